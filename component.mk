@@ -5,6 +5,11 @@ COMPONENT_INCDIRS := src/include
 
 COMPONENT_CFLAGS := -Wno-unused-function
 
+# Serialise filesystem access so it may be used from multiple threads (e.g. FreeRTOS tasks)
+COMPONENT_VARS += LFS_ENABLE_LOCKING
+LFS_ENABLE_LOCKING ?= 0
+GLOBAL_CFLAGS += -DLFS_ENABLE_LOCKING=$(LFS_ENABLE_LOCKING)
+
 HWCONFIG_BUILDSPECS += $(COMPONENT_PATH)/build.json
 
 LFS_TOOLS := $(COMPONENT_PATH)/tools
@@ -14,17 +19,21 @@ LFSCOPY := $(LFSCOPY_TOOL) --nonet --debug=0 --
 $(LFSCOPY_TOOL):
 	$(Q) $(MAKE) -C $(LFS_TOOLS)/fscopy SMING_ARCH=Host SMING_RELEASE=1 ENABLE_CUSTOM_LWIP=2
 
+# Update existing images instead of rebuilding them every time
+COMPONENT_VARS += LFS_BUILD_INCREMENTAL
+LFS_BUILD_INCREMENTAL ?= 0
+
 # Target invoked via partition table
 ifneq (,$(filter lfs-build,$(MAKECMDGOALS)))
 PART_TARGET := $(PARTITION_$(PART)_FILENAME)
 ifneq (,$(PART_TARGET))
 $(eval PART_CONFIG := $(call HwExpr,part.build['config']))
+$(eval PART_BLOCKSIZE := $(call HwExpr,part.build.get('blocksize', 0)))
 .PHONY: lfs-build
 lfs-build: $(LFSCOPY_TOOL)
 	@echo "Creating intermediate FWFS image..."
 	$(Q) $(FSBUILD) -i "$(subst ",\",$(PART_CONFIG))" -o $(PART_TARGET).fwfs
 	@echo "Creating LFS image '$(PART_TARGET)'"
-	$(Q) $(LFSCOPY) $(PART_TARGET).fwfs $(PART_TARGET).tmp $(PARTITION_$(PART)_SIZE_BYTES)
-	$(Q) mv $(PART_TARGET).tmp $(PART_TARGET)
+	$(Q) $(LFSCOPY) $(PART_TARGET).fwfs $(PART_TARGET) $(PARTITION_$(PART)_SIZE_BYTES) blocksize=$(PART_BLOCKSIZE) update=$(LFS_BUILD_INCREMENTAL)
 endif
 endif
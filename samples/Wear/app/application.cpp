@@ -2,6 +2,7 @@
 #include <LittleFS.h>
 #include <IFS/FileCopier.h>
 #include <IFS/Debug.h>
+#include <numeric>
 
 namespace
 {
@@ -32,9 +33,16 @@ public:
 			++count[blockNumber];
 		}
 
+		size_t total() const
+		{
+			return std::accumulate(count.get(), count.get() + blockCount, size_t(0));
+		}
+
 		size_t printTo(Print& p) const
 		{
 			size_t n{0};
+			n += p.print(_F("total "));
+			n += p.print(total());
 			for(unsigned i = 0; i < blockCount; ++i) {
 				if(i % 8 == 0) {
 					n += p.println();
@@ -137,7 +145,12 @@ void fstest()
 	for(unsigned i = 0; i < writeCount; ++i) {
 		char buffer[256];
 		os_get_random(reinterpret_cast<uint8_t*>(buffer), sizeof(buffer));
-		fileSetContent("config.bin", buffer, sizeof(buffer));
+		// Data, modification time and attributes should all go in a single commit
+		auto file = fs->open("config.bin", File::CreateNewAlways | File::WriteOnly);
+		fs->write(file, buffer, sizeof(buffer));
+		auto role = IFS::UserRole::Admin;
+		fs->fsetxattr(file, IFS::AttributeTag::WriteAce, &role, sizeof(role));
+		fs->close(file);
 	}
 
 	fs->setProfiler(nullptr);
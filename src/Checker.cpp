@@ -0,0 +1,400 @@
+/**
+ * Checker.cpp
+ *
+ * Copyright 2021 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the Sming-LittleFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#include "include/LittleFS/Checker.h"
+#include "../littlefs/lfs_util.h"
+#include <algorithm>
+
+namespace IFS
+{
+namespace LittleFS
+{
+size_t CheckReport::printTo(Print& p) const
+{
+	size_t n{0};
+#define XX(name) n += p.print(_F(" " #name "=")) + p.print(name);
+	XX(metadataPairs)
+	XX(directories)
+	XX(files)
+	XX(usedBlocks)
+	XX(corruptPairs)
+	XX(badEntries)
+	XX(badPointers)
+	XX(crossLinks)
+	XX(orphans)
+	XX(leakedBlocks)
+#undef XX
+	return n;
+}
+
+Checker::Checker(const lfs_config& cfg, const lfs_t& lfs)
+	: cfg(cfg), reader(cfg, &lfs), usedMap(new uint32_t[(cfg.block_count + 31) / 32]{}),
+	  // Top bit of count indicates superblock needs updating (littlefs v2.5)
+	  pendingOrphans(Tag{lfs.gdisk.tag}.size() & 0x1ff)
+{
+}
+
+int Checker::step(unsigned budget)
+{
+	if(!usedMap) {
+		return LFS_ERR_NOMEM;
+	}
+
+	while(budget != 0 && state != State::Complete) {
+		--budget;
+
+		switch(state) {
+		case State::Metadata: {
+			++report.metadataPairs;
+			// Also detects loops in the tail list
+			bool ok = markBlock(next[0]);
+			ok = markBlock(next[1]) && ok;
+			if(!ok) {
+				finish();
+				break;
+			}
+			if(nextIsHead) {
+				dirs.push_back({{next[0], next[1]}, 0});
+			}
+			dirs.back().blockCount += 2;
+			int err = fetch(next, mdir);
+			if(err == LFS_ERR_CORRUPT) {
+				// Cannot follow tail list without valid metadata
+				++report.corruptPairs;
+				finish();
+				break;
+			}
+			if(err < 0) {
+				return err;
+			}
+			entryId = 0;
+			state = State::Entries;
+			break;
+		}
+
+		case State::Entries: {
+			if(entryId >= mdir.count) {
+				if(mdir.tail[0] == BLOCK_NULL || mdir.tail[1] == BLOCK_NULL) {
+					finish();
+					break;
+				}
+				next[0] = mdir.tail[0];
+				next[1] = mdir.tail[1];
+				nextIsHead = !mdir.split;
+				state = State::Metadata;
+				break;
+			}
+			int err = checkEntry();
+			if(err < 0) {
+				return err;
+			}
+			++entryId;
+			break;
+		}
+
+		case State::File: {
+			if(!markBlock(ctzBlock)) {
+				state = State::Entries;
+				break;
+			}
+			++dirs.back().blockCount;
+			if(ctzIndex == 0) {
+				state = State::Entries;
+				break;
+			}
+			uint8_t buf[4];
+			int err = reader.read(ctzBlock, 0, buf, sizeof(buf));
+			if(err < 0) {
+				return err;
+			}
+			ctzBlock = fromle32(buf);
+			--ctzIndex;
+			break;
+		}
+
+		case State::Complete:
+			break;
+		}
+	}
+
+	return (state == State::Complete) ? 0 : 1;
+}
+
+/*
+ * Mark block as in use
+ * @retval bool false if block is invalid or already in use
+ */
+bool Checker::markBlock(lfs_block_t block)
+{
+	if(block >= cfg.block_count) {
+		++report.badPointers;
+		return false;
+	}
+	auto& word = usedMap[block / 32];
+	uint32_t mask = 1U << (block % 32);
+	if(word & mask) {
+		++report.crossLinks;
+		return false;
+	}
+	word |= mask;
+	++report.usedBlocks;
+	return true;
+}
+
+/*
+ * Fetch metadata pair, choosing the block with the most recent valid commit as `lfs_dir_fetch` does
+ */
+int Checker::fetch(const lfs_block_t pair[2], lfs_mdir_t& dir)
+{
+	uint32_t revs[2];
+	for(unsigned i = 0; i < 2; ++i) {
+		uint8_t buf[4];
+		int err = reader.read(pair[i], 0, buf, sizeof(buf));
+		if(err < 0) {
+			return err;
+		}
+		revs[i] = fromle32(buf);
+	}
+
+	unsigned r = (int32_t(revs[1] - revs[0]) > 0) ? 1 : 0;
+	for(unsigned i = 0; i < 2; ++i) {
+		auto block = pair[r];
+		int err = fetchBlock(block, dir);
+		if(err == 0) {
+			dir.pair[0] = block;
+			dir.pair[1] = pair[r ^ 1];
+			return 0;
+		}
+		if(err != LFS_ERR_CORRUPT) {
+			return err;
+		}
+		r ^= 1;
+	}
+
+	return LFS_ERR_CORRUPT;
+}
+
+/*
+ * Validate commits in a metadata block, recording state as of the last valid one.
+ *
+ * Each commit is a sequence of tags, XOR'd with the previous tag and terminated by a CRC tag
+ * covering everything since the previous CRC (or start of block).
+ */
+int Checker::fetchBlock(lfs_block_t block, lfs_mdir_t& dir)
+{
+	uint8_t buf[32];
+	int err = reader.read(block, 0, buf, 4);
+	if(err < 0) {
+		return err;
+	}
+	uint32_t crc = lfs_crc(0xffffffff, buf, 4);
+	dir = lfs_mdir_t{};
+	dir.rev = fromle32(buf);
+	dir.tail[0] = dir.tail[1] = BLOCK_NULL;
+
+	lfs_off_t off{0};
+	uint32_t ptag{0xffffffff};
+	uint16_t tempCount{0};
+	lfs_block_t tempTail[2]{BLOCK_NULL, BLOCK_NULL};
+	bool tempSplit{false};
+
+	for(;;) {
+		off += Tag{ptag}.dsize();
+		err = reader.read(block, off, buf, 4);
+		if(err == LFS_ERR_CORRUPT) {
+			// Out of range
+			break;
+		}
+		if(err < 0) {
+			return err;
+		}
+		crc = lfs_crc(crc, buf, 4);
+		Tag tag{frombe32(buf) ^ ptag};
+		if(!tag.isValid() || off + tag.dsize() > cfg.block_size) {
+			break;
+		}
+		ptag = tag.value;
+
+		if(tag.isCommitCrc()) {
+			err = reader.read(block, off + 4, buf, 4);
+			if(err < 0) {
+				return err;
+			}
+			if(crc != fromle32(buf)) {
+				// Partially written commit, or corruption
+				break;
+			}
+			// Expected valid bit for next commit
+			ptag ^= uint32_t(tag.chunk() & 1) << 31;
+			dir.off = off + tag.dsize();
+			dir.etag = ptag;
+			dir.count = tempCount;
+			dir.tail[0] = tempTail[0];
+			dir.tail[1] = tempTail[1];
+			dir.split = tempSplit;
+			crc = 0xffffffff;
+			continue;
+		}
+
+		// Include tag data in CRC
+		lfs_off_t dataOffset = off + 4;
+		lfs_size_t dataSize = tag.dsize() - 4;
+		while(dataSize != 0) {
+			auto n = std::min(dataSize, lfs_size_t(sizeof(buf)));
+			err = reader.read(block, dataOffset, buf, n);
+			if(err < 0) {
+				return err;
+			}
+			if(dataOffset == off + 4 && tag.type1() == LFS_TYPE_TAIL && n >= 8) {
+				tempSplit = tag.chunk() & 1;
+				tempTail[0] = fromle32(&buf[0]);
+				tempTail[1] = fromle32(&buf[4]);
+			}
+			crc = lfs_crc(crc, buf, n);
+			dataOffset += n;
+			dataSize -= n;
+		}
+
+		if(tag.type1() == LFS_TYPE_NAME) {
+			if(tag.id() >= tempCount) {
+				tempCount = tag.id() + 1;
+			}
+		} else if(tag.type1() == LFS_TYPE_SPLICE) {
+			tempCount += tag.splice();
+		}
+	}
+
+	return (dir.off != 0) ? 0 : LFS_ERR_CORRUPT;
+}
+
+/*
+ * Check entry `entryId` in current metadata pair
+ */
+int Checker::checkEntry()
+{
+	lfs_off_t off;
+	int32_t res = reader.findTag(mdir, Tag::make(0x780, 0x3ff, 0), Tag::make(LFS_TYPE_NAME, entryId, 0), off);
+	if(res == LFS_ERR_NOENT) {
+		// Not a file or directory, e.g. superblock
+		return 0;
+	}
+	if(res < 0) {
+		return res;
+	}
+	Tag nameTag{uint32_t(res)};
+
+	res = reader.findTag(mdir, Tag::make(0x700, 0x3ff, 0), Tag::make(LFS_TYPE_STRUCT, entryId, 0), off);
+	if(res == LFS_ERR_NOENT) {
+		++report.badEntries;
+		return 0;
+	}
+	if(res < 0) {
+		return res;
+	}
+	Tag structTag{uint32_t(res)};
+
+	uint8_t buf[8];
+	if(structTag.type() != LFS_TYPE_INLINESTRUCT) {
+		if(structTag.size() < sizeof(buf)) {
+			++report.badEntries;
+			return 0;
+		}
+		int err = reader.read(mdir.pair[0], off, buf, sizeof(buf));
+		if(err < 0) {
+			return err;
+		}
+	}
+
+	switch(nameTag.type()) {
+	case LFS_TYPE_DIR:
+		if(structTag.type() != LFS_TYPE_DIRSTRUCT) {
+			++report.badEntries;
+			break;
+		}
+		referencedDirs.push_back({{fromle32(&buf[0]), fromle32(&buf[4])}, 0});
+		break;
+
+	case LFS_TYPE_REG: {
+		++report.files;
+		if(structTag.type() == LFS_TYPE_INLINESTRUCT) {
+			break;
+		}
+		if(structTag.type() != LFS_TYPE_CTZSTRUCT) {
+			++report.badEntries;
+			break;
+		}
+		lfs_size_t size = fromle32(&buf[4]);
+		if(size == 0) {
+			break;
+		}
+		lfs_off_t last = size - 1;
+		ctzBlock = fromle32(&buf[0]);
+		ctzIndex = reader.ctzIndex(last);
+		state = State::File;
+		break;
+	}
+
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+void Checker::finish()
+{
+	report.directories = dirs.size();
+
+	/*
+	 * An operation interrupted by power loss may leave a directory unreferenced, or referenced by the
+	 * parent at a pair which differs in one block (a 'half-orphan') following relocation.
+	 * littlefs records this in the global state and repairs it before the next write,
+	 * so such directories are only counted as leaked blocks.
+	 */
+	bool pending = pendingOrphans != 0;
+
+	// First entry is the root directory, which has no parent
+	for(unsigned i = 1; i < dirs.size(); ++i) {
+		auto& dir = dirs[i];
+		auto it = std::find_if(referencedDirs.begin(), referencedDirs.end(),
+							   [&](const DirInfo& ref) { return pairMatch(ref.pair, dir.pair); });
+		if(it == referencedDirs.end()) {
+			if(!pending) {
+				++report.orphans;
+			}
+			report.leakedBlocks += dir.blockCount;
+		}
+	}
+
+	for(auto& ref : referencedDirs) {
+		auto it = std::find_if(dirs.begin(), dirs.end(), [&](const DirInfo& dir) {
+			return pairMatch(ref.pair, dir.pair) || (pending && pairOverlap(ref.pair, dir.pair));
+		});
+		if(it == dirs.end()) {
+			++report.badEntries;
+		}
+	}
+
+	referencedDirs.clear();
+	dirs.clear();
+	state = State::Complete;
+}
+
+} // namespace LittleFS
+} // namespace IFS
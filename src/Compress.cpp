@@ -0,0 +1,141 @@
+/**
+ * Compress.cpp
+ *
+ * Copyright 2021 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the Sming-LittleFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#include "include/LittleFS/Compress.h"
+#include <algorithm>
+#include <cstring>
+
+namespace IFS
+{
+namespace LittleFS
+{
+namespace Compress
+{
+namespace
+{
+constexpr size_t minMatch{3};
+constexpr size_t maxMatch{minMatch + 15};
+constexpr size_t maxOffset{4096};
+
+unsigned hash(const uint8_t* p)
+{
+	uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+	return (v * 2654435761U) >> 22;
+}
+
+static_assert(hashSize == 1024, "hash() produces 10 bits");
+
+} // namespace
+
+size_t compress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize, uint16_t* table)
+{
+	// Entries are position + 1, 0 if unused
+	memset(table, 0, hashSize * sizeof(uint16_t));
+
+	size_t in{0};
+	size_t out{0};
+	size_t flagPos{0};
+	unsigned flagBit{8};
+	while(in < srcSize) {
+		if(flagBit == 8) {
+			if(out >= dstSize) {
+				return 0;
+			}
+			flagPos = out++;
+			dst[flagPos] = 0;
+			flagBit = 0;
+		}
+
+		size_t matchLen{0};
+		size_t matchOffset{0};
+		if(in + minMatch <= srcSize) {
+			auto& entry = table[hash(&src[in])];
+			if(entry != 0 && in - (entry - 1) <= maxOffset) {
+				size_t cand = entry - 1;
+				auto maxLen = std::min(maxMatch, srcSize - in);
+				while(matchLen < maxLen && src[cand + matchLen] == src[in + matchLen]) {
+					++matchLen;
+				}
+				matchOffset = in - cand;
+			}
+			entry = in + 1;
+		}
+
+		if(matchLen >= minMatch) {
+			if(out + 2 > dstSize) {
+				return 0;
+			}
+			uint16_t code = ((matchOffset - 1) << 4) | (matchLen - minMatch);
+			dst[out++] = code;
+			dst[out++] = code >> 8;
+			dst[flagPos] |= 1 << flagBit;
+			// Positions within match may be referred to later
+			for(size_t i = 1; i < matchLen && in + i + minMatch <= srcSize; ++i) {
+				table[hash(&src[in + i])] = in + i + 1;
+			}
+			in += matchLen;
+		} else {
+			if(out >= dstSize) {
+				return 0;
+			}
+			dst[out++] = src[in++];
+		}
+		++flagBit;
+	}
+
+	return out;
+}
+
+int decompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize)
+{
+	size_t in{0};
+	size_t out{0};
+	while(in < srcSize) {
+		uint8_t flags = src[in++];
+		for(unsigned bit = 0; bit < 8 && in < srcSize; ++bit) {
+			if(flags & (1 << bit)) {
+				if(in + 2 > srcSize) {
+					return -1;
+				}
+				uint16_t code = src[in] | (src[in + 1] << 8);
+				in += 2;
+				size_t offset = (code >> 4) + 1;
+				size_t len = (code & 0x0f) + minMatch;
+				if(offset > out || out + len > dstSize) {
+					return -1;
+				}
+				// Regions may overlap
+				for(; len != 0; --len, ++out) {
+					dst[out] = dst[out - offset];
+				}
+			} else {
+				if(out >= dstSize) {
+					return -1;
+				}
+				dst[out++] = src[in++];
+			}
+		}
+	}
+
+	return out;
+}
+
+} // namespace Compress
+} // namespace LittleFS
+} // namespace IFS
@@ -0,0 +1,36 @@
+/**
+ * Delta.cpp
+ *
+ * Copyright 2021 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the Sming-LittleFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#include "include/LittleFS/Delta.h"
+#include "../littlefs/lfs_util.h"
+
+namespace IFS
+{
+namespace LittleFS
+{
+namespace Delta
+{
+uint32_t crc(uint32_t crc, const void* data, size_t size)
+{
+	return lfs_crc(crc, data, size);
+}
+
+} // namespace Delta
+} // namespace LittleFS
+} // namespace IFS
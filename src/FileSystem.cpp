@@ -21,21 +21,44 @@
 
 #include "include/LittleFS/FileSystem.h"
 #include "include/LittleFS/Error.h"
+#include "include/LittleFS/Metadata.h"
+#include "../littlefs/lfs_util.h"
 #include <IFS/Util.h>
+#include <Data/Stream/DataSourceStream.h>
+#include <climits>
+#include <cstddef>
+#include <type_traits>
 
 namespace IFS
 {
 namespace LittleFS
 {
-/**
- * @brief LittleFS directory object
+namespace
+{
+/*
+ * Tags from `LFS_ATTR_PRIVATE_MIN` are used internally so not available to applications
  */
-struct FileDir {
-	lfs_dir_t dir;
+bool isPublicTag(AttributeTag tag)
+{
+	return unsigned(tag) < LFS_ATTR_PRIVATE_MIN;
+}
+
+struct WearStateHeader {
+	uint32_t blockCount;
+	uint32_t crc; ///< Covers the following counts
 };
 
-namespace
+size_t getWearStateSize(lfs_size_t blockCount)
 {
+	return sizeof(WearStateHeader) + blockCount * sizeof(uint32_t);
+}
+
+struct AllocStateHeader {
+	uint32_t blockCount;
+	lfs_block_t next; ///< Next block the allocator will consider
+	uint32_t crc;	  ///< Covers the following block map
+};
+
 void fillStat(Stat& stat, const lfs_info& info)
 {
 	auto name = info.name;
@@ -49,6 +72,104 @@ void fillStat(Stat& stat, const lfs_info& info)
 	checkStat(stat);
 }
 
+/*
+ * Add a directory to the list of open metadata which littlefs keeps updated on commit,
+ * as `lfs_dir_open()` does internally. `lfs_dir_close()` removes it again.
+ *
+ * There is no public API for this: it depends on `lfs_dir_t` starting with the same fields
+ * as `lfs_t::mlist` entries, as in littlefs v2. Check this when updating the littlefs submodule.
+ */
+void attachOpenDir(lfs_t& lfs, lfs_dir_t& dir)
+{
+	using lfs_mlist_t = std::remove_pointer_t<decltype(lfs.mlist)>;
+	static_assert(offsetof(lfs_dir_t, m) == offsetof(lfs_mlist_t, m) &&
+					  offsetof(lfs_dir_t, id) == offsetof(lfs_mlist_t, id) &&
+					  offsetof(lfs_dir_t, type) == offsetof(lfs_mlist_t, type),
+				  "lfs_dir_t layout changed");
+	auto mlist = reinterpret_cast<lfs_mlist_t*>(&dir);
+	mlist->next = lfs.mlist;
+	lfs.mlist = mlist;
+}
+
+bool isBlockUsed(const uint32_t* map, lfs_block_t block)
+{
+	return map[block / 32] & (1U << (block % 32));
+}
+
+/*
+ * Access to the block allocator's lookahead window, `lfs_t::free`.
+ *
+ * There is no public API for this: it depends on the littlefs v2 allocator, whose window covers
+ * `size` blocks from `off`, of which the first `i` have been handed out, and which reports no space
+ * once `ack` blocks have been considered without a commit. littlefs v2.9 reworked the allocator,
+ * so check this when updating the littlefs submodule.
+ */
+class Lookahead
+{
+public:
+	static_assert(LFS_VERSION < 0x00020009, "littlefs allocator changed");
+	static_assert(std::is_same<decltype(lfs_t::free.buffer), uint32_t*>::value, "lfs_t::free layout changed");
+
+	Lookahead(lfs_t& lfs) : alloc(lfs.free), cfg(*lfs.cfg)
+	{
+	}
+
+	/**
+	 * @brief Get the next block the allocator will consider
+	 */
+	lfs_block_t next() const
+	{
+		return (alloc.off + alloc.i) % cfg.block_count;
+	}
+
+	/**
+	 * @brief Determine if window should be refilled, because it's empty or largely used
+	 */
+	bool isExhausted(unsigned threshold) const
+	{
+		return alloc.size == 0 || (alloc.i != 0 && getFreeCount() < alloc.size / threshold);
+	}
+
+	/**
+	 * @brief Count free blocks remaining in the window
+	 */
+	lfs_size_t getFreeCount() const
+	{
+		lfs_size_t count{0};
+		for(lfs_size_t i = alloc.i; i < alloc.size; ++i) {
+			if(!(alloc.buffer[i / 32] & (1U << (i % 32)))) {
+				++count;
+			}
+		}
+		return count;
+	}
+
+	/**
+	 * @brief Load the window starting at the given block
+	 *
+	 * This is exactly what `lfs_alloc` does when its window is exhausted, but using a map
+	 * we already have avoids another filesystem traversal.
+	 */
+	void load(lfs_block_t start, const uint32_t* map)
+	{
+		auto blockCount = cfg.block_count;
+		alloc.off = start;
+		alloc.size = std::min(lfs_size_t(8 * cfg.lookahead_size), blockCount);
+		alloc.i = 0;
+		alloc.ack = blockCount;
+		memset(alloc.buffer, 0, cfg.lookahead_size);
+		for(lfs_size_t i = 0; i < alloc.size; ++i) {
+			if(isBlockUsed(map, (start + i) % blockCount)) {
+				alloc.buffer[i / 32] |= 1U << (i % 32);
+			}
+		}
+	}
+
+private:
+	decltype(lfs_t::free)& alloc;
+	const lfs_config& cfg;
+};
+
 } // namespace
 
 /**
@@ -84,6 +205,12 @@ OpenFlags mapFileOpenFlags(OpenFlags flags, lfs_open_flags& lfsflags)
 	return flags;
 }
 
+// Serialise access from multiple threads, see Mutex.h
+#define FS_LOCK() MutexLock fsLock(mutex);
+
+// Attribute device accesses to a filesystem operation
+#define PROFILE_OP(op) Profiler::Scope profileScope(lfsProfiler, Profiler::Operation::op);
+
 #define CHECK_MOUNTED()                                                                                                \
 	if(!mounted) {                                                                                                     \
 		return Error::NotMounted;                                                                                      \
@@ -94,8 +221,8 @@ OpenFlags mapFileOpenFlags(OpenFlags flags, lfs_open_flags& lfsflags)
 	if(file < LFS_HANDLE_MIN || file > LFS_HANDLE_MAX) {                                                               \
 		return Error::InvalidHandle;                                                                                   \
 	}                                                                                                                  \
-	auto& fd = fileDescriptors[file - LFS_HANDLE_MIN];                                                                 \
-	if(fd == nullptr) {                                                                                                \
+	auto fd = fileDescriptors[file - LFS_HANDLE_MIN];                                                                  \
+	if(fd == nullptr || fd->flags[FileDescriptor::Flag::Removed]) {                                                    \
 		return Error::FileNotOpen;                                                                                     \
 	}
 
@@ -113,6 +240,8 @@ FileSystem::~FileSystem()
 
 int FileSystem::mount()
 {
+	FS_LOCK()
+	PROFILE_OP(mount)
 	if(!partition) {
 		return Error::NoPartition;
 	}
@@ -121,13 +250,18 @@ int FileSystem::mount()
 		return Error::BadPartition;
 	}
 
-	config.block_count = partition.size() / LFS_BLOCK_SIZE;
-
-	auto res = tryMount();
+	int res = configure(true);
 	if(res < 0) {
+		return res;
+	}
+
+	statCache.clear();
+	dirCache.clear();
+	res = tryMount();
+	if(res < 0 && config.formatOnFail) {
 		/*
-		 * Mount failed, so we either try to repair the system or format it.
-		 * For now, just format it.
+		 * Mount failed, so format it.
+		 * Applications wishing to retain data should disable `formatOnFail` and use `check()`.
 		 */
 		debug_w("[LFS] Mount failed, formatting");
 		format();
@@ -137,21 +271,388 @@ int FileSystem::mount()
 	return res;
 }
 
+/*
+ * Read block size from an existing superblock, if there is one.
+ *
+ * The superblock entry is always the first in a metadata commit, giving:
+ *
+ *	0	revision count
+ *	4	tag
+ *	8	"littlefs"
+ *	16	tag
+ *	20	version
+ *	24	block size
+ *
+ * The superblock pair is blocks 0 and 1, either of which may be erased or part-way through
+ * compaction, so both are checked and the one with the newer revision is used. Block 1 is
+ * found at the block size given by block 0 or, failing that, by trying power-of-two multiples
+ * of the erase size: the right one records its own offset as the block size.
+ *
+ * Geometry is only guessed if neither copy can be found, so a volume is never formatted
+ * (via `Config::formatOnFail`) because its block size was misread.
+ */
+size_t FileSystem::readSuperblockBlockSize()
+{
+	struct Superblock {
+		uint32_t revision;
+		uint32_t tag;
+		char magic[8];
+		uint32_t tag2;
+		uint32_t version;
+		uint32_t blockSize;
+	};
+	auto read = [&](storage_size_t offset, Superblock& sb) {
+		return partition.read(offset, &sb, sizeof(sb)) && memcmp(sb.magic, "littlefs", 8) == 0 &&
+			   sb.blockSize >= LFS_MIN_BLOCK_SIZE;
+	};
+	auto readBlock1 = [&](size_t blockSize, Superblock& sb) {
+		return blockSize <= partition.size() / 2 && read(blockSize, sb) && sb.blockSize == blockSize;
+	};
+
+	Superblock sb0, sb1;
+	bool valid0 = read(0, sb0);
+	bool valid1 = valid0 && readBlock1(sb0.blockSize, sb1);
+	if(!valid1) {
+		size_t minSize = std::max(size_t(partition.getBlockSize()), LFS_MIN_BLOCK_SIZE);
+		for(size_t blockSize = minSize; !valid1 && blockSize <= partition.size() / 2; blockSize *= 2) {
+			valid1 = readBlock1(blockSize, sb1);
+		}
+	}
+
+	// Revisions are sequence numbers, so compare as littlefs does
+	if(valid1 && (!valid0 || int32_t(sb1.revision - sb0.revision) > 0)) {
+		if(!valid0) {
+			debug_w("[LFS] Superblock 0 invalid, using block 1");
+		}
+		return sb1.blockSize;
+	}
+	return valid0 ? sb0.blockSize : 0;
+}
+
+/*
+ * Determine block geometry, check settings against littlefs requirements and allocate buffers
+ *
+ * @param useExisting true to retain block size of any existing volume
+ */
+int FileSystem::configure(bool useExisting)
+{
+	auto& c = config;
+
+	/*
+	 * Erase size for the device.
+	 * Flash is byte-addressable for reads and writes, but sector devices (SD cards, disks)
+	 * require whole-sector transfers so read/prog granularity must match.
+	 */
+	size_t eraseSize = partition.getBlockSize();
+	auto device = partition.getDevice();
+	auto devType = device ? device->getType() : Storage::Device::Type::unknown;
+	bool isSectorDevice = (devType == Storage::Device::Type::sdcard || devType == Storage::Device::Type::disk);
+
+	size_t blockSize = c.blockSize;
+	if(blockSize == 0) {
+		if(useExisting) {
+			blockSize = readSuperblockBlockSize();
+		}
+		if(blockSize == 0) {
+			blockSize = (eraseSize >= LFS_MIN_BLOCK_SIZE) ? eraseSize : LFS_BLOCK_SIZE;
+		}
+	}
+	size_t readSize = c.readSize;
+	size_t progSize = c.progSize;
+	if(isSectorDevice) {
+		readSize = std::max(readSize, eraseSize);
+		progSize = std::max(progSize, eraseSize);
+	}
+	size_t cacheSize = std::max({c.cacheSize, readSize, progSize});
+
+	bool ok = (readSize != 0) && (progSize != 0);
+	ok = ok && (cacheSize % readSize == 0) && (cacheSize % progSize == 0);
+	ok = ok && (blockSize >= LFS_MIN_BLOCK_SIZE) && (blockSize % cacheSize == 0);
+	ok = ok && (eraseSize == 0 || blockSize % eraseSize == 0);
+	ok = ok && (c.lookaheadSize != 0) && (c.lookaheadSize % 8 == 0);
+	ok = ok && (partition.size() / blockSize >= 2);
+	ok = ok && (c.readAheadSize % readSize == 0);
+	ok = ok && (c.blockCycles != 0);
+	if(!ok) {
+		debug_e("[LFS] Bad config: block %u, erase %u, read %u, prog %u, cache %u, lookahead %u", blockSize, eraseSize,
+				readSize, progSize, cacheSize, c.lookaheadSize);
+		return Error::BadParam;
+	}
+
+	if(cacheSize != lfsConfig.cache_size) {
+		readBuffer.reset(new uint8_t[cacheSize]);
+		progBuffer.reset(new uint8_t[cacheSize]);
+	}
+	if(c.lookaheadSize != lfsConfig.lookahead_size) {
+		lookaheadBuffer.reset(new uint32_t[c.lookaheadSize / 4]);
+	}
+	if(!readBuffer || !progBuffer || !lookaheadBuffer) {
+		lfsConfig.cache_size = lfsConfig.lookahead_size = 0;
+		return Error::NoMem;
+	}
+
+	// Counts are retained across re-configuration, such as by `format()`, unless geometry changes
+	lfs_size_t blockCount = partition.size() / blockSize;
+	if(c.trackWear && (!wearCounts || blockCount != lfsConfig.block_count)) {
+		wearCounts.reset(new uint32_t[blockCount]{});
+		wearStateLoaded = false;
+		if(!wearCounts) {
+			return Error::NoMem;
+		}
+		if(getWearStateSize(blockCount) > (lfsConfig.attr_max ?: LFS_ATTR_MAX)) {
+			debug_w("[LFS] %u blocks, too many for `saveWearState()`", blockCount);
+		}
+	}
+
+	readAheadPool.configure(c.readAheadSize, c.readAheadBuffers);
+
+	lfsConfig.read_size = readSize;
+	lfsConfig.prog_size = progSize;
+	lfsConfig.block_size = blockSize;
+	lfsConfig.block_count = blockCount;
+	lfsConfig.cache_size = cacheSize;
+	lfsConfig.lookahead_size = c.lookaheadSize;
+	lfsConfig.read_buffer = readBuffer.get();
+	lfsConfig.prog_buffer = progBuffer.get();
+	lfsConfig.lookahead_buffer = lookaheadBuffer.get();
+	lfsConfig.block_cycles = c.blockCycles;
+
+	return FS_OK;
+}
+
 int FileSystem::tryMount()
 {
 	assert(!mounted);
 	lfs = lfs_t{};
-	auto err = lfs_mount(&lfs, &config);
+	usedMap.reset();
+	auto err = lfs_mount(&lfs, &lfsConfig);
 	if(err < 0) {
 		err = translateLfsError(err);
 		debug_ifserr(err, "lfs_mount()");
 		return err;
 	}
 
-	get_attr("", AttributeTag::ReadAce, rootAcl.readAccess);
-	get_attr("", AttributeTag::WriteAce, rootAcl.writeAccess);
-
+	rootAcl = ACL{};
+	rootAclLoaded = false;
+	allocStateSaved = false;
 	mounted = true;
+
+	loadAllocState();
+	if(wearCounts && !wearStateLoaded) {
+		loadWearState();
+		wearStateLoaded = true;
+	}
+
+	return FS_OK;
+}
+
+/*
+ * Root ACL is read on first use so mounting doesn't need to fetch attributes
+ */
+const ACL& FileSystem::getRootAcl()
+{
+	if(!rootAclLoaded) {
+		get_attr("", AttributeTag::ReadAce, rootAcl.readAccess);
+		get_attr("", AttributeTag::WriteAce, rootAcl.writeAccess);
+		rootAclLoaded = true;
+	}
+	return rootAcl;
+}
+
+int FileSystem::saveAllocState()
+{
+	FS_LOCK()
+	CHECK_MOUNTED()
+
+	auto words = (lfsConfig.block_count + 31) / 32;
+	size_t size = sizeof(AllocStateHeader) + words * sizeof(uint32_t);
+	if(size > lfs.attr_max) {
+		return Error::TooBig;
+	}
+	std::unique_ptr<uint8_t[]> buffer(new uint8_t[size]);
+	if(!buffer) {
+		return Error::NoMem;
+	}
+
+	/*
+	 * Writing the attribute may cause the root directory to be compacted or relocated.
+	 * That changes the set of used blocks, so map is rebuilt and stored again.
+	 * Root will then have free space so a second attempt doesn't need to erase anything.
+	 */
+	for(unsigned attempt = 0; attempt < 2; ++attempt) {
+		std::unique_ptr<uint32_t[]> map;
+		int err = getUsedMap(map);
+		if(err < 0) {
+			return err;
+		}
+		AllocStateHeader hdr{
+			lfsConfig.block_count,
+			Lookahead(lfs).next(),
+			lfs_crc(0xffffffff, map.get(), words * sizeof(uint32_t)),
+		};
+		memcpy(buffer.get(), &hdr, sizeof(hdr));
+		memcpy(&buffer[sizeof(hdr)], map.get(), words * sizeof(uint32_t));
+
+		auto erased = eraseCount;
+		err = lfs_setattr(&lfs, "", LFS_ATTR_ALLOC_STATE, buffer.get(), size);
+		if(err < 0) {
+			return translateLfsError(err);
+		}
+		allocStateSaved = true;
+		if(eraseCount == erased) {
+			setUsedMap(std::move(map));
+			return FS_OK;
+		}
+	}
+
+	debug_w("[LFS] Allocator state unstable, not saved");
+	return dropAllocState() ?: Error::WriteFailure;
+}
+
+/*
+ * Use saved allocator state, if present, to fill the lookahead buffer and the used block map.
+ * The state is only valid until the filesystem is modified, see `dropAllocState()`.
+ */
+void FileSystem::loadAllocState()
+{
+	auto words = (lfsConfig.block_count + 31) / 32;
+	size_t size = sizeof(AllocStateHeader) + words * sizeof(uint32_t);
+	if(size > lfs.attr_max) {
+		return;
+	}
+	std::unique_ptr<uint8_t[]> buffer(new uint8_t[size]);
+	if(!buffer) {
+		return;
+	}
+	int res = lfs_getattr(&lfs, "", LFS_ATTR_ALLOC_STATE, buffer.get(), size);
+	if(res < 0) {
+		return;
+	}
+	// Present, so must be removed before any modification
+	allocStateSaved = true;
+
+	AllocStateHeader hdr;
+	memcpy(&hdr, buffer.get(), sizeof(hdr));
+	if(lfs_size_t(res) != size || hdr.blockCount != lfsConfig.block_count || hdr.next >= hdr.blockCount) {
+		debug_w("[LFS] Allocator state invalid");
+		return;
+	}
+	std::unique_ptr<uint32_t[]> map(new uint32_t[words]);
+	if(!map) {
+		return;
+	}
+	memcpy(map.get(), &buffer[sizeof(hdr)], words * sizeof(uint32_t));
+	if(lfs_crc(0xffffffff, map.get(), words * sizeof(uint32_t)) != hdr.crc) {
+		debug_w("[LFS] Allocator state CRC mismatch");
+		return;
+	}
+
+	Lookahead(lfs).load(hdr.next, map.get());
+	setUsedMap(std::move(map));
+}
+
+int FileSystem::saveWearState()
+{
+	FS_LOCK()
+	CHECK_MOUNTED()
+
+	if(!wearCounts) {
+		return Error::NotSupported;
+	}
+	size_t size = getWearStateSize(lfsConfig.block_count);
+	size_t countSize = size - sizeof(WearStateHeader);
+	if(size > lfs.attr_max) {
+		return Error::TooBig;
+	}
+	int err = dropAllocState();
+	if(err < 0) {
+		return err;
+	}
+	std::unique_ptr<uint8_t[]> buffer(new uint8_t[size]);
+	if(!buffer) {
+		return Error::NoMem;
+	}
+
+	// Any erases caused by the commit itself are recorded on the next save
+	WearStateHeader hdr{
+		lfsConfig.block_count,
+		lfs_crc(0xffffffff, wearCounts.get(), countSize),
+	};
+	memcpy(buffer.get(), &hdr, sizeof(hdr));
+	memcpy(&buffer[sizeof(hdr)], wearCounts.get(), countSize);
+	err = lfs_setattr(&lfs, "", LFS_ATTR_WEAR_STATE, buffer.get(), size);
+	return translateLfsError(err);
+}
+
+/*
+ * Add saved erase counts to those recorded so far
+ */
+void FileSystem::loadWearState()
+{
+	size_t size = getWearStateSize(lfsConfig.block_count);
+	size_t countSize = size - sizeof(WearStateHeader);
+	if(size > lfs.attr_max) {
+		return;
+	}
+	std::unique_ptr<uint8_t[]> buffer(new uint8_t[size]);
+	if(!buffer) {
+		return;
+	}
+	int res = lfs_getattr(&lfs, "", LFS_ATTR_WEAR_STATE, buffer.get(), size);
+	if(res < 0) {
+		return;
+	}
+
+	WearStateHeader hdr;
+	memcpy(&hdr, buffer.get(), sizeof(hdr));
+	if(lfs_size_t(res) != size || hdr.blockCount != lfsConfig.block_count ||
+	   lfs_crc(0xffffffff, &buffer[sizeof(hdr)], countSize) != hdr.crc) {
+		debug_w("[LFS] Wear state invalid");
+		return;
+	}
+	for(lfs_block_t block = 0; block < lfsConfig.block_count; ++block) {
+		uint32_t count;
+		memcpy(&count, &buffer[sizeof(hdr) + block * sizeof(count)], sizeof(count));
+		auto& value = wearCounts[block];
+		value = std::min(uint64_t(value) + count, uint64_t(UINT32_MAX));
+	}
+}
+
+int FileSystem::getWearStats(WearStats& stats)
+{
+	FS_LOCK()
+	CHECK_MOUNTED()
+
+	if(!wearCounts) {
+		return Error::NotSupported;
+	}
+	stats = WearStats{};
+	stats.blockCount = lfsConfig.block_count;
+	for(lfs_block_t block = 0; block < lfsConfig.block_count; ++block) {
+		auto count = wearCounts[block];
+		stats.totalErases += count;
+		stats.histogram.add(count);
+		if(count > stats.maxErases) {
+			stats.maxErases = count;
+			stats.maxBlock = block;
+		}
+	}
+	return FS_OK;
+}
+
+/*
+ * Remove saved allocator state ahead of a modification, which would make it stale
+ */
+int FileSystem::dropAllocState()
+{
+	if(!allocStateSaved) {
+		return FS_OK;
+	}
+	int err = lfs_removeattr(&lfs, "", LFS_ATTR_ALLOC_STATE);
+	if(err < 0) {
+		return translateLfsError(err);
+	}
+	allocStateSaved = false;
 	return FS_OK;
 }
 
@@ -175,17 +676,19 @@ public:
  */
 int FileSystem::format()
 {
+	FS_LOCK()
+	PROFILE_OP(format)
 	auto wasMounted = mounted;
-	if(mounted) {
-		lfs_unmount(&lfs);
-		mounted = false;
-	}
+	unmount();
 	if(!partition) {
 		return Error::NoPartition;
 	}
+	int err = configure(false);
+	if(err < 0) {
+		return err;
+	}
 	lfs = lfs_t{};
-	config.block_count = partition.size() / LFS_BLOCK_SIZE;
-	int err = lfs_format(&lfs, &config);
+	err = lfs_format(&lfs, &lfsConfig);
 	if(err < 0) {
 		err = translateLfsError(err);
 		debug_ifserr(err, "format()");
@@ -200,96 +703,597 @@ int FileSystem::format()
 
 int FileSystem::check()
 {
-	return Error::NotImplemented;
+	FS_LOCK()
+	PROFILE_OP(check)
+	if(lfsConfig.block_count == 0) {
+		return Error::NotMounted;
+	}
+
+	checker.reset(new Checker(lfsConfig, lfs));
+	if(!checker) {
+		return Error::NoMem;
+	}
+	int res;
+	while((res = checker->step(UINT_MAX)) > 0) {
+	}
+	if(res < 0) {
+		return translateLfsError(res);
+	}
+
+	auto& report = checker->getReport();
+	if(report.errorCount() != 0) {
+		debug_w("[LFS] check found %u errors", report.errorCount());
+		return Error::BadFileSystem;
+	}
+	return FS_OK;
 }
 
-int FileSystem::getinfo(Info& info)
+int FileSystem::checkIncremental(unsigned budget)
 {
-	info.clear();
-	info.partition = partition;
-	info.type = Type::LittleFS;
-	info.maxNameLength = LFS_NAME_MAX;
-	info.maxPathLength = UINT16_MAX;
-	if(mounted) {
-		info.attr |= Attribute::Mounted;
-		auto usedBlocks = lfs_fs_size(&lfs);
-		if(usedBlocks < 0) {
-			return translateLfsError(usedBlocks);
+	FS_LOCK()
+	PROFILE_OP(check)
+	// Configuration is set by `mount()`, even if it fails
+	if(lfsConfig.block_count == 0) {
+		return Error::NotMounted;
+	}
+
+	auto modifyCount = getModifyCount();
+	if(!checker || checker->isComplete() || modifyCount != checkModifyCount) {
+		checker.reset(new Checker(lfsConfig, lfs));
+		if(!checker) {
+			return Error::NoMem;
 		}
-		info.volumeSize = config.block_count * LFS_BLOCK_SIZE;
-		info.freeSpace = (config.block_count - usedBlocks) * LFS_BLOCK_SIZE;
+		checkModifyCount = modifyCount;
 	}
 
-	return FS_OK;
+	int res = checker->step(budget);
+	return (res < 0) ? translateLfsError(res) : res;
 }
 
-int FileSystem::setProfiler(IProfiler* profiler)
+const CheckReport& FileSystem::getCheckReport() const
 {
-	this->profiler = profiler;
-	return FS_OK;
+	static const CheckReport emptyReport{};
+	return checker ? checker->getReport() : emptyReport;
 }
 
-String FileSystem::getErrorString(int err)
+void FileSystem::unmount()
 {
-	if(Error::isSystem(err)) {
-		return lfsErrorToStr(Error::toSystem(err));
-	} else {
-		return IFS::Error::toString(err);
+	if(!mounted) {
+		return;
 	}
+	lfs_unmount(&lfs);
+	mounted = false;
+	statCache.clear();
+	dirCache.clear();
+	usedMap.reset();
+	checker.reset();
 }
 
-int FileSystem::fgetextents(FileHandle file, Storage::Partition* part, Extent* list, uint16_t extcount)
+uint32_t FileSystem::partitionCrc(uint8_t* buffer, size_t bufSize)
 {
-	GET_FD()
-	auto& f = fd->file;
-
-	if(part) {
-		*part = partition;
+	uint32_t crc{0xffffffff};
+	for(storage_size_t offset = 0; offset < partition.size(); offset += bufSize) {
+		if(!partition.read(offset, buffer, bufSize)) {
+			return 0;
+		}
+		crc = Delta::crc(crc, buffer, bufSize);
 	}
+	return crc;
+}
 
-	int res = lfs_file_seek(&lfs, &f, 0, LFS_SEEK_END);
-	if(res < 0) {
-		return translateLfsError(res);
+int FileSystem::writeDelta(IDataSourceStream& delta, const Delta::Header& header, uint8_t* buffer)
+{
+	auto blockSize = header.blockSize;
+	if(partitionCrc(buffer, blockSize) != header.baseCrc) {
+		debug_e("[LFS] Delta base image doesn't match partition");
+		return Error::BadFileSystem;
 	}
-	uint32_t fileSize = res;
 
-	uint16_t extIndex{0};
-	for(uint32_t offset = 0; offset < fileSize; ++extIndex) {
-		res = lfs_file_seek(&lfs, &f, offset, LFS_SEEK_SET);
-		if(res < 0) {
-			return translateLfsError(res);
+	for(unsigned i = 0; i < header.recordCount; ++i) {
+		uint32_t block;
+		if(delta.readBytes(reinterpret_cast<char*>(&block), sizeof(block)) != sizeof(block) ||
+		   delta.readBytes(reinterpret_cast<char*>(buffer), blockSize) != blockSize) {
+			return Error::ReadFailure;
 		}
-		uint8_t c;
-		res = lfs_file_read(&lfs, &f, &c, 1);
-		if(res < 0) {
-			return translateLfsError(res);
+		if(block >= header.blockCount) {
+			return Error::BadParam;
 		}
-		if(f.flags & LFS_F_INLINE) {
-			// Inline extents require traversing mdir, not trivial
-			return Error::NotSupported;
+		storage_size_t offset = storage_size_t(block) * blockSize;
+		if(!partition.erase_range(offset, blockSize)) {
+			return Error::EraseFailure;
 		}
-		auto off = f.off - 1;
-		Extent ext{(f.block * LFS_BLOCK_SIZE) + off, std::min(LFS_BLOCK_SIZE - off, fileSize - offset)};
-		if(list && extIndex < extcount) {
-			list[extIndex] = ext;
+		if(!partition.write(offset, buffer, blockSize)) {
+			return Error::WriteFailure;
 		}
-		offset += ext.length;
 	}
 
-	return extIndex;
+	if(partitionCrc(buffer, blockSize) != header.targetCrc) {
+		debug_e("[LFS] Delta target image verification failed");
+		return Error::BadFileSystem;
+	}
+
+	return FS_OK;
 }
 
-FileHandle FileSystem::open(const char* path, OpenFlags flags)
+int FileSystem::applyDelta(IDataSourceStream& delta)
 {
-	CHECK_MOUNTED()
-	FS_CHECK_PATH(path)
-
-	// If file is marked read-only, fail write requests
-	if(flags[OpenFlag::Write]) {
-		FileAttributes attr;
-		get_attr(path ?: "", AttributeTag::FileAttributes, attr);
-		if(attr[FileAttribute::ReadOnly]) {
-			return Error::ReadOnly;
+	FS_LOCK()
+	if(!partition) {
+		return Error::NoPartition;
+	}
+	for(unsigned i = 0; i < fileDescriptors.capacity(); ++i) {
+		if(fileDescriptors[i] != nullptr) {
+			return Error::Denied;
+		}
+	}
+	for(unsigned i = 0; i < fileDirs.size(); ++i) {
+		if(fileDirs[i] != nullptr) {
+			return Error::Denied;
+		}
+	}
+
+	Delta::Header header;
+	if(delta.readBytes(reinterpret_cast<char*>(&header), sizeof(header)) != sizeof(header)) {
+		return Error::ReadFailure;
+	}
+	if(header.magic != Delta::magic ||
+	   header.headerCrc != Delta::crc(0xffffffff, &header, offsetof(Delta::Header, headerCrc))) {
+		return Error::BadParam;
+	}
+	size_t eraseSize = partition.getBlockSize();
+	if(header.blockSize == 0 || (eraseSize != 0 && header.blockSize % eraseSize != 0) ||
+	   storage_size_t(header.blockSize) * header.blockCount != partition.size()) {
+		return Error::BadParam;
+	}
+	std::unique_ptr<uint8_t[]> buffer(new uint8_t[header.blockSize]);
+	if(!buffer) {
+		return Error::NoMem;
+	}
+
+	auto wasMounted = mounted;
+	unmount();
+	int err = writeDelta(delta, header, buffer.get());
+	buffer.reset();
+
+	// Geometry is re-read from the updated superblock
+	if(wasMounted) {
+		int res = configure(true);
+		if(res >= 0) {
+			res = tryMount();
+		}
+		if(err == FS_OK) {
+			err = res;
+		}
+	}
+
+	debug_ifserr(err, "applyDelta()");
+	return err;
+}
+
+int FileSystem::getinfo(Info& info)
+{
+	FS_LOCK()
+	PROFILE_OP(info)
+	info.clear();
+	info.partition = partition;
+	info.type = Type::LittleFS;
+	info.maxNameLength = LFS_NAME_MAX;
+	info.maxPathLength = UINT16_MAX;
+	if(mounted) {
+		info.attr |= Attribute::Mounted;
+		int usedBlocks = getUsedBlockCount(false);
+		if(usedBlocks < 0) {
+			return usedBlocks;
+		}
+		info.volumeSize = lfsConfig.block_count * lfsConfig.block_size;
+		info.freeSpace = (lfsConfig.block_count - usedBlocks) * lfsConfig.block_size;
+	}
+
+	return FS_OK;
+}
+
+int FileSystem::getUsedBlockCount(bool exact)
+{
+	FS_LOCK()
+	PROFILE_OP(info)
+	CHECK_MOUNTED()
+
+	if(exact || !usedMap) {
+		std::unique_ptr<uint32_t[]> map;
+		int err = getUsedMap(map);
+		if(err < 0) {
+			return err;
+		}
+		setUsedMap(std::move(map));
+	}
+
+	return usedBlockCount;
+}
+
+void FileSystem::setUsedMap(std::unique_ptr<uint32_t[]>&& map)
+{
+	usedMap = std::move(map);
+	usedBlockCount = 0;
+	for(unsigned i = 0; i < (lfsConfig.block_count + 31) / 32; ++i) {
+		usedBlockCount += __builtin_popcount(usedMap[i]);
+	}
+	usedMapProgCount = progCount;
+}
+
+void FileSystem::noteErase(lfs_block_t block)
+{
+	++eraseCount;
+	if(wearCounts && wearCounts[block] != UINT32_MAX) {
+		++wearCounts[block];
+	}
+	if(!usedMap) {
+		return;
+	}
+	// Blocks are always erased before use, this may be a new allocation
+	auto& word = usedMap[block / 32];
+	uint32_t mask = 1U << (block % 32);
+	if(!(word & mask)) {
+		word |= mask;
+		++usedBlockCount;
+	}
+}
+
+int FileSystem::setProfiler(IProfiler* profiler)
+{
+	FS_LOCK()
+	this->profiler = profiler;
+	lfsProfiler = nullptr;
+	return FS_OK;
+}
+
+int FileSystem::attachProfiler(Profiler* profiler, bool blockCounts)
+{
+	FS_LOCK()
+	this->profiler = profiler;
+	lfsProfiler = profiler;
+	if(profiler == nullptr || !blockCounts) {
+		return FS_OK;
+	}
+	CHECK_MOUNTED()
+	return profiler->setGeometry(lfsConfig.block_size, lfsConfig.block_count) ? FS_OK : Error::NoMem;
+}
+
+String FileSystem::getErrorString(int err)
+{
+	if(Error::isSystem(err)) {
+		return lfsErrorToStr(Error::toSystem(err));
+	} else {
+		return IFS::Error::toString(err);
+	}
+}
+
+int FileSystem::fgetextents(FileHandle file, Storage::Partition* part, Extent* list, uint16_t extcount)
+{
+	FS_LOCK()
+	GET_FD()
+
+	// Stored data isn't usable directly
+	if(fd->compress) {
+		return Error::NotSupported;
+	}
+	auto& f = fd->file;
+
+	if(part) {
+		*part = partition;
+	}
+
+	// Extents describe on-disk data so any pending writes must be committed first
+	if(f.flags & (LFS_F_DIRTY | LFS_F_WRITING)) {
+		int err = lfs_file_sync(&lfs, &f);
+		if(err < 0) {
+			return translateLfsError(err);
+		}
+	}
+
+	auto blockSize = lfsConfig.block_size;
+	MetaReader reader(lfsConfig, &lfs);
+
+	if(f.flags & LFS_F_INLINE) {
+		// Inline data is stored as a single tag within the metadata pair
+		if(f.ctz.size == 0) {
+			return 0;
+		}
+		lfs_off_t off;
+		int32_t tag = reader.findTag(f.m, Tag::make(0x700, 0x3ff, 0), Tag::make(LFS_TYPE_STRUCT, f.id, 0), off);
+		if(tag < 0) {
+			return translateLfsError(tag);
+		}
+		if(Tag{uint32_t(tag)}.type() != LFS_TYPE_INLINESTRUCT) {
+			return Error::BadFileSystem;
+		}
+		if(list && extcount != 0) {
+			list[0] = Extent{(f.m.pair[0] * blockSize) + off, Tag{uint32_t(tag)}.size()};
+		}
+		return 1;
+	}
+
+	/*
+	 * Walk CTZ list from the last block, reading one pointer per block.
+	 * Extents are stored in file order.
+	 */
+	struct Param {
+		Extent* list;
+		uint16_t extcount;
+		lfs_size_t blockSize;
+		lfs_off_t count;
+	};
+	Param param{list, extcount, blockSize, 0};
+
+	auto callback = [](void* param, lfs_off_t index, lfs_block_t block, lfs_off_t start, lfs_off_t end) -> int {
+		auto& p = *static_cast<Param*>(param);
+		if(p.count == 0) {
+			p.count = index + 1;
+		}
+		if(p.list != nullptr && index < p.extcount) {
+			p.list[index] = Extent{(block * p.blockSize) + start, end - start};
+		}
+		return 0;
+	};
+
+	int err = reader.ctzTraverse(f.ctz.head, f.ctz.size, callback, &param);
+	if(err < 0) {
+		return translateLfsError(err);
+	}
+
+	return std::min(param.count, lfs_off_t(UINT16_MAX));
+}
+
+int FileSystem::mmap(FileHandle file, file_offset_t offset, size_t& length, const void*& data)
+{
+	FS_LOCK()
+	PROFILE_OP(read)
+	GET_FD()
+
+	// Stored data isn't usable directly
+	if(fd->compress) {
+		return Error::NotSupported;
+	}
+	auto& f = fd->file;
+
+	unmapFlash(fd->mapping);
+	data = nullptr;
+
+	if(f.flags & (LFS_F_DIRTY | LFS_F_WRITING)) {
+		int err = lfs_file_sync(&lfs, &f);
+		if(err < 0) {
+			return translateLfsError(err);
+		}
+	}
+
+	if(offset < 0) {
+		return Error::BadParam;
+	}
+	if(lfs_off_t(offset) >= f.ctz.size) {
+		length = 0;
+		return FS_OK;
+	}
+
+	MetaReader reader(lfsConfig, &lfs);
+	storage_size_t addr;
+	size_t avail;
+
+	if(f.flags & LFS_F_INLINE) {
+		lfs_off_t off;
+		int32_t tag = reader.findTag(f.m, Tag::make(0x700, 0x3ff, 0), Tag::make(LFS_TYPE_STRUCT, f.id, 0), off);
+		if(tag < 0) {
+			return translateLfsError(tag);
+		}
+		if(Tag{uint32_t(tag)}.type() != LFS_TYPE_INLINESTRUCT) {
+			return Error::BadFileSystem;
+		}
+		addr = (f.m.pair[0] * lfsConfig.block_size) + off + offset;
+		avail = f.ctz.size - offset;
+	} else {
+		lfs_block_t block;
+		lfs_off_t off;
+		int err = reader.ctzFind(f.ctz.head, f.ctz.size, offset, block, off);
+		if(err < 0) {
+			return translateLfsError(err);
+		}
+		addr = (block * lfsConfig.block_size) + off;
+		avail = std::min(lfs_size_t(lfsConfig.block_size - off), lfs_size_t(f.ctz.size - offset));
+	}
+
+	length = std::min(length, avail);
+	if(!mapFlash(partition, addr, length, fd->mapping)) {
+		length = 0;
+		return Error::NotSupported;
+	}
+
+	data = fd->mapping.data;
+	return FS_OK;
+}
+
+int FileSystem::munmap(FileHandle file)
+{
+	FS_LOCK()
+	GET_FD()
+
+	unmapFlash(fd->mapping);
+	return FS_OK;
+}
+
+int FileSystem::fallocate(FileHandle file, file_size_t size)
+{
+	FS_LOCK()
+	GET_FD()
+	CHECK_WRITE()
+	auto& f = fd->file;
+
+	if(f.flags & (LFS_F_DIRTY | LFS_F_WRITING)) {
+		int err = lfs_file_sync(&lfs, &f);
+		if(err < 0) {
+			return translateLfsError(err);
+		}
+	}
+
+	MetaReader reader(lfsConfig);
+	auto getBlockCount = [&](lfs_size_t size) -> lfs_size_t {
+		if(size == 0) {
+			return 0;
+		}
+		lfs_off_t off = size - 1;
+		return reader.ctzIndex(off) + 1;
+	};
+
+	lfs_size_t required = getBlockCount(size);
+	lfs_size_t existing = (f.flags & LFS_F_INLINE) ? 0 : getBlockCount(f.ctz.size);
+	if(required <= existing) {
+		return FS_OK;
+	}
+	required -= existing;
+
+	std::unique_ptr<uint32_t[]> map;
+	int err = getUsedMap(map);
+	if(err < 0) {
+		return err;
+	}
+	auto blockCount = lfsConfig.block_count;
+	auto isUsed = [&](lfs_block_t block) -> bool { return isBlockUsed(map.get(), block); };
+
+	/*
+	 * Find first run of sufficient length, starting at current allocator position
+	 * so wear-levelling is not disrupted.
+	 * Blocks 0 and 1 always hold the superblock so runs never wrap.
+	 */
+	lfs_block_t bestStart{0};
+	lfs_size_t bestLength{0};
+	lfs_block_t runStart{0};
+	lfs_size_t runLength{0};
+	auto first = Lookahead(lfs).next();
+	for(lfs_size_t i = 0; i < blockCount && bestLength < required; ++i) {
+		auto block = (first + i) % blockCount;
+		if(isUsed(block)) {
+			runLength = 0;
+			continue;
+		}
+		if(runLength == 0) {
+			runStart = block;
+		}
+		++runLength;
+		if(runLength > bestLength) {
+			bestStart = runStart;
+			bestLength = runLength;
+		}
+	}
+
+	if(bestLength == 0) {
+		return Error::NoSpace;
+	}
+
+	Lookahead(lfs).load(bestStart, map.get());
+	setUsedMap(std::move(map));
+
+	if(bestLength < required) {
+		debug_w("[LFS] fallocate: %u blocks required, longest run %u", required, bestLength);
+	}
+
+	return FS_OK;
+}
+
+/*
+ * Build map of blocks in use.
+ * This includes blocks belonging to open files.
+ */
+int FileSystem::getUsedMap(std::unique_ptr<uint32_t[]>& map)
+{
+	map.reset(new uint32_t[(lfsConfig.block_count + 31) / 32]{});
+	if(!map) {
+		return Error::NoMem;
+	}
+	auto callback = [](void* param, lfs_block_t block) -> int {
+		auto map = static_cast<uint32_t*>(param);
+		map[block / 32] |= 1U << (block % 32);
+		return 0;
+	};
+	int err = lfs_fs_traverse(&lfs, callback, map.get());
+	return (err < 0) ? translateLfsError(err) : FS_OK;
+}
+
+int FileSystem::gc(unsigned budget)
+{
+	FS_LOCK()
+	PROFILE_OP(gc)
+	CHECK_MOUNTED()
+
+	for(unsigned i = 0; i < fileDescriptors.capacity(); ++i) {
+		auto fd = fileDescriptors[i];
+		if(fd == nullptr || fd->writeBehind.pending == 0 || !isCommitDue(*fd)) {
+			continue;
+		}
+		if(budget == 0) {
+			return 1;
+		}
+		--budget;
+		int err = commit(*fd);
+		if(err < 0) {
+			return err;
+		}
+	}
+
+	/*
+	 * Refill lookahead window once it's largely been used, or if it's empty following mount.
+	 * The new window starts where the allocator would next look, so the order in which blocks
+	 * are allocated (and hence wear-levelling) is unaffected.
+	 */
+	Lookahead lookahead(lfs);
+	bool refill = lookahead.isExhausted(LFS_GC_LOOKAHEAD_THRESHOLD);
+
+	/*
+	 * Blocks freed by commits aren't tracked, so used block count may be an over-estimate.
+	 * The same traversal serves both purposes.
+	 */
+	bool recount = usedMap && usedMapProgCount != progCount;
+
+	if(!refill && !recount) {
+		return 0;
+	}
+	if(budget == 0) {
+		return 1;
+	}
+	std::unique_ptr<uint32_t[]> map;
+	int err = getUsedMap(map);
+	if(err < 0) {
+		return err;
+	}
+	if(refill) {
+		lookahead.load(lookahead.next(), map.get());
+	}
+	setUsedMap(std::move(map));
+
+	return 0;
+}
+
+FileHandle FileSystem::open(const char* path, OpenFlags flags)
+{
+	FS_LOCK()
+	PROFILE_OP(open)
+	CHECK_MOUNTED()
+	FS_CHECK_PATH(path)
+
+	auto pathHash = getPathHash(path);
+
+	// If file is marked read-only, fail write requests
+	if(flags[OpenFlag::Write]) {
+		Stat stat;
+		FileAttributes attr;
+		if(statCache.get(pathHash, path, stat)) {
+			attr = stat.attr;
+		} else {
+			get_attr(path ?: "", AttributeTag::FileAttributes, attr);
+		}
+		if(attr[FileAttribute::ReadOnly]) {
+			return Error::ReadOnly;
+		}
+		statCache.invalidate(pathHash);
+		int err = dropAllocState();
+		if(err < 0) {
+			return err;
 		}
 	}
 
@@ -301,70 +1305,115 @@ FileHandle FileSystem::open(const char* path, OpenFlags flags)
 	/*
 	 * Allocate a file descriptor
 	 */
-	int file{Error::OutOfFileDescs};
-	for(unsigned i = 0; i < LFS_MAX_FDS; ++i) {
-		auto& fd = fileDescriptors[i];
-		if(!fd) {
-			fd.reset(new FileDescriptor);
-			file = LFS_HANDLE_MIN + i;
-			break;
-		}
+	int index = fileDescriptors.allocate();
+	if(index < 0) {
+		int err = Error::OutOfFileDescs;
+		debug_ifserr(err, "open('%s')", path);
+		return err;
 	}
-	if(file < 0) {
-		debug_ifserr(file, "open('%s')", path);
-		return file;
+	int file = LFS_HANDLE_MIN + index;
+	auto fd = fileDescriptors[index];
+	if(!fd->allocateBuffer(lfsConfig.cache_size)) {
+		fileDescriptors.release(index);
+		return Error::NoMem;
 	}
 
-	auto& fd = fileDescriptors[file - LFS_HANDLE_MIN];
+	/*
+	 * Modification time is read on open, and written on sync if the file has changed.
+	 * For writeable files it's attached on first change, see `FileDescriptor::attachMeta()`.
+	 */
+	fd->attrs[0] = makeAttr(AttributeTag::ModifiedTime, fd->mtime);
+	fd->config.attrs = fd->attrs;
+	fd->config.attr_count = flags[OpenFlag::Write] ? 0 : 1;
+
 	int err = lfs_file_opencfg(&lfs, &fd->file, path ?: "", oflags, &fd->config);
 	if(err < 0) {
 		err = translateLfsError(err);
-		debug_d("open('%s'): %s", path, getErrorString(file).c_str());
-		fd.reset();
+		debug_d("open('%s'): %s", path, getErrorString(err).c_str());
+		fileDescriptors.release(index);
 		return err;
 	}
 
-	get_attr(fd->file, AttributeTag::ModifiedTime, fd->mtime);
+	if(fd->config.attr_count == 0) {
+		int res = get_attr(fd->file, AttributeTag::ModifiedTime, fd->mtime);
+		// New or truncated file
+		if(res < 0 || (fd->file.flags & LFS_F_DIRTY)) {
+			fd->touch();
+		}
+	}
+	fd->pathHash = pathHash;
 
 	if(isRootPath(path)) {
 		fd->flags += FileDescriptor::Flag::IsRoot;
 	}
 	fd->flags[FileDescriptor::Flag::Write] = flags[OpenFlag::Write];
 
-	// Copy name into descriptor
-	if(path != nullptr) {
-		const char* p = strrchr(path, '/');
-		if(p == nullptr) {
-			p = path;
-		} else {
-			++p;
+	if(fd->file.type == LFS_TYPE_REG) {
+		err = openCompressed(*fd, flags[OpenFlag::Write] && config.compressNewFiles);
+		if(err < 0) {
+			lfs_file_close(&lfs, &fd->file);
+			fileDescriptors.release(index);
+			return err;
 		}
-		fd->name = p;
 	}
+	if(flags[OpenFlag::Write]) {
+		fd->writeBehind.maxPending = config.writeBehindSize;
+		fd->writeBehind.maxDelay = config.writeBehindTime;
+	}
+
+	// Copy path into descriptor
+	fd->path = path;
 
 	return file;
 }
 
 int FileSystem::close(FileHandle file)
 {
-	GET_FD()
+	FS_LOCK()
+	PROFILE_OP(close)
+	CHECK_MOUNTED()
+	if(file < LFS_HANDLE_MIN || file > LFS_HANDLE_MAX) {
+		return Error::InvalidHandle;
+	}
+	auto fd = fileDescriptors[file - LFS_HANDLE_MIN];
+	if(fd == nullptr) {
+		return Error::FileNotOpen;
+	}
+
+	// Already closed by `fremove()`
+	if(fd->flags[FileDescriptor::Flag::Removed]) {
+		fileDescriptors.release(file - LFS_HANDLE_MIN);
+		return FS_OK;
+	}
 
+	int err = flushCompressed(*fd);
 	flushMeta(*fd);
+	dropReadAhead(*fd);
 
 	int res = lfs_file_close(&lfs, &fd->file);
-	fd.reset();
-	return translateLfsError(res);
+	if(fd->flags[FileDescriptor::Flag::Write]) {
+		statCache.invalidate(fd->pathHash);
+	}
+	fileDescriptors.release(file - LFS_HANDLE_MIN);
+	return (err < 0) ? err : translateLfsError(res);
 }
 
 int FileSystem::eof(FileHandle file)
 {
+	FS_LOCK()
 	GET_FD()
 
+	if(fd->compress) {
+		auto& c = *fd->compress;
+		return (c.pos >= c.info.size) ? 1 : 0;
+	}
+
 	auto size = lfs_file_size(&lfs, &fd->file);
 	if(size < 0) {
 		return translateLfsError(size);
 	}
-	auto pos = lfs_file_tell(&lfs, &fd->file);
+	auto& ra = fd->readAhead;
+	auto pos = ra.buffer ? lfs_soff_t(ra.pos + ra.offset) : lfs_file_tell(&lfs, &fd->file);
 	if(pos < 0) {
 		return translateLfsError(pos);
 	}
@@ -373,45 +1422,185 @@ int FileSystem::eof(FileHandle file)
 
 file_offset_t FileSystem::tell(FileHandle file)
 {
+	FS_LOCK()
 	GET_FD()
 
+	if(fd->compress) {
+		return fd->compress->pos;
+	}
+
+	auto& ra = fd->readAhead;
+	if(ra.buffer != nullptr) {
+		return ra.pos + ra.offset;
+	}
+
 	int res = lfs_file_tell(&lfs, &fd->file);
 	return translateLfsError(res);
 }
 
 int FileSystem::ftruncate(FileHandle file, file_size_t new_size)
 {
+	FS_LOCK()
+	PROFILE_OP(truncate)
 	GET_FD()
 	CHECK_WRITE()
 
+	auto& c = fd->compress;
+	if(c && new_size == c->info.size) {
+		return FS_OK;
+	}
+	if(c && new_size != 0) {
+		return Error::NotSupported;
+	}
+
+	statCache.invalidate(fd->pathHash);
+	int err = dropAllocState();
+	if(err < 0) {
+		return err;
+	}
 	int res = lfs_file_truncate(&lfs, &fd->file, new_size);
-	return translateLfsError(res);
+	if(res < 0) {
+		return translateLfsError(res);
+	}
+
+	if(c) {
+		c->info.size = c->info.storedSize = 0;
+		c->chunkLen = 0;
+		c->pending = false;
+		c->index.clear();
+		c->scanPos = c->scanOffset = 0;
+		err = setCompressInfo(*fd);
+		if(err < 0) {
+			return err;
+		}
+	}
+
+	fd->touch();
+	notePending(*fd, 1);
+	return FS_OK;
 }
 
 void FileSystem::flushMeta(FileDescriptor& fd)
 {
+	// Modification time is in the file config attributes, so is written by the next sync
 	if(fd.flags[FileDescriptor::Flag::TimeChanged]) {
 		fd.flags -= FileDescriptor::Flag::TimeChanged;
-		set_attr(fd.file, AttributeTag::ModifiedTime, fd.mtime);
+		fd.attachMeta();
+		fd.file.flags |= LFS_F_DIRTY;
+	}
+}
+
+int FileSystem::commit(FileDescriptor& fd)
+{
+	int err = flushCompressed(fd);
+	if(err < 0) {
+		return err;
+	}
+	flushMeta(fd);
+	fd.writeBehind.pending = 0;
+	statCache.invalidate(fd.pathHash);
+	int res = lfs_file_sync(&lfs, &fd.file);
+	if(res >= 0) {
+		fd.clearPendingAttrs();
+	}
+	return translateLfsError(res);
+}
+
+void FileSystem::notePending(FileDescriptor& fd, size_t size)
+{
+	auto& wb = fd.writeBehind;
+	if(wb.maxPending == 0) {
+		return;
+	}
+	if(wb.pending == 0 && wb.maxDelay != 0) {
+		wb.timer.reset(wb.maxDelay);
+	}
+	wb.pending += std::max(size, size_t(1));
+}
+
+bool FileSystem::isCommitDue(FileDescriptor& fd)
+{
+	auto& wb = fd.writeBehind;
+	if(wb.maxPending == 0) {
+		return true;
+	}
+	if(wb.pending == 0) {
+		return false;
 	}
+	return wb.pending >= wb.maxPending || (wb.maxDelay != 0 && wb.timer.expired());
 }
 
 int FileSystem::flush(FileHandle file)
 {
+	FS_LOCK()
+	PROFILE_OP(flush)
 	GET_FD()
 	CHECK_WRITE()
 
-	flushMeta(*fd);
+	if(!isCommitDue(*fd)) {
+		return FS_OK;
+	}
 
-	int res = lfs_file_sync(&lfs, &fd->file);
-	return translateLfsError(res);
+	return commit(*fd);
+}
+
+int FileSystem::setWriteBehind(FileHandle file, size_t maxPending, uint32_t maxDelay)
+{
+	FS_LOCK()
+	GET_FD()
+	CHECK_WRITE()
+
+	auto& wb = fd->writeBehind;
+	if(maxPending == 0 && wb.pending != 0) {
+		int err = commit(*fd);
+		if(err < 0) {
+			return err;
+		}
+	}
+	wb.maxPending = maxPending;
+	wb.maxDelay = maxDelay;
+	if(wb.pending != 0 && maxDelay != 0) {
+		wb.timer.reset(maxDelay);
+	}
+	return FS_OK;
+}
+
+int FileSystem::commitPending()
+{
+	FS_LOCK()
+	PROFILE_OP(flush)
+	CHECK_MOUNTED()
+
+	int res{FS_OK};
+	for(unsigned i = 0; i < fileDescriptors.capacity(); ++i) {
+		auto fd = fileDescriptors[i];
+		if(fd == nullptr || fd->writeBehind.pending == 0 || !isCommitDue(*fd)) {
+			continue;
+		}
+		int err = commit(*fd);
+		if(err < 0) {
+			res = err;
+		}
+	}
+	return res;
 }
 
 int FileSystem::read(FileHandle file, void* data, size_t size)
 {
+	FS_LOCK()
+	PROFILE_OP(read)
 	GET_FD()
 
-	int res = lfs_file_read(&lfs, &fd->file, data, size);
+	if(fd->compress) {
+		return readCompressed(*fd, data, size);
+	}
+
+	int res;
+	if(readAheadPool.getBufferSize() != 0 && !fd->flags[FileDescriptor::Flag::Write]) {
+		res = readBuffered(*fd, data, size);
+	} else {
+		res = lfs_file_read(&lfs, &fd->file, data, size);
+	}
 	if(res < 0) {
 		int err = translateLfsError(res);
 		debug_ifserr(err, "read()");
@@ -421,34 +1610,502 @@ int FileSystem::read(FileHandle file, void* data, size_t size)
 	return res;
 }
 
+/*
+ * Reads are passed directly to littlefs until a sequential pattern is detected.
+ * A buffer is then borrowed from the pool and filled in large chunks, which littlefs
+ * reads directly from the device bypassing its own cache.
+ */
+int FileSystem::readBuffered(FileDescriptor& fd, void* data, size_t size)
+{
+	auto& ra = fd.readAhead;
+	auto& f = fd.file;
+	auto bufSize = readAheadPool.getBufferSize();
+
+	lfs_off_t pos = ra.buffer ? (ra.pos + ra.offset) : lfs_file_tell(&lfs, &f);
+	if(pos == ra.nextPos) {
+		if(ra.seqCount < 0xff) {
+			++ra.seqCount;
+		}
+	} else {
+		ra.seqCount = 0;
+	}
+	bool sequential = (ra.seqCount >= LFS_READ_AHEAD_TRIGGER);
+
+	if(ra.buffer == nullptr) {
+		if(sequential && size < bufSize) {
+			ra.buffer = readAheadPool.allocate();
+		}
+		if(ra.buffer == nullptr) {
+			int res = lfs_file_read(&lfs, &f, data, size);
+			if(res > 0) {
+				ra.nextPos = pos + res;
+			}
+			return res;
+		}
+		ra.pos = pos;
+		ra.length = ra.offset = 0;
+	}
+
+	auto out = static_cast<uint8_t*>(data);
+	int count{0};
+	while(size != 0) {
+		if(ra.offset == ra.length) {
+			// Buffer is empty so littlefs position matches ours
+			ra.pos += ra.length;
+			ra.length = ra.offset = 0;
+			if(!sequential || size >= bufSize) {
+				if(!sequential) {
+					readAheadPool.release(ra.buffer);
+					ra.buffer = nullptr;
+				}
+				int res = lfs_file_read(&lfs, &f, out, size);
+				if(res < 0) {
+					return count ?: res;
+				}
+				ra.pos += res;
+				count += res;
+				break;
+			}
+			int res = lfs_file_read(&lfs, &f, ra.buffer, bufSize);
+			if(res < 0) {
+				return count ?: res;
+			}
+			if(res == 0) {
+				break;
+			}
+			ra.length = res;
+		}
+		auto n = std::min(size, size_t(ra.length - ra.offset));
+		memcpy(out, &ra.buffer[ra.offset], n);
+		ra.offset += n;
+		out += n;
+		size -= n;
+		count += n;
+	}
+
+	ra.nextPos = pos + count;
+	return count;
+}
+
+/*
+ * Return read-ahead buffer to pool and restore littlefs file position
+ */
+int FileSystem::dropReadAhead(FileDescriptor& fd)
+{
+	auto& ra = fd.readAhead;
+	if(ra.buffer == nullptr) {
+		return FS_OK;
+	}
+
+	int res{0};
+	if(ra.offset != ra.length) {
+		res = lfs_file_seek(&lfs, &fd.file, ra.pos + ra.offset, LFS_SEEK_SET);
+	}
+	readAheadPool.release(ra.buffer);
+	ra.buffer = nullptr;
+	return res < 0 ? translateLfsError(res) : FS_OK;
+}
+
+/*
+ * Set up state for a compressed file, or a new file if `create` is set
+ */
+int FileSystem::openCompressed(FileDescriptor& fd, bool create)
+{
+	Compress::Info info{};
+	int res = lfs_file_getattr(&lfs, &fd.file, LFS_ATTR_COMPRESS, &info, sizeof(info));
+	auto storedSize = lfs_file_size(&lfs, &fd.file);
+	if(storedSize < 0) {
+		return translateLfsError(storedSize);
+	}
+	if(res != sizeof(info) || info.chunkSize == 0) {
+		if(!create || storedSize != 0) {
+			return FS_OK;
+		}
+		info = Compress::Info{0, LFS_COMPRESS_CHUNK_SIZE, 0};
+	} else if(storedSize == 0) {
+		// Truncated on open
+		info.size = info.storedSize = 0;
+	}
+	if(info.chunkSize > Compress::maxChunkSize || info.storedSize > lfs_size_t(storedSize)) {
+		return Error::BadFileSystem;
+	}
+
+	fd.compress.reset(new Compress::State);
+	auto& c = fd.compress;
+	if(!c) {
+		return Error::NoMem;
+	}
+	c->info = info;
+	c->chunk.reset(new uint8_t[info.chunkSize]);
+	c->work.reset(new uint8_t[info.chunkSize]);
+	if(!c->chunk || !c->work) {
+		return Error::NoMem;
+	}
+
+	if(!fd.flags[FileDescriptor::Flag::Write]) {
+		return FS_OK;
+	}
+
+	// Discard data written without a corresponding update to the attribute, e.g. following power loss
+	if(lfs_size_t(storedSize) > info.storedSize) {
+		res = lfs_file_truncate(&lfs, &fd.file, info.storedSize);
+		if(res < 0) {
+			return translateLfsError(res);
+		}
+	}
+	return setCompressInfo(fd);
+}
+
+/*
+ * Attribute is committed with file data
+ */
+int FileSystem::setCompressInfo(FileDescriptor& fd)
+{
+	auto& info = fd.compress->info;
+	if(fd.setPendingAttr(LFS_ATTR_COMPRESS, &info, sizeof(info))) {
+		return FS_OK;
+	}
+	// No space, so commit existing changes first
+	int err = commit(fd);
+	if(err < 0) {
+		return err;
+	}
+	fd.setPendingAttr(LFS_ATTR_COMPRESS, &info, sizeof(info));
+	return FS_OK;
+}
+
+int FileSystem::readStored(lfs_file_t& file, lfs_off_t offset, void* buffer, lfs_size_t size)
+{
+	int res = lfs_file_seek(&lfs, &file, offset, LFS_SEEK_SET);
+	if(res >= 0) {
+		res = lfs_file_read(&lfs, &file, buffer, size);
+	}
+	if(res < 0) {
+		return translateLfsError(res);
+	}
+	return (lfs_size_t(res) == size) ? FS_OK : Error::BadFileSystem;
+}
+
+/*
+ * Locate the chunk containing a file position and decompress it.
+ * Chunk headers are followed from the last one located so far, building an index as we go.
+ */
+int FileSystem::loadChunk(FileDescriptor& fd, lfs_off_t pos)
+{
+	auto& c = *fd.compress;
+	auto& f = fd.file;
+	Compress::ChunkHeader hdr;
+
+	while(c.scanPos <= pos) {
+		if(c.scanOffset >= c.info.storedSize) {
+			return Error::BadFileSystem;
+		}
+		int err = readStored(f, c.scanOffset, &hdr, sizeof(hdr));
+		if(err < 0) {
+			return err;
+		}
+		if(hdr.rawSize == 0 || hdr.rawSize > c.info.chunkSize || hdr.storedSize > hdr.rawSize) {
+			return Error::BadFileSystem;
+		}
+		c.index.push_back({c.scanPos, c.scanOffset});
+		c.scanPos += hdr.rawSize;
+		c.scanOffset += sizeof(hdr) + hdr.storedSize;
+	}
+
+	auto it = std::upper_bound(c.index.begin(), c.index.end(), pos,
+							   [](lfs_off_t pos, const Compress::State::IndexEntry& e) { return pos < e.pos; });
+	--it;
+	int err = readStored(f, it->offset, &hdr, sizeof(hdr));
+	if(err < 0) {
+		return err;
+	}
+	c.chunkLen = 0;
+	if(hdr.storedSize == hdr.rawSize) {
+		err = readStored(f, it->offset + sizeof(hdr), c.chunk.get(), hdr.rawSize);
+	} else {
+		err = readStored(f, it->offset + sizeof(hdr), c.work.get(), hdr.storedSize);
+		if(err >= 0 && Compress::decompress(c.work.get(), hdr.storedSize, c.chunk.get(), hdr.rawSize) != hdr.rawSize) {
+			err = Error::BadFileSystem;
+		}
+	}
+	if(err < 0) {
+		return err;
+	}
+	c.chunkPos = it->pos;
+	c.chunkLen = hdr.rawSize;
+	return FS_OK;
+}
+
+int FileSystem::readCompressed(FileDescriptor& fd, void* data, size_t size)
+{
+	auto& c = *fd.compress;
+	if((fd.file.flags & LFS_O_RDONLY) != LFS_O_RDONLY) {
+		return Error::NotSupported;
+	}
+
+	// Buffer may be overwritten
+	if(c.pending) {
+		auto pos = c.pos;
+		int err = flushCompressed(fd);
+		if(err < 0) {
+			return err;
+		}
+		if(!fd.compress) {
+			err = lfs_file_seek(&lfs, &fd.file, pos, LFS_SEEK_SET);
+			if(err >= 0) {
+				err = lfs_file_read(&lfs, &fd.file, data, size);
+			}
+			return translateLfsError(err);
+		}
+	}
+
+	auto out = static_cast<uint8_t*>(data);
+	size_t count{0};
+	while(count < size && c.pos < c.info.size) {
+		if(!c.contains(c.pos)) {
+			int err = loadChunk(fd, c.pos);
+			if(err < 0) {
+				debug_ifserr(err, "read()");
+				return count ? int(count) : err;
+			}
+		}
+		auto offset = c.pos - c.chunkPos;
+		auto n = std::min(size - count, size_t(c.chunkLen - offset));
+		memcpy(&out[count], &c.chunk[offset], n);
+		c.pos += n;
+		count += n;
+	}
+	return count;
+}
+
+int FileSystem::writeCompressed(FileDescriptor& fd, const void* data, size_t size)
+{
+	auto& c = *fd.compress;
+	if(fd.file.flags & LFS_O_APPEND) {
+		c.pos = c.info.size;
+	}
+	if(c.pos != c.info.size) {
+		return Error::NotSupported;
+	}
+	if(!c.table) {
+		c.table.reset(new uint16_t[Compress::hashSize]);
+		if(!c.table) {
+			return Error::NoMem;
+		}
+	}
+
+	auto in = static_cast<const uint8_t*>(data);
+	size_t count{0};
+	while(count < size) {
+		if(!c.pending) {
+			c.chunkPos = c.info.size;
+			c.chunkLen = 0;
+			c.pending = true;
+		}
+		auto n = std::min(size - count, size_t(c.info.chunkSize - c.chunkLen));
+		memcpy(&c.chunk[c.chunkLen], &in[count], n);
+		c.chunkLen += n;
+		c.pos += n;
+		c.info.size += n;
+		count += n;
+		if(c.chunkLen == c.info.chunkSize) {
+			int err = flushCompressed(fd);
+			if(err < 0) {
+				return err;
+			}
+			if(!fd.compress) {
+				// Write remainder directly
+				int res = lfs_file_write(&lfs, &fd.file, &in[count], size - count);
+				if(res < 0) {
+					return translateLfsError(res);
+				}
+				return count + res;
+			}
+		}
+	}
+	return count;
+}
+
+/*
+ * Compress and write any pending data as a new chunk
+ */
+int FileSystem::flushCompressed(FileDescriptor& fd)
+{
+	auto& c = fd.compress;
+	if(!c || !c->pending) {
+		return FS_OK;
+	}
+
+	Compress::ChunkHeader hdr{uint16_t(c->chunkLen), 0};
+	hdr.storedSize = Compress::compress(c->chunk.get(), c->chunkLen, c->work.get(), c->chunkLen - 1, c->table.get());
+	const uint8_t* stored = c->work.get();
+	if(hdr.storedSize == 0) {
+		// Content which is already compressed (images, gzip, etc.) is best left alone
+		if(c->chunkPos == 0 && c->chunkLen == c->info.chunkSize) {
+			return storeUncompressed(fd);
+		}
+		hdr.storedSize = hdr.rawSize;
+		stored = c->chunk.get();
+	}
+
+	auto& f = fd.file;
+	lfs_off_t offset = c->info.storedSize;
+	int res = lfs_file_seek(&lfs, &f, offset, LFS_SEEK_SET);
+	if(res >= 0) {
+		res = lfs_file_write(&lfs, &f, &hdr, sizeof(hdr));
+	}
+	if(res >= 0) {
+		res = lfs_file_write(&lfs, &f, stored, hdr.storedSize);
+	}
+	if(res < 0) {
+		return translateLfsError(res);
+	}
+
+	// Chunk remains in buffer for reading
+	c->pending = false;
+	c->info.storedSize = offset + sizeof(hdr) + hdr.storedSize;
+	if(c->scanPos == c->chunkPos) {
+		c->index.push_back({c->chunkPos, offset});
+		c->scanPos += c->chunkLen;
+		c->scanOffset = c->info.storedSize;
+	}
+	return setCompressInfo(fd);
+}
+
+/*
+ * Revert to storing file content as-is, discarding compression state
+ */
+int FileSystem::storeUncompressed(FileDescriptor& fd)
+{
+	auto& c = *fd.compress;
+	auto pos = c.pos;
+	assert(c.info.storedSize == 0);
+
+	fd.removePendingAttr(LFS_ATTR_COMPRESS);
+	int res = lfs_file_removeattr(&lfs, &fd.file, LFS_ATTR_COMPRESS);
+	if(res < 0 && res != LFS_ERR_NOATTR) {
+		return translateLfsError(res);
+	}
+	res = lfs_file_seek(&lfs, &fd.file, 0, LFS_SEEK_SET);
+	if(res >= 0 && c.pending) {
+		res = lfs_file_write(&lfs, &fd.file, c.chunk.get(), c.chunkLen);
+	}
+	if(res >= 0) {
+		res = lfs_file_seek(&lfs, &fd.file, pos, LFS_SEEK_SET);
+	}
+	fd.compress.reset();
+	return translateLfsError(res);
+}
+
+int FileSystem::enableCompression(FileHandle file)
+{
+	FS_LOCK()
+	GET_FD()
+	CHECK_WRITE()
+
+	if(fd->compress) {
+		return FS_OK;
+	}
+	if(fd->file.type != LFS_TYPE_REG || lfs_file_size(&lfs, &fd->file) != 0) {
+		return Error::NotSupported;
+	}
+	return openCompressed(*fd, true);
+}
+
 int FileSystem::write(FileHandle file, const void* data, size_t size)
 {
+	FS_LOCK()
+	PROFILE_OP(write)
 	GET_FD()
 	CHECK_WRITE()
 
-	int res = lfs_file_write(&lfs, &fd->file, data, size);
-	if(res < 0) {
-		return translateLfsError(res);
+	int err = dropAllocState();
+	if(err < 0) {
+		return err;
+	}
+
+	int res;
+	if(fd->compress) {
+		res = writeCompressed(*fd, data, size);
+		if(res < 0) {
+			return res;
+		}
+	} else {
+		res = lfs_file_write(&lfs, &fd->file, data, size);
+		if(res < 0) {
+			return translateLfsError(res);
+		}
 	}
 
 	fd->touch();
+	notePending(*fd, res);
+	if(fd->writeBehind.pending != 0 && isCommitDue(*fd)) {
+		err = commit(*fd);
+		if(err < 0) {
+			return err;
+		}
+	}
 	return res;
 }
 
 file_offset_t FileSystem::lseek(FileHandle file, file_offset_t offset, SeekOrigin origin)
 {
+	FS_LOCK()
+	PROFILE_OP(seek)
 	GET_FD()
 
+	if(fd->compress) {
+		auto& c = *fd->compress;
+		lfs_soff_t target = offset;
+		if(origin == SeekOrigin::Current) {
+			target += c.pos;
+		} else if(origin == SeekOrigin::End) {
+			target += c.info.size;
+		}
+		if(target < 0) {
+			return Error::BadParam;
+		}
+		c.pos = target;
+		return target;
+	}
+
+	auto& ra = fd->readAhead;
+	if(ra.buffer != nullptr) {
+		// Seek within buffered data if possible
+		lfs_soff_t target = offset;
+		if(origin == SeekOrigin::Current) {
+			target += ra.pos + ra.offset;
+		} else if(origin == SeekOrigin::End) {
+			target += lfs_file_size(&lfs, &fd->file);
+		}
+		if(target >= lfs_soff_t(ra.pos) && target <= lfs_soff_t(ra.pos + ra.length)) {
+			ra.offset = target - ra.pos;
+			return target;
+		}
+		int err = dropReadAhead(*fd);
+		if(err < 0) {
+			return err;
+		}
+	}
+
 	int res = lfs_file_seek(&lfs, &fd->file, offset, int(origin));
 	return translateLfsError(res);
 }
 
 int FileSystem::stat(const char* path, Stat* stat)
 {
+	FS_LOCK()
+	PROFILE_OP(stat)
 	CHECK_MOUNTED()
 	FS_CHECK_PATH(path);
 
+	auto pathHash = getPathHash(path);
+
 	if(stat == nullptr) {
+		Stat s;
+		if(statCache.get(pathHash, path, s)) {
+			return FS_OK;
+		}
 		struct lfs_info info {
 		};
 		int err = lfs_stat(&lfs, path ?: "", &info);
@@ -456,7 +2113,12 @@ int FileSystem::stat(const char* path, Stat* stat)
 	}
 
 	*stat = Stat{};
-	stat->acl = rootAcl;
+	if(statCache.get(pathHash, path, *stat)) {
+		stat->fs = this;
+		return FS_OK;
+	}
+
+	stat->acl = getRootAcl();
 	StatAttr sa(*stat);
 	struct lfs_stat_config cfg {
 		sa.attrs, sa.count
@@ -470,25 +2132,41 @@ int FileSystem::stat(const char* path, Stat* stat)
 
 	stat->fs = this;
 	fillStat(*stat, info);
+	sa.update(*stat);
+	statCache.put(pathHash, path, *stat);
 	return FS_OK;
 }
 
 int FileSystem::fstat(FileHandle file, Stat* stat)
 {
+	FS_LOCK()
+	PROFILE_OP(stat)
 	GET_FD()
 
 	auto size = lfs_file_size(&lfs, &fd->file);
 	if(stat == nullptr || size < 0) {
 		return translateLfsError(size);
 	}
+	if(fd->compress) {
+		size = fd->compress->info.size;
+	}
 
 	*stat = Stat{};
+	bool canCache = !fd->flags[FileDescriptor::Flag::Write];
+	if(canCache && statCache.get(fd->pathHash, fd->path.c_str(), *stat)) {
+		stat->fs = this;
+		stat->id = fd->file.id;
+		stat->size = size;
+		stat->mtime = fd->mtime;
+		return FS_OK;
+	}
+
 	stat->fs = this;
 	stat->id = fd->file.id;
-	stat->name.copy(fd->name.c_str());
+	stat->name.copy(fd->getName());
 	stat->size = size;
 	stat->mtime = fd->mtime;
-	stat->acl = rootAcl;
+	stat->acl = getRootAcl();
 
 	auto callback = [&](AttributeEnum& e) -> bool {
 		auto update = [&](void* value) {
@@ -513,20 +2191,35 @@ int FileSystem::fstat(FileHandle file, Stat* stat)
 	checkStat(*stat);
 	stat->attr[FileAttribute::Directory] = (fd->file.type == LFS_TYPE_DIR);
 
+	if(canCache) {
+		statCache.put(fd->pathHash, fd->path.c_str(), *stat);
+	}
+
 	return FS_OK;
 }
 
 int FileSystem::fsetxattr(FileHandle file, AttributeTag tag, const void* data, size_t size)
 {
+	FS_LOCK()
+	PROFILE_OP(attr)
 	GET_FD()
 	CHECK_WRITE()
+	if(!isPublicTag(tag)) {
+		return Error::BadParam;
+	}
+
+	int err = dropAllocState();
+	if(err < 0) {
+		return err;
+	}
 
 	if(data == nullptr) {
 		// Cannot delete standard attributes
 		if(tag < AttributeTag::User) {
 			return Error::NotSupported;
 		}
-		int err = lfs_file_removeattr(&lfs, &fd->file, uint8_t(tag));
+		fd->removePendingAttr(uint8_t(tag));
+		err = lfs_file_removeattr(&lfs, &fd->file, uint8_t(tag));
 		return translateLfsError(err);
 	}
 
@@ -535,13 +2228,32 @@ int FileSystem::fsetxattr(FileHandle file, AttributeTag tag, const void* data, s
 		return Error::BadParam;
 	}
 
+	statCache.invalidate(fd->pathHash);
+
+	// Content tagged as compressed is read by the application as stored, so don't compress it again
+	if(tag == AttributeTag::Compression && fd->compress && fd->compress->info.storedSize == 0 &&
+	   static_cast<const Compression*>(data)->type != Compression::Type::None) {
+		err = storeUncompressed(*fd);
+		if(err < 0) {
+			return err;
+		}
+	}
+
 	if(tag == AttributeTag::ModifiedTime) {
 		memcpy(&fd->mtime, data, attrSize);
 		fd->flags += FileDescriptor::Flag::TimeChanged;
+		notePending(*fd, 1);
 		return FS_OK;
 	}
 
-	int res = lfs_file_setattr(&lfs, &fd->file, uint8_t(tag), data, size);
+	// Regular files get attributes written in the same commit as data
+	int res;
+	if(fd->file.type == LFS_TYPE_REG && fd->setPendingAttr(uint8_t(tag), data, size)) {
+		notePending(*fd, 1);
+		res = LFS_ERR_OK;
+	} else {
+		res = lfs_file_setattr(&lfs, &fd->file, uint8_t(tag), data, size);
+	}
 	if(res >= 0 && fd->flags[FileDescriptor::Flag::IsRoot]) {
 		checkRootAcl(tag, data);
 	}
@@ -551,6 +2263,14 @@ int FileSystem::fsetxattr(FileHandle file, AttributeTag tag, const void* data, s
 
 void FileSystem::checkRootAcl(AttributeTag tag, const void* value)
 {
+	// Root ACL provides defaults for everything else
+	if(tag == AttributeTag::ReadAce || tag == AttributeTag::WriteAce) {
+		statCache.clear();
+	}
+	if(!rootAclLoaded) {
+		// Will be read when needed
+		return;
+	}
 	if(tag == AttributeTag::ReadAce) {
 		rootAcl.readAccess = *static_cast<const UserRole*>(value);
 	}
@@ -561,21 +2281,46 @@ void FileSystem::checkRootAcl(AttributeTag tag, const void* value)
 
 int FileSystem::fgetxattr(FileHandle file, AttributeTag tag, void* buffer, size_t size)
 {
+	FS_LOCK()
+	PROFILE_OP(attr)
 	GET_FD()
+	if(!isPublicTag(tag)) {
+		return Error::BadParam;
+	}
 
 	if(tag == AttributeTag::ModifiedTime) {
 		memcpy(buffer, &fd->mtime, std::min(size, sizeof(TimeStamp)));
 		return sizeof(TimeStamp);
 	}
 
+	auto attr = fd->findPendingAttr(uint8_t(tag));
+	if(attr != nullptr) {
+		memcpy(buffer, attr->buffer, std::min(size, size_t(attr->size)));
+		return attr->size;
+	}
+
 	return lfs_file_getattr(&lfs, &fd->file, uint8_t(tag), buffer, size);
 }
 
 int FileSystem::fenumxattr(FileHandle file, AttributeEnumCallback callback, void* buffer, size_t bufsize)
 {
+	FS_LOCK()
+	PROFILE_OP(attr)
 	GET_FD()
 
+	// Enumeration reads from disk
+	if(fd->hasPendingAttrs()) {
+		int err = commit(*fd);
+		if(err < 0) {
+			return err;
+		}
+	}
+
 	auto lfs_callback = [](struct lfs_attr_enum_t* lfs_e, uint8_t type, lfs_size_t attrsize) -> bool {
+		// Skip internal attributes
+		if(type >= LFS_ATTR_PRIVATE_MIN) {
+			return true;
+		}
 		AttributeEnum e{lfs_e->buffer, lfs_e->bufsize};
 		e.tag = AttributeTag(type);
 		e.attrsize = attrsize;
@@ -592,26 +2337,33 @@ int FileSystem::fenumxattr(FileHandle file, AttributeEnumCallback callback, void
 
 int FileSystem::setxattr(const char* path, AttributeTag tag, const void* data, size_t size)
 {
+	FS_LOCK()
+	PROFILE_OP(attr)
 	CHECK_MOUNTED()
 	FS_CHECK_PATH(path)
+	if(!isPublicTag(tag)) {
+		return Error::BadParam;
+	}
+
+	statCache.invalidate(getPathHash(path));
+	int err = dropAllocState();
+	if(err < 0) {
+		return err;
+	}
 
 	if(data == nullptr) {
 		// Cannot delete standard attributes
 		if(tag < AttributeTag::User) {
 			return Error::NotSupported;
 		}
-		int err = lfs_removeattr(&lfs, path ?: "", uint8_t(tag));
+		err = lfs_removeattr(&lfs, path ?: "", uint8_t(tag));
 		return translateLfsError(err);
 	}
 
-	if(tag < AttributeTag::User) {
-		if(size < getAttributeSize(tag)) {
-			return Error::BadParam;
-		}
-	} else if(unsigned(tag) > 255) {
+	if(tag < AttributeTag::User && size < getAttributeSize(tag)) {
 		return Error::BadParam;
 	}
-	int err = lfs_setattr(&lfs, path ?: "", uint8_t(tag), data, size);
+	err = lfs_setattr(&lfs, path ?: "", uint8_t(tag), data, size);
 
 	if(err >= 0) {
 		checkRootAcl(tag, data);
@@ -622,16 +2374,19 @@ int FileSystem::setxattr(const char* path, AttributeTag tag, const void* data, s
 
 int FileSystem::getxattr(const char* path, AttributeTag tag, void* buffer, size_t size)
 {
+	FS_LOCK()
+	PROFILE_OP(attr)
 	CHECK_MOUNTED()
 	FS_CHECK_PATH(path)
+	if(!isPublicTag(tag)) {
+		return Error::BadParam;
+	}
 
 	if(tag < AttributeTag::User) {
 		auto attrSize = getAttributeSize(tag);
 		if(size < attrSize) {
 			return attrSize;
 		}
-	} else if(unsigned(tag) > 255) {
-		return Error::BadParam;
 	}
 
 	int res = lfs_getattr(&lfs, path ?: "", uint8_t(tag), buffer, size);
@@ -640,48 +2395,125 @@ int FileSystem::getxattr(const char* path, AttributeTag tag, void* buffer, size_
 
 int FileSystem::opendir(const char* path, DirHandle& dir)
 {
+	FS_LOCK()
+	PROFILE_OP(dir)
 	CHECK_MOUNTED()
 	FS_CHECK_PATH(path)
 
-	auto d = new FileDir{};
+	auto d = fileDirs.allocate();
 	if(d == nullptr) {
-		return Error::NoMem;
+		d = new FileDir{};
+		if(d == nullptr) {
+			return Error::NoMem;
+		}
 	}
 
-	int err = lfs_dir_open(&lfs, &d->dir, path ?: "");
+	auto pathHash = getPathHash(path);
+	lfs_block_t pair[2];
+	int err = -1;
+	if(dirCache.get(pathHash, path, eraseCount, pair)) {
+		err = openDirAt(d->dir, pair);
+		if(err < 0) {
+			dirCache.invalidate(pathHash);
+		}
+	}
 	if(err < 0) {
-		err = translateLfsError(err);
-		delete d;
-		return err;
+		err = lfs_dir_open(&lfs, &d->dir, path ?: "");
+		if(err < 0) {
+			err = translateLfsError(err);
+			releaseDir(d);
+			return err;
+		}
+		dirCache.put(pathHash, path, eraseCount, d->dir.head);
 	}
 	lfs_dir_seek(&lfs, &d->dir, 2);
+	d->pathHash = pathHash;
+	d->path = path;
 
 	dir = DirHandle(d);
 	return FS_OK;
 }
 
+/*
+ * Equivalent to `lfs_dir_open` but starting from a known metadata pair,
+ * which avoids resolving the path from the root.
+ */
+int FileSystem::openDirAt(lfs_dir_t& dir, const lfs_block_t pair[2])
+{
+	dir = lfs_dir_t{};
+	dir.head[0] = pair[0];
+	dir.head[1] = pair[1];
+	dir.type = LFS_TYPE_DIR;
+
+	attachOpenDir(lfs, dir);
+
+	// Fetches metadata from head
+	int err = lfs_dir_rewind(&lfs, &dir);
+	if(err < 0) {
+		lfs_dir_close(&lfs, &dir);
+	}
+	return err;
+}
+
 int FileSystem::rewinddir(DirHandle dir)
 {
+	FS_LOCK()
+	PROFILE_OP(dir)
 	GET_FILEDIR()
 
 	// Skip "." and ".." entries for consistency with other filesystems
 	int err = lfs_dir_seek(&lfs, &d->dir, 2);
+	d->readCount = 0;
 	return translateLfsError(err);
 }
 
 int FileSystem::readdir(DirHandle dir, Stat& stat)
 {
+	FS_LOCK()
+	PROFILE_OP(dir)
+	GET_FILEDIR()
+
+	return readEntry(*d, stat, true);
+}
+
+int FileSystem::readdirBatch(DirHandle dir, Stat* list, unsigned count, bool withAttributes)
+{
+	FS_LOCK()
+	PROFILE_OP(dir)
 	GET_FILEDIR()
 
+	unsigned n{0};
+	for(; n < count; ++n) {
+		int err = readEntry(*d, list[n], withAttributes);
+		if(err == Error::NoMoreFiles) {
+			break;
+		}
+		if(err < 0) {
+			return n ? int(n) : err;
+		}
+	}
+	return n;
+}
+
+/*
+ * Read next directory entry, without attributes if not required
+ *
+ * Entries read with attributes are added to the stat cache, except in large directories
+ * where a listing would otherwise evict everything else.
+ */
+int FileSystem::readEntry(FileDir& d, Stat& stat, bool withAttributes)
+{
 	stat = Stat{};
-	stat.acl = rootAcl;
+	struct lfs_info info {
+	};
+
+	stat.acl = getRootAcl();
 	StatAttr sa(stat);
+	// Compression attribute is always needed to get the correct size
 	struct lfs_stat_config cfg {
-		sa.attrs, sa.count
-	};
-	struct lfs_info info {
+		withAttributes ? sa.attrs : &sa.attrs[StatAttr::count - 1], withAttributes ? sa.count : 1
 	};
-	int err = lfs_dir_readcfg(&lfs, &d->dir, &info, &cfg);
+	int err = lfs_dir_readcfg(&lfs, &d.dir, &info, &cfg);
 	if(err == 0) {
 		return Error::NoMoreFiles;
 	}
@@ -690,28 +2522,59 @@ int FileSystem::readdir(DirHandle dir, Stat& stat)
 	}
 
 	stat.fs = this;
-	stat.id = d->dir.id - 1;
+	stat.id = d.dir.id - 1;
 	fillStat(stat, info);
+	sa.update(stat);
+	if(d.readCount < UINT16_MAX) {
+		++d.readCount;
+	}
+	if(withAttributes && d.pathHash != 0 && d.readCount <= statCache.getSize() / 2) {
+		auto hash = getPathHash(info.name, d.pathHash);
+		statCache.put(hash, d.path.c_str(), info.name, stat);
+	}
 	return FS_OK;
 }
 
 int FileSystem::closedir(DirHandle dir)
 {
+	FS_LOCK()
+	PROFILE_OP(dir)
 	GET_FILEDIR()
 
 	int err = lfs_dir_close(&lfs, &d->dir);
-	delete d;
+	releaseDir(d);
 	return translateLfsError(err);
 }
 
+void FileSystem::releaseDir(FileDir* d)
+{
+	if(fileDirs.contains(d)) {
+		fileDirs.release(d);
+	} else {
+		delete d;
+	}
+}
+
 int FileSystem::mkdir(const char* path)
 {
+	FS_LOCK()
+	PROFILE_OP(mkdir)
 	CHECK_MOUNTED()
 	if(isRootPath(path)) {
 		return Error::BadParam;
 	}
 
-	int err = lfs_mkdir(&lfs, path);
+	auto pathHash = getPathHash(path);
+	if(dirCache.exists(pathHash, path)) {
+		return FS_OK;
+	}
+
+	statCache.invalidate(pathHash);
+	int err = dropAllocState();
+	if(err < 0) {
+		return err;
+	}
+	err = lfs_mkdir(&lfs, path);
 	if(err == 0) {
 		TimeStamp mtime;
 		mtime = fsGetTimeUTC();
@@ -725,17 +2588,56 @@ int FileSystem::mkdir(const char* path)
 
 int FileSystem::rename(const char* oldpath, const char* newpath)
 {
+	FS_LOCK()
+	PROFILE_OP(rename)
 	CHECK_MOUNTED()
 	if(isRootPath(oldpath) || isRootPath(newpath)) {
 		return Error::BadParam;
 	}
 
-	int err = lfs_rename(&lfs, oldpath, newpath);
-	return translateLfsError(err);
+	// Renaming a directory moves everything within it
+	statCache.clear();
+	dirCache.clear();
+	int err = dropAllocState();
+	if(err < 0) {
+		return err;
+	}
+	err = lfs_rename(&lfs, oldpath, newpath);
+	if(err < 0) {
+		return translateLfsError(err);
+	}
+	renameOpenFiles(oldpath, newpath);
+	return FS_OK;
+}
+
+/*
+ * Update paths recorded for open files following a rename
+ */
+void FileSystem::renameOpenFiles(const char* oldpath, const char* newpath)
+{
+	FS_CHECK_PATH(oldpath)
+	FS_CHECK_PATH(newpath)
+	auto oldLength = strlen(oldpath);
+	for(unsigned i = 0; i < fileDescriptors.capacity(); ++i) {
+		auto fd = fileDescriptors[i];
+		if(fd == nullptr || !fd->path) {
+			continue;
+		}
+		auto path = fd->path.c_str();
+		if(strncmp(path, oldpath, oldLength) != 0 || (path[oldLength] != '\0' && path[oldLength] != '/')) {
+			continue;
+		}
+		String s(newpath);
+		s += &path[oldLength];
+		fd->path = s;
+		fd->pathHash = getPathHash(s.c_str());
+	}
 }
 
 int FileSystem::remove(const char* path)
 {
+	FS_LOCK()
+	PROFILE_OP(remove)
 	CHECK_MOUNTED()
 	if(isRootPath(path)) {
 		return Error::BadParam;
@@ -748,26 +2650,294 @@ int FileSystem::remove(const char* path)
 		return Error::ReadOnly;
 	}
 
-	int err = lfs_remove(&lfs, path);
+	auto pathHash = getPathHash(path);
+	statCache.invalidate(pathHash);
+	dirCache.invalidate(pathHash);
+	int err = dropAllocState();
+	if(err < 0) {
+		return err;
+	}
+	err = lfs_remove(&lfs, path);
+	return translateLfsError(err);
+}
+
+/*
+ * Get metadata pair for a subdirectory, the entry most recently read from `dir`
+ */
+int FileSystem::getChildPair(const lfs_dir_t& dir, lfs_block_t pair[2])
+{
+	MetaReader reader(lfsConfig, &lfs);
+	lfs_off_t off;
+	int32_t tag = reader.findTag(dir.m, Tag::make(0x700, 0x3ff, 0), Tag::make(LFS_TYPE_STRUCT, dir.id - 1, 0), off);
+	if(tag < 0) {
+		return translateLfsError(tag);
+	}
+	if(Tag{uint32_t(tag)}.type() != LFS_TYPE_DIRSTRUCT) {
+		return Error::BadFileSystem;
+	}
+	uint8_t buffer[8];
+	int err = reader.read(dir.m.pair[0], off, buffer, sizeof(buffer));
+	if(err < 0) {
+		return translateLfsError(err);
+	}
+	pair[0] = fromle32(&buffer[0]);
+	pair[1] = fromle32(&buffer[4]);
+	return FS_OK;
+}
+
+int FileSystem::dirUsage(const char* path, DirUsage& usage)
+{
+	FS_LOCK()
+	PROFILE_OP(dir)
+	CHECK_MOUNTED()
+	FS_CHECK_PATH(path)
+
+	usage = DirUsage{};
+	lfs_dir_t dir;
+	int err = lfs_dir_open(&lfs, &dir, path ?: "");
+	if(err < 0) {
+		return translateLfsError(err);
+	}
+	err = usageAt(dir, usage);
+	lfs_dir_close(&lfs, &dir);
+	return err;
+}
+
+/*
+ * Subdirectories are opened from their metadata pair, so paths are never resolved
+ */
+int FileSystem::usageAt(lfs_dir_t& dir, DirUsage& usage)
+{
+	MetaReader reader(lfsConfig, &lfs);
+	Compress::Info compress;
+	lfs_attr attr{LFS_ATTR_COMPRESS, &compress, sizeof(compress)};
+	struct lfs_stat_config cfg {
+		&attr, 1
+	};
+
+	int err = lfs_dir_seek(&lfs, &dir, 2);
+	if(err < 0) {
+		return translateLfsError(err);
+	}
+	lfs_block_t lastPair = dir.m.pair[0];
+	usage.blocks += 2;
+
+	for(;;) {
+		compress = Compress::Info{};
+		struct lfs_info info {
+		};
+		err = lfs_dir_readcfg(&lfs, &dir, &info, &cfg);
+		if(err <= 0) {
+			return translateLfsError(err);
+		}
+		// Large directories have several metadata pairs
+		if(dir.m.pair[0] != lastPair) {
+			lastPair = dir.m.pair[0];
+			usage.blocks += 2;
+		}
+
+		if(info.type == LFS_TYPE_DIR) {
+			++usage.directories;
+			lfs_block_t pair[2];
+			err = getChildPair(dir, pair);
+			if(err < 0) {
+				return err;
+			}
+			lfs_dir_t child;
+			err = openDirAt(child, pair);
+			if(err < 0) {
+				return translateLfsError(err);
+			}
+			err = usageAt(child, usage);
+			lfs_dir_close(&lfs, &child);
+			if(err < 0) {
+				return err;
+			}
+			continue;
+		}
+
+		++usage.files;
+		usage.size += (compress.chunkSize != 0) ? compress.size : info.size;
+		if(info.size == 0) {
+			continue;
+		}
+		lfs_off_t off;
+		int32_t tag =
+			reader.findTag(dir.m, Tag::make(0x700, 0x3ff, 0), Tag::make(LFS_TYPE_STRUCT, dir.id - 1, 0), off);
+		if(tag < 0) {
+			return translateLfsError(tag);
+		}
+		if(Tag{uint32_t(tag)}.type() == LFS_TYPE_CTZSTRUCT) {
+			off = info.size - 1;
+			usage.blocks += reader.ctzIndex(off) + 1;
+		}
+	}
+}
+
+int FileSystem::removeTree(const char* path)
+{
+	FS_LOCK()
+	PROFILE_OP(remove)
+	CHECK_MOUNTED()
+	FS_CHECK_PATH(path)
+
+	lfs_dir_t dir;
+	int err = lfs_dir_open(&lfs, &dir, path ?: "");
+	if(err == LFS_ERR_NOTDIR) {
+		return remove(path);
+	}
+	if(err < 0) {
+		return translateLfsError(err);
+	}
+
+	// Directory itself must not be read-only, as for `remove()`
+	if(path != nullptr) {
+		FileAttributes attr{};
+		get_attr(path, AttributeTag::FileAttributes, attr);
+		if(attr[FileAttribute::ReadOnly]) {
+			lfs_dir_close(&lfs, &dir);
+			return Error::ReadOnly;
+		}
+	}
+
+	// Affects many paths
+	statCache.clear();
+	dirCache.clear();
+	err = dropAllocState();
+	if(err >= 0) {
+		String childPath = path;
+		err = removeAt(dir, childPath);
+	}
+	lfs_dir_close(&lfs, &dir);
+	if(err < 0 || path == nullptr) {
+		return err;
+	}
+
+	err = lfs_remove(&lfs, path);
 	return translateLfsError(err);
 }
 
+/*
+ * Remove directory content. littlefs keeps the open directory position valid as entries are removed.
+ *
+ * Entries are found without resolving any paths, but littlefs can only delete an entry by path
+ * (the commit operations which work on a metadata pair and id are internal), so `lfs_remove()`
+ * resolves each child from the root. Keeping the tree shallow keeps this cheap.
+ *
+ * @param path Path of directory, used to build child paths: restored on return
+ */
+int FileSystem::removeAt(lfs_dir_t& dir, String& path)
+{
+	FileAttributes attr;
+	auto lattr = makeAttr(AttributeTag::FileAttributes, attr);
+	struct lfs_stat_config cfg {
+		&lattr, 1
+	};
+
+	int err = lfs_dir_seek(&lfs, &dir, 2);
+	if(err < 0) {
+		return translateLfsError(err);
+	}
+
+	auto pathLength = path.length();
+	for(;;) {
+		attr = FileAttributes{};
+		struct lfs_info info {
+		};
+		err = lfs_dir_readcfg(&lfs, &dir, &info, &cfg);
+		if(err <= 0) {
+			err = translateLfsError(err);
+			break;
+		}
+		if(attr[FileAttribute::ReadOnly]) {
+			err = Error::ReadOnly;
+			break;
+		}
+
+		path.setLength(pathLength);
+		if(pathLength != 0) {
+			path += '/';
+		}
+		path += info.name;
+
+		if(info.type == LFS_TYPE_DIR) {
+			lfs_block_t pair[2];
+			err = getChildPair(dir, pair);
+			if(err < 0) {
+				break;
+			}
+			lfs_dir_t child;
+			err = openDirAt(child, pair);
+			if(err < 0) {
+				err = translateLfsError(err);
+				break;
+			}
+			err = removeAt(child, path);
+			lfs_dir_close(&lfs, &child);
+			if(err < 0) {
+				break;
+			}
+		}
+
+		err = lfs_remove(&lfs, path.c_str());
+		if(err < 0) {
+			err = translateLfsError(err);
+			break;
+		}
+	}
+
+	path.setLength(pathLength);
+	return err;
+}
+
 int FileSystem::fremove(FileHandle file)
 {
+	FS_LOCK()
+	PROFILE_OP(remove)
 	GET_FD()
 
+	if(fd->flags[FileDescriptor::Flag::IsRoot]) {
+		return Error::BadParam;
+	}
+
 	FileAttributes attr{};
 	get_attr(fd->file, AttributeTag::FileAttributes, attr);
 	if(attr[FileAttribute::ReadOnly]) {
 		return Error::ReadOnly;
 	}
 
+	int err = dropAllocState();
+	if(err < 0) {
+		return err;
+	}
+
+	err = lfs_remove(&lfs, fd->path.c_str());
+	if(err < 0) {
+		return translateLfsError(err);
+	}
+	statCache.invalidate(fd->pathHash);
+
 	/*
-	 * TODO: Update littlefs library to support deletion of open file.
-	 * Note that we can mark the file descriptor as invalid, but don't release it:
-	 * that happens when the user calls `close()`.
+	 * Close the file, discarding any unwritten data as littlefs skips sync for errored files.
+	 * The descriptor isn't released until the user calls `close()`.
 	 */
-	return Error::NotImplemented;
+	dropReadAhead(*fd);
+	fd->compress.reset();
+	fd->writeBehind.pending = 0;
+	fd->file.flags |= LFS_F_ERRED;
+	lfs_file_close(&lfs, &fd->file);
+	fd->flags += FileDescriptor::Flag::Removed;
+	return FS_OK;
+}
+
+int FileSystem::getFilePath(FileHandle file, String& path)
+{
+	FS_LOCK()
+	PROFILE_OP(stat)
+	GET_FD()
+
+	path = fd->path.c_str();
+	return FS_OK;
 }
 
 } // namespace LittleFS
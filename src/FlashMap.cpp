@@ -0,0 +1,88 @@
+/**
+ * FlashMap.cpp
+ *
+ * Copyright 2021 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the Sming-LittleFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#include "include/LittleFS/FlashMap.h"
+#include <Storage/SpiFlash.h>
+
+#if defined(ARCH_ESP8266)
+#include <esp_spi_flash.h>
+#elif defined(ARCH_ESP32)
+#include <esp_spi_flash.h>
+#elif defined(ARCH_RP2040)
+#include <hardware/regs/addressmap.h>
+#endif
+
+namespace IFS
+{
+namespace LittleFS
+{
+bool mapFlash(Storage::Partition& partition, storage_size_t offset, size_t size, FlashMapping& mapping)
+{
+	mapping = FlashMapping{};
+
+	if(partition.getDevice() != Storage::spiFlash || offset + size > partition.size()) {
+		return false;
+	}
+	uint32_t addr = partition.address() + offset;
+
+#if defined(ARCH_ESP8266)
+	// Only one 1MByte segment is mapped at a time
+	constexpr uint32_t windowSize{0x100000};
+	auto windowStart = flashmem_get_address(reinterpret_cast<const void*>(INTERNAL_FLASH_START_ADDRESS));
+	if(addr < windowStart || addr + size > windowStart + windowSize) {
+		return false;
+	}
+	mapping.data = reinterpret_cast<const void*>(INTERNAL_FLASH_START_ADDRESS + addr - windowStart);
+	return true;
+
+#elif defined(ARCH_ESP32)
+	auto pageOffset = addr % SPI_FLASH_MMU_PAGE_SIZE;
+	const void* ptr;
+	spi_flash_mmap_handle_t handle;
+	auto err = spi_flash_mmap(addr - pageOffset, size + pageOffset, SPI_FLASH_MMAP_DATA, &ptr, &handle);
+	if(err != ESP_OK) {
+		debug_w("[LFS] spi_flash_mmap(0x%08x, %u) failed %d", addr, size, err);
+		return false;
+	}
+	mapping.data = static_cast<const uint8_t*>(ptr) + pageOffset;
+	mapping.handle = handle;
+	return true;
+
+#elif defined(ARCH_RP2040)
+	mapping.data = reinterpret_cast<const void*>(XIP_BASE + addr);
+	return true;
+
+#else
+	(void)addr;
+	return false;
+#endif
+}
+
+void unmapFlash(FlashMapping& mapping)
+{
+#ifdef ARCH_ESP32
+	if(mapping) {
+		spi_flash_munmap(mapping.handle);
+	}
+#endif
+	mapping = FlashMapping{};
+}
+
+} // namespace LittleFS
+} // namespace IFS
@@ -26,9 +26,9 @@
 
 namespace IFS
 {
-FileSystem* createLfsFilesystem(Storage::Partition partition)
+FileSystem* createLfsFilesystem(Storage::Partition partition, const LittleFS::Config& config)
 {
-	auto fs = new LittleFS::FileSystem(partition);
+	auto fs = new LittleFS::FileSystem(partition, config);
 	return FileSystem::cast(fs);
 }
 
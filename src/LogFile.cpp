@@ -0,0 +1,287 @@
+/**
+ * LogFile.cpp
+ *
+ * Copyright 2021 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the Sming-LittleFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#include "include/LittleFS/LogFile.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+namespace IFS
+{
+namespace LittleFS
+{
+namespace
+{
+constexpr size_t headerSize{sizeof(uint16_t)};
+constexpr size_t segmentNameLength{8};
+
+} // namespace
+
+String LogFile::getSegmentPath(uint32_t seq) const
+{
+	char name[segmentNameLength + 2];
+	snprintf(name, sizeof(name), "/%08x", seq);
+	return path + name;
+}
+
+int LogFile::open(const String& path, const Config& config)
+{
+	close();
+
+	if(config.segmentCount == 0 || config.maxRecordSize == 0 ||
+	   config.segmentSize < headerSize + config.maxRecordSize) {
+		return Error::BadParam;
+	}
+
+	int err = fs.mkdir(path.c_str());
+	if(err < 0) {
+		return err;
+	}
+
+	// Find range of existing segments
+	DirHandle dir;
+	err = fs.opendir(path.c_str(), dir);
+	if(err < 0) {
+		return err;
+	}
+	bool found{false};
+	NameStat stat;
+	while(fs.readdir(dir, stat) == FS_OK) {
+		if(stat.isDir() || stat.name.length != segmentNameLength) {
+			continue;
+		}
+		char* end;
+		uint32_t seq = strtoul(stat.name.c_str(), &end, 16);
+		if(*end != '\0') {
+			continue;
+		}
+		if(!found) {
+			firstSeq = lastSeq = seq;
+			found = true;
+		} else {
+			firstSeq = std::min(firstSeq, seq);
+			lastSeq = std::max(lastSeq, seq);
+		}
+	}
+	fs.closedir(dir);
+
+	this->path = path;
+	this->config = config;
+	buffer.reset(new uint8_t[headerSize + config.maxRecordSize]);
+	if(!buffer) {
+		return Error::NoMem;
+	}
+
+	if(!found) {
+		firstSeq = lastSeq = 0;
+		err = startSegment(0);
+	} else {
+		// Content is only committed at record boundaries so no scan is required
+		auto file = fs.open(getSegmentPath(lastSeq).c_str(), File::Create | File::Append | File::WriteOnly);
+		if(file < 0) {
+			return file;
+		}
+		writeFile = file;
+		auto pos = fs.lseek(file, 0, SeekOrigin::End);
+		if(pos < 0) {
+			err = pos;
+		}
+		writePos = pos;
+	}
+
+	while(err >= 0 && lastSeq - firstSeq >= config.segmentCount) {
+		err = removeOldest();
+	}
+
+	if(err < 0) {
+		close();
+		return err;
+	}
+
+	readSeq = firstSeq;
+	readPos = 0;
+	return FS_OK;
+}
+
+int LogFile::close()
+{
+	closeReader();
+	buffer.reset();
+	if(writeFile < 0) {
+		return FS_OK;
+	}
+	int err = fs.close(writeFile);
+	writeFile = -1;
+	return err;
+}
+
+int LogFile::startSegment(uint32_t seq)
+{
+	auto file = fs.open(getSegmentPath(seq).c_str(), File::CreateNewAlways | File::WriteOnly);
+	if(file < 0) {
+		return file;
+	}
+	lastSeq = seq;
+	writeFile = file;
+	writePos = 0;
+	return FS_OK;
+}
+
+int LogFile::removeOldest()
+{
+	if(readSeq == firstSeq) {
+		closeReader();
+		++readSeq;
+		readPos = 0;
+	}
+	int err = fs.remove(getSegmentPath(firstSeq).c_str());
+	if(err < 0 && err != Error::NotFound) {
+		return err;
+	}
+	++firstSeq;
+	return FS_OK;
+}
+
+void LogFile::closeReader()
+{
+	if(readFile >= 0) {
+		fs.close(readFile);
+		readFile = -1;
+	}
+}
+
+int LogFile::append(const void* data, uint16_t size)
+{
+	if(!isOpen()) {
+		return Error::FileNotOpen;
+	}
+	if(size == 0 || size > config.maxRecordSize) {
+		return Error::BadParam;
+	}
+
+	size_t recordSize = headerSize + size;
+	if(writePos + recordSize > config.segmentSize) {
+		int err = fs.close(writeFile);
+		writeFile = -1;
+		if(err < 0) {
+			return err;
+		}
+		// lastSeq only advances once the new segment exists
+		auto seq = lastSeq + 1;
+		while(seq - firstSeq >= config.segmentCount) {
+			err = removeOldest();
+			if(err < 0) {
+				return err;
+			}
+		}
+		err = startSegment(seq);
+		if(err < 0) {
+			return err;
+		}
+	}
+
+	// A single write ensures any commit, explicit or write-behind, occurs on a record boundary
+	buffer[0] = size & 0xff;
+	buffer[1] = size >> 8;
+	memcpy(&buffer[headerSize], data, size);
+	int res = fs.write(writeFile, buffer.get(), recordSize);
+	if(res < 0) {
+		return res;
+	}
+	writePos += recordSize;
+	return FS_OK;
+}
+
+int LogFile::flush()
+{
+	if(!isOpen()) {
+		return Error::FileNotOpen;
+	}
+	return fs.flush(writeFile);
+}
+
+int LogFile::rewind()
+{
+	if(!isOpen()) {
+		return Error::FileNotOpen;
+	}
+	closeReader();
+	readSeq = firstSeq;
+	readPos = 0;
+	return FS_OK;
+}
+
+int LogFile::read(void* buffer, size_t bufSize)
+{
+	if(!isOpen()) {
+		return Error::FileNotOpen;
+	}
+
+	for(;;) {
+		if(readFile < 0) {
+			auto file = fs.open(getSegmentPath(readSeq).c_str(), File::ReadOnly);
+			if(file < 0) {
+				return file;
+			}
+			readFile = file;
+			if(readPos != 0) {
+				auto pos = fs.lseek(file, readPos, SeekOrigin::Start);
+				if(pos < 0) {
+					return pos;
+				}
+			}
+		}
+
+		uint8_t header[headerSize];
+		int res = fs.read(readFile, header, sizeof(header));
+		if(res < 0) {
+			return res;
+		}
+		if(res == sizeof(header)) {
+			uint16_t size = header[0] | (header[1] << 8);
+			auto len = std::min(size_t(size), bufSize);
+			res = fs.read(readFile, buffer, len);
+			if(res < 0) {
+				return res;
+			}
+			if(len < size) {
+				auto pos = fs.lseek(readFile, size - len, SeekOrigin::Current);
+				if(pos < 0) {
+					return pos;
+				}
+			}
+			readPos += headerSize + size;
+			return size;
+		}
+
+		/*
+		 * End of segment. Release handle so records appended to the current segment
+		 * are seen on the next call.
+		 */
+		closeReader();
+		if(readSeq >= lastSeq) {
+			return 0;
+		}
+		++readSeq;
+		readPos = 0;
+	}
+}
+
+} // namespace LittleFS
+} // namespace IFS
@@ -0,0 +1,150 @@
+/**
+ * Metadata.cpp
+ *
+ * Copyright 2021 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the Sming-LittleFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#include "include/LittleFS/Metadata.h"
+#include <algorithm>
+
+namespace IFS
+{
+namespace LittleFS
+{
+int MetaReader::read(lfs_block_t block, lfs_off_t off, void* buffer, lfs_size_t size) const
+{
+	if(block >= cfg.block_count || off + size > cfg.block_size) {
+		return LFS_ERR_CORRUPT;
+	}
+	return cfg.read(&cfg, block, off, buffer, size);
+}
+
+lfs_off_t MetaReader::ctzIndex(lfs_off_t& off) const
+{
+	lfs_off_t size = off;
+	lfs_off_t b = cfg.block_size - 2 * 4;
+	lfs_off_t i = size / b;
+	if(i == 0) {
+		return 0;
+	}
+	i = (size - 4 * (__builtin_popcount(i - 1) + 2)) / b;
+	off = size - b * i - 4 * __builtin_popcount(i);
+	return i;
+}
+
+int MetaReader::ctzFind(lfs_block_t head, lfs_size_t size, lfs_off_t pos, lfs_block_t& block, lfs_off_t& off) const
+{
+	if(size == 0) {
+		block = BLOCK_NULL;
+		off = 0;
+		return LFS_ERR_OK;
+	}
+
+	lfs_off_t last = size - 1;
+	lfs_off_t current = ctzIndex(last);
+	off = pos;
+	lfs_off_t target = ctzIndex(off);
+	while(current > target) {
+		lfs_size_t skip = std::min(31U - __builtin_clz(current - target), unsigned(__builtin_ctz(current)));
+		uint8_t buf[4];
+		int err = read(head, sizeof(lfs_block_t) * skip, buf, sizeof(buf));
+		if(err < 0) {
+			return err;
+		}
+		head = fromle32(buf);
+		current -= 1U << skip;
+	}
+
+	block = head;
+	return LFS_ERR_OK;
+}
+
+int MetaReader::ctzTraverse(lfs_block_t head, lfs_size_t size, CtzCallback callback, void* param) const
+{
+	if(size == 0) {
+		return LFS_ERR_OK;
+	}
+
+	lfs_off_t end = size - 1;
+	lfs_off_t index = ctzIndex(end);
+	++end;
+	for(;;) {
+		int err = callback(param, index, head, ctzDataOffset(index), end);
+		if(err != 0 || index == 0) {
+			return err;
+		}
+
+		uint8_t buf[4];
+		err = read(head, 0, buf, sizeof(buf));
+		if(err < 0) {
+			return err;
+		}
+		head = fromle32(buf);
+		--index;
+		end = cfg.block_size;
+	}
+}
+
+int32_t MetaReader::findTag(const lfs_mdir_t& dir, uint32_t gmask, uint32_t gtag, lfs_off_t& dataOffset) const
+{
+	lfs_off_t off = dir.off;
+	Tag ntag{dir.etag};
+	uint32_t gdiff = 0;
+
+	// Synthetic moves
+	if(lfs != nullptr && Tag{gmask}.id() != 0) {
+		auto& gdisk = lfs->gdisk;
+		bool hasMoveHere = Tag{gdisk.tag}.type1() != 0 &&
+						   (gdisk.pair[0] == dir.pair[0] || gdisk.pair[1] == dir.pair[1] ||
+							gdisk.pair[0] == dir.pair[1] || gdisk.pair[1] == dir.pair[0]);
+		if(hasMoveHere && Tag{gdisk.tag}.id() <= Tag{gtag}.id()) {
+			gdiff -= Tag::make(0, 1, 0);
+		}
+	}
+
+	while(off >= sizeof(uint32_t) + ntag.dsize()) {
+		off -= ntag.dsize();
+		Tag tag = ntag;
+		uint8_t buf[4];
+		int err = read(dir.pair[0], off, buf, sizeof(buf));
+		if(err < 0) {
+			return err;
+		}
+		ntag.value = (frombe32(buf) ^ tag.value) & 0x7fffffff;
+
+		if(Tag{gmask}.id() != 0 && tag.type1() == LFS_TYPE_SPLICE && tag.id() <= Tag{gtag - gdiff}.id()) {
+			if(tag.value == (Tag::make(LFS_TYPE_CREATE, 0, 0) | (Tag::make(0, 0x3ff, 0) & (gtag - gdiff)))) {
+				// Found where we were created
+				return LFS_ERR_NOENT;
+			}
+			// Move around splices
+			gdiff += uint32_t(int32_t(tag.splice())) << 10;
+		}
+
+		if((gmask & tag.value) == (gmask & (gtag - gdiff))) {
+			if(tag.isDelete()) {
+				return LFS_ERR_NOENT;
+			}
+			dataOffset = off + sizeof(uint32_t);
+			return tag.value + gdiff;
+		}
+	}
+
+	return LFS_ERR_NOENT;
+}
+
+} // namespace LittleFS
+} // namespace IFS
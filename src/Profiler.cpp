@@ -0,0 +1,225 @@
+/**
+ * Profiler.cpp
+ *
+ * Copyright 2021 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the Sming-LittleFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#include "include/LittleFS/Profiler.h"
+#include <algorithm>
+
+namespace IFS
+{
+namespace LittleFS
+{
+String toString(Profiler::Operation operation)
+{
+	switch(operation) {
+#define XX(name)                                                                                                       \
+	case Profiler::Operation::name:                                                                                    \
+		return F(#name);
+		LFS_PROFILER_OPERATION_MAP(XX)
+#undef XX
+	default:
+		return nullptr;
+	}
+}
+
+String toString(Profiler::Device device)
+{
+	switch(device) {
+	case Profiler::Device::read:
+		return F("read");
+	case Profiler::Device::prog:
+		return F("prog");
+	case Profiler::Device::erase:
+		return F("erase");
+	case Profiler::Device::sync:
+		return F("sync");
+	default:
+		return nullptr;
+	}
+}
+
+void Profiler::Histogram::add(uint32_t value)
+{
+	unsigned n = (value == 0) ? 0 : 32 - __builtin_clz(value);
+	if(n >= bucketCount) {
+		n = bucketCount - 1;
+	}
+	++buckets[n];
+}
+
+size_t Profiler::Histogram::printTo(Print& p) const
+{
+	size_t n{0};
+	for(unsigned i = 0; i < bucketCount; ++i) {
+		if(buckets[i] == 0) {
+			continue;
+		}
+		// Lower bound of bucket
+		n += p.print(' ');
+		n += p.print((i == 0) ? 0 : 1U << (i - 1));
+		n += p.print(':');
+		n += p.print(buckets[i]);
+	}
+	return n;
+}
+
+bool Profiler::setGeometry(size_t blockSize, size_t blockCount)
+{
+	blockCounts.reset();
+	this->blockSize = 0;
+	this->blockCount = 0;
+	if(blockSize == 0 || blockCount == 0) {
+		return true;
+	}
+	blockCounts.reset(new uint32_t[3 * blockCount]{});
+	if(!blockCounts) {
+		return false;
+	}
+	this->blockSize = blockSize;
+	this->blockCount = blockCount;
+	return true;
+}
+
+void Profiler::reset()
+{
+	for(auto& dev : devices) {
+		dev = DeviceStats{};
+	}
+	for(auto& op : operations) {
+		op = OperationStats{};
+	}
+	if(blockCounts) {
+		std::fill_n(blockCounts.get(), 3 * blockCount, 0);
+	}
+}
+
+void Profiler::record(Device device, storage_size_t address, size_t size)
+{
+	auto& dev = devices[unsigned(device)];
+	++dev.count;
+	dev.bytes += size;
+	dev.sizes.add(size);
+
+	auto& op = operations[unsigned(operation)];
+	++op.count[unsigned(device)];
+	op.bytes[unsigned(device)] += size;
+
+	if(blockCounts && device != Device::sync) {
+		auto block = address / blockSize;
+		if(block < blockCount) {
+			++blockCounts[unsigned(device) * blockCount + block];
+		}
+	}
+}
+
+void Profiler::recordTime(Device device, uint32_t time)
+{
+	auto& dev = devices[unsigned(device)];
+	dev.time += time;
+	dev.maxTime = std::max(dev.maxTime, time);
+	dev.times.add(time);
+	operations[unsigned(operation)].time += time;
+}
+
+uint32_t Profiler::getBlockCount(Device device, uint32_t block) const
+{
+	if(!blockCounts || device == Device::sync || block >= blockCount) {
+		return 0;
+	}
+	return blockCounts[unsigned(device) * blockCount + block];
+}
+
+size_t Profiler::printTo(Print& p) const
+{
+	size_t n{0};
+
+	for(unsigned i = 0; i < deviceCount; ++i) {
+		auto& dev = devices[i];
+		if(dev.count == 0) {
+			continue;
+		}
+		n += p.print(toString(Device(i)));
+		n += p.print(_F(": count "));
+		n += p.print(dev.count);
+		n += p.print(_F(", bytes "));
+		n += p.print(dev.bytes);
+		n += p.print(_F(", time "));
+		n += p.print(dev.time);
+		n += p.print(_F("us, max "));
+		n += p.print(dev.maxTime);
+		n += p.println(_F("us"));
+		if(Device(i) != Device::sync) {
+			n += p.print(_F("  sizes:"));
+			n += p.println(dev.sizes);
+		}
+		n += p.print(_F("  times:"));
+		n += p.println(dev.times);
+	}
+
+	for(unsigned i = 0; i < operationCount; ++i) {
+		auto& op = operations[i];
+		if(op.calls == 0 && op.count[0] == 0 && op.count[1] == 0 && op.count[2] == 0 && op.count[3] == 0) {
+			continue;
+		}
+		n += p.print(toString(Operation(i)));
+		n += p.print(_F(": calls "));
+		n += p.print(op.calls);
+		for(unsigned d = 0; d < deviceCount; ++d) {
+			if(op.count[d] == 0) {
+				continue;
+			}
+			n += p.print(", ");
+			n += p.print(toString(Device(d)));
+			n += p.print(' ');
+			n += p.print(op.count[d]);
+			if(Device(d) != Device::sync) {
+				n += p.print('/');
+				n += p.print(op.bytes[d]);
+			}
+		}
+		n += p.print(_F(", time "));
+		n += p.print(op.time);
+		n += p.println(_F("us"));
+	}
+
+	return n;
+}
+
+size_t Profiler::printHeatmap(Print& p, Device device) const
+{
+	if(!blockCounts || device == Device::sync) {
+		return 0;
+	}
+	size_t n{0};
+	for(unsigned i = 0; i < blockCount; ++i) {
+		if(i % 8 == 0) {
+			if(i != 0) {
+				n += p.println();
+			}
+			n += p.print(String(i).padLeft(5));
+			n += p.print(':');
+		}
+		n += p.print(' ');
+		n += p.print(String(getBlockCount(device, i)).padLeft(7));
+	}
+	n += p.println();
+	return n;
+}
+
+} // namespace LittleFS
+} // namespace IFS
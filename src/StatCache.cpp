@@ -0,0 +1,231 @@
+/**
+ * StatCache.cpp
+ *
+ * Copyright 2021 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the Sming-LittleFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#include "include/LittleFS/StatCache.h"
+
+namespace IFS
+{
+namespace LittleFS
+{
+namespace
+{
+// FNV-1a
+constexpr uint32_t FNV_OFFSET_BASIS{2166136261U};
+constexpr uint32_t FNV_PRIME{16777619U};
+
+uint32_t fnv(uint32_t hash, char c)
+{
+	return (hash ^ uint8_t(c)) * FNV_PRIME;
+}
+
+/*
+ * Compare components of `path` with the start of a normalised path
+ * Returns position in `stored` following the match, or nullptr if they differ
+ */
+const char* matchPath(const char* stored, const char* path)
+{
+	if(path == nullptr) {
+		return stored;
+	}
+	for(;;) {
+		while(*path == '/') {
+			++path;
+		}
+		if(*path == '\0') {
+			return stored;
+		}
+		if(*stored == '/') {
+			++stored;
+		}
+		auto len = strcspn(path, "/");
+		if(strncmp(stored, path, len) != 0 || (stored[len] != '\0' && stored[len] != '/')) {
+			return nullptr;
+		}
+		stored += len;
+		path += len;
+	}
+}
+
+void appendPath(String& s, const char* path)
+{
+	if(path == nullptr) {
+		return;
+	}
+	for(;;) {
+		while(*path == '/') {
+			++path;
+		}
+		if(*path == '\0') {
+			return;
+		}
+		auto len = strcspn(path, "/");
+		if(s.length() != 0) {
+			s += '/';
+		}
+		s.concat(path, len);
+		path += len;
+	}
+}
+
+} // namespace
+
+uint32_t getPathHash(const char* path, uint32_t hash)
+{
+	if(hash == 0) {
+		hash = FNV_OFFSET_BASIS;
+	}
+	if(path == nullptr) {
+		return hash;
+	}
+
+	auto p = path;
+	for(;;) {
+		while(*p == '/') {
+			++p;
+		}
+		if(*p == '\0') {
+			break;
+		}
+		auto len = strcspn(p, "/");
+		if(p[0] == '.' && (len == 1 || (len == 2 && p[1] == '.'))) {
+			return 0;
+		}
+		hash = fnv(hash, '/');
+		for(unsigned i = 0; i < len; ++i) {
+			hash = fnv(hash, p[i]);
+		}
+		p += len;
+	}
+
+	// Zero is reserved
+	return hash ?: 1;
+}
+
+String normalisePath(const char* dir, const char* name)
+{
+	String path;
+	appendPath(path, dir);
+	appendPath(path, name);
+	return path;
+}
+
+bool isSamePath(const char* stored, const char* dir, const char* name)
+{
+	auto p = matchPath(stored, dir);
+	p = p ? matchPath(p, name) : nullptr;
+	return p != nullptr && *p == '\0';
+}
+
+void StatCache::setSize(size_t size)
+{
+	if(size == this->size) {
+		clear();
+		return;
+	}
+	entries.reset(size ? new Entry[size] : nullptr);
+	this->size = entries ? size : 0;
+	useCount = 0;
+}
+
+StatCache::Entry* StatCache::find(uint32_t hash, const char* dir, const char* name)
+{
+	if(hash == 0) {
+		return nullptr;
+	}
+	for(unsigned i = 0; i < size; ++i) {
+		auto& e = entries[i];
+		if(e.hash != hash) {
+			continue;
+		}
+		if(isSamePath(e.path.c_str(), dir, name)) {
+			return &e;
+		}
+	}
+	return nullptr;
+}
+
+bool StatCache::get(uint32_t hash, const char* path, Stat& stat)
+{
+	auto e = find(hash, nullptr, path);
+	if(e == nullptr) {
+		return false;
+	}
+	e->lastUsed = ++useCount;
+	auto name = e->path.c_str();
+	auto sep = strrchr(name, '/');
+	stat.name.copy(sep ? sep + 1 : name);
+	stat.size = e->size;
+	stat.mtime = e->mtime;
+	stat.acl = e->acl;
+	stat.attr = e->attr;
+	stat.compression = e->compression;
+	return true;
+}
+
+void StatCache::put(uint32_t hash, const char* dir, const char* name, const Stat& stat)
+{
+	if(hash == 0 || size == 0) {
+		return;
+	}
+	auto e = find(hash, dir, name);
+	if(e == nullptr) {
+		e = &entries[0];
+		for(unsigned i = 1; i < size && e->hash != 0; ++i) {
+			auto& entry = entries[i];
+			if(entry.hash == 0 || entry.lastUsed < e->lastUsed) {
+				e = &entry;
+			}
+		}
+		e->path = normalisePath(dir, name);
+	}
+	e->hash = hash;
+	e->lastUsed = ++useCount;
+	e->size = stat.size;
+	e->mtime = stat.mtime;
+	e->acl = stat.acl;
+	e->attr = stat.attr;
+	e->compression = stat.compression;
+}
+
+void StatCache::invalidate(uint32_t hash)
+{
+	if(hash == 0) {
+		return;
+	}
+	// Paths sharing a hash are all discarded
+	for(unsigned i = 0; i < size; ++i) {
+		auto& e = entries[i];
+		if(e.hash == hash) {
+			e.hash = 0;
+			e.path = nullptr;
+		}
+	}
+}
+
+void StatCache::clear()
+{
+	for(unsigned i = 0; i < size; ++i) {
+		entries[i].hash = 0;
+		entries[i].path = nullptr;
+	}
+	useCount = 0;
+}
+
+} // namespace LittleFS
+} // namespace IFS
@@ -9,15 +9,17 @@
 #pragma once
 
 #include <IFS/FileSystem.h>
+#include "LittleFS/Config.h"
 
 namespace IFS
 {
 /**
  * @brief Create a LittleFS filesystem
  * @param partition
+ * @param config Buffer sizes, etc. for this instance
  * @retval FileSystem* constructed filesystem object
  */
-FileSystem* createLfsFilesystem(Storage::Partition partition);
+FileSystem* createLfsFilesystem(Storage::Partition partition, const LittleFS::Config& config = {});
 
 } // namespace IFS
 
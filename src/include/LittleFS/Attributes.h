@@ -0,0 +1,52 @@
+/****
+ * Attributes.h - Attribute types used internally by the driver
+ *
+ * Copyright 2021 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the Sming-LittleFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#pragma once
+
+#include <cstdint>
+
+namespace IFS
+{
+namespace LittleFS
+{
+/*
+ * littlefs attribute types are 8 bits and IFS attribute tags map directly onto them.
+ * Types from `LFS_ATTR_PRIVATE_MIN` are reserved for the driver: tags in this range are rejected
+ * by the attribute API and never reported by `fenumxattr()`, so cannot collide with IFS standard
+ * or user attributes.
+ */
+constexpr uint8_t LFS_ATTR_PRIVATE_MIN{0xf8};
+
+/*
+ * Root attribute holding saved allocator state, a header followed by the used block map
+ */
+constexpr uint8_t LFS_ATTR_ALLOC_STATE{0xff};
+
+/*
+ * File attribute holding `Compress::Info`
+ */
+constexpr uint8_t LFS_ATTR_COMPRESS{0xfe};
+
+/*
+ * Root attribute holding saved erase counts, a header followed by one uint32_t per block
+ */
+constexpr uint8_t LFS_ATTR_WEAR_STATE{0xfd};
+
+} // namespace LittleFS
+} // namespace IFS
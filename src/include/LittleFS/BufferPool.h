@@ -0,0 +1,111 @@
+/****
+ * BufferPool.h - Shared pool of equal-sized buffers
+ *
+ * Copyright 2021 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the Sming-LittleFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+#include <memory>
+
+namespace IFS
+{
+namespace LittleFS
+{
+/**
+ * @brief Pool of buffers borrowed by open files for short periods
+ *
+ * Buffers are allocated on first use and retained for re-use.
+ */
+class BufferPool
+{
+public:
+	/**
+	 * @brief Set size and number of buffers
+	 * @note All buffers must have been released
+	 */
+	void configure(size_t bufferSize, size_t count)
+	{
+		if(bufferSize == this->bufferSize && count == this->count) {
+			return;
+		}
+		entries.reset(count ? new Entry[count]{} : nullptr);
+		this->count = entries ? count : 0;
+		this->bufferSize = bufferSize;
+	}
+
+	/**
+	 * @brief Borrow a buffer
+	 * @retval uint8_t* nullptr if none available
+	 */
+	uint8_t* allocate()
+	{
+		if(bufferSize == 0) {
+			return nullptr;
+		}
+		for(unsigned i = 0; i < count; ++i) {
+			auto& e = entries[i];
+			if(e.used) {
+				continue;
+			}
+			if(!e.buffer) {
+				e.buffer.reset(new uint8_t[bufferSize]);
+				if(!e.buffer) {
+					return nullptr;
+				}
+			}
+			e.used = true;
+			return e.buffer.get();
+		}
+		return nullptr;
+	}
+
+	/**
+	 * @brief Return a buffer to the pool
+	 */
+	void release(uint8_t* buffer)
+	{
+		for(unsigned i = 0; i < count; ++i) {
+			auto& e = entries[i];
+			if(e.buffer.get() == buffer) {
+				assert(e.used);
+				e.used = false;
+				return;
+			}
+		}
+		assert(false);
+	}
+
+	size_t getBufferSize() const
+	{
+		return bufferSize;
+	}
+
+private:
+	struct Entry {
+		std::unique_ptr<uint8_t[]> buffer;
+		bool used;
+	};
+
+	std::unique_ptr<Entry[]> entries;
+	size_t count{0};
+	size_t bufferSize{0};
+};
+
+} // namespace LittleFS
+} // namespace IFS
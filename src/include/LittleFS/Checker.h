@@ -0,0 +1,139 @@
+/****
+ * Checker.h - Incremental filesystem consistency check
+ *
+ * Copyright 2021 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the Sming-LittleFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#pragma once
+
+#include "Metadata.h"
+#include <Print.h>
+#include <memory>
+#include <vector>
+
+namespace IFS
+{
+namespace LittleFS
+{
+/**
+ * @brief Results of a consistency check
+ */
+struct CheckReport {
+	uint32_t metadataPairs{0}; ///< Number of metadata pairs in the tail list
+	uint32_t directories{0};
+	uint32_t files{0};
+	uint32_t usedBlocks{0};
+	uint32_t corruptPairs{0}; ///< Metadata pairs with no valid commit (bad CRC)
+	uint32_t badEntries{0};	  ///< Entries with missing or invalid structure, or referencing non-existent directories
+	uint32_t badPointers{0};  ///< References to blocks outside the volume
+	uint32_t crossLinks{0};	  ///< Blocks referenced more than once
+	uint32_t orphans{0};	  ///< Directories not referenced by any parent, which littlefs will not repair
+	uint32_t leakedBlocks{0}; ///< Blocks belonging to orphaned directories, including those pending removal
+
+	unsigned errorCount() const
+	{
+		return corruptPairs + badEntries + badPointers + crossLinks + orphans;
+	}
+
+	size_t printTo(Print& p) const;
+};
+
+/**
+ * @brief Walks littlefs on-disk structures to verify consistency
+ *
+ * All metadata pairs are visited by following the tail list from the root.
+ * Each commit is CRC-checked, and every file's CTZ list is followed to build a map of used blocks.
+ * Orphans which the global state shows littlefs has yet to remove are not treated as errors.
+ *
+ * Work is performed in steps so a check can be spread over time, for example from the task queue.
+ * The scan must be restarted if the filesystem is modified between steps.
+ */
+class Checker
+{
+public:
+	Checker(const lfs_config& cfg, const lfs_t& lfs);
+
+	/**
+	 * @brief Perform some work
+	 * @param budget Maximum number of steps to perform
+	 * @retval int 0 when complete, 1 if more work remains, or LFS error code
+	 *
+	 * Each step is one of:
+	 *
+	 * - Fetch and CRC-check a metadata pair
+	 * - Check one directory entry
+	 * - Follow one file block pointer
+	 */
+	int step(unsigned budget);
+
+	const CheckReport& getReport() const
+	{
+		return report;
+	}
+
+	bool isComplete() const
+	{
+		return state == State::Complete;
+	}
+
+private:
+	enum class State {
+		Metadata, ///< Fetch next metadata pair
+		Entries,  ///< Check entries in current metadata pair
+		File,	  ///< Following CTZ list
+		Complete,
+	};
+
+	struct DirInfo {
+		lfs_block_t pair[2];
+		uint32_t blockCount;
+	};
+
+	int fetch(const lfs_block_t pair[2], lfs_mdir_t& dir);
+	int fetchBlock(lfs_block_t block, lfs_mdir_t& dir);
+	int checkEntry();
+	bool markBlock(lfs_block_t block);
+	void finish();
+
+	static bool pairMatch(const lfs_block_t a[2], const lfs_block_t b[2])
+	{
+		return (a[0] == b[0] && a[1] == b[1]) || (a[0] == b[1] && a[1] == b[0]);
+	}
+
+	static bool pairOverlap(const lfs_block_t a[2], const lfs_block_t b[2])
+	{
+		return a[0] == b[0] || a[0] == b[1] || a[1] == b[0] || a[1] == b[1];
+	}
+
+	const lfs_config& cfg;
+	MetaReader reader;
+	CheckReport report;
+	std::unique_ptr<uint32_t[]> usedMap;
+	std::vector<DirInfo> dirs;			 ///< Head of each directory, in tail-list order
+	std::vector<DirInfo> referencedDirs; ///< Directories referenced by a parent entry, blockCount unused
+	lfs_mdir_t mdir{};
+	lfs_block_t next[2]{0, 1};
+	bool nextIsHead{true}; ///< Next metadata pair starts a new directory
+	uint16_t entryId{0};
+	uint16_t pendingOrphans; ///< Orphan count from on-disk global state
+	// CTZ traversal
+	lfs_block_t ctzBlock{0};
+	lfs_off_t ctzIndex{0};
+	State state{State::Metadata};
+};
+
+} // namespace LittleFS
+} // namespace IFS
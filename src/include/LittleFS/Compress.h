@@ -0,0 +1,112 @@
+/****
+ * Compress.h - Transparent file compression
+ *
+ * Copyright 2021 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the Sming-LittleFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#pragma once
+
+#include "../../littlefs/lfs.h"
+#include <memory>
+#include <vector>
+
+// Uncompressed size of each chunk for files written with compression
+#ifndef LFS_COMPRESS_CHUNK_SIZE
+#define LFS_COMPRESS_CHUNK_SIZE 1024
+#endif
+
+namespace IFS
+{
+namespace LittleFS
+{
+/**
+ * @brief Compressed file storage
+ *
+ * File content is stored as a sequence of chunks, each a `ChunkHeader` followed by data.
+ * Chunks are compressed independently using a simple LZ77 variant so any position may be
+ * read by decompressing just one chunk. An `Info` attribute gives the uncompressed file size.
+ *
+ * Compressed data is a sequence of groups, each a flag byte followed by up to 8 items.
+ * Flag bits are taken LSB first: 0 for a literal byte, 1 for a 16-bit little-endian match code
+ * with a 12-bit offset (1 - 4096) and 4-bit length (3 - 18).
+ */
+namespace Compress
+{
+constexpr size_t maxChunkSize{32768};
+constexpr size_t hashSize{1024}; ///< Entries in compressor hash table
+
+static_assert(LFS_COMPRESS_CHUNK_SIZE >= 64 && LFS_COMPRESS_CHUNK_SIZE <= maxChunkSize, "Bad chunk size");
+
+/**
+ * @brief Attribute value for a compressed file
+ */
+struct Info {
+	uint32_t size;		 ///< Uncompressed file size
+	uint32_t chunkSize;	 ///< Largest uncompressed chunk size
+	uint32_t storedSize; ///< Stored data covering `size`, anything following is discarded
+};
+
+struct ChunkHeader {
+	uint16_t rawSize;	 ///< Uncompressed size
+	uint16_t storedSize; ///< Size of following data, same as rawSize if stored uncompressed
+};
+
+/**
+ * @brief Compress a block of data
+ * @param table Working storage of `hashSize` entries
+ * @retval size_t Size of compressed data, 0 if it doesn't fit in dstSize
+ */
+size_t compress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize, uint16_t* table);
+
+/**
+ * @brief Decompress a block of data
+ * @retval int Size of decompressed data, -1 if data is corrupt or doesn't fit in dstSize
+ */
+int decompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize);
+
+/**
+ * @brief State for an open compressed file
+ */
+struct State {
+	struct IndexEntry {
+		lfs_off_t pos;				   ///< Uncompressed position of chunk
+		lfs_off_t offset;			   ///< Stored position of chunk header
+	};
+
+	Info info{};
+	lfs_off_t pos{0};				   ///< Uncompressed file position
+	std::unique_ptr<uint8_t[]> chunk;  ///< Decompressed chunk, or data waiting to be written
+	std::unique_ptr<uint8_t[]> work;   ///< Stored chunk data
+	std::unique_ptr<uint16_t[]> table; ///< Compressor hash table, allocated on first write
+	lfs_off_t chunkPos{0};			   ///< Uncompressed position of chunk[0]
+	lfs_size_t chunkLen{0};			   ///< Bytes in chunk
+	bool pending{false};			   ///< Chunk holds data not yet written
+	std::vector<IndexEntry> index;	   ///< Chunks located so far
+	lfs_off_t scanPos{0};			   ///< Uncompressed position following last indexed chunk
+	lfs_off_t scanOffset{0};		   ///< Stored position following last indexed chunk
+
+	/**
+	 * @brief Check whether a position is held in the chunk buffer
+	 */
+	bool contains(lfs_off_t p) const
+	{
+		return p >= chunkPos && p < chunkPos + chunkLen;
+	}
+};
+
+} // namespace Compress
+} // namespace LittleFS
+} // namespace IFS
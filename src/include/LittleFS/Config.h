@@ -0,0 +1,95 @@
+/****
+ * Config.h - LittleFS filesystem configuration
+ *
+ * Copyright 2021 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the Sming-LittleFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Number of file descriptors held in-place, the table grows in steps of this size
+#ifndef LFS_MAX_FDS
+#define LFS_MAX_FDS 5
+#endif
+
+// Absolute limit on number of file descriptors, see Config::maxFiles
+#ifndef LFS_FDS_LIMIT
+#define LFS_FDS_LIMIT 100
+#endif
+
+namespace IFS
+{
+namespace LittleFS
+{
+/*
+ * Default geometry and buffer sizes
+ */
+constexpr size_t LFS_READ_SIZE{16};
+constexpr size_t LFS_PROG_SIZE{16};
+constexpr size_t LFS_BLOCK_SIZE{4096};
+constexpr size_t LFS_MIN_BLOCK_SIZE{128};
+constexpr int32_t LFS_BLOCK_CYCLES{500};
+constexpr size_t LFS_CACHE_SIZE{32};
+constexpr size_t LFS_LOOKAHEAD_SIZE{16};
+constexpr size_t LFS_STAT_CACHE_SIZE{8};
+constexpr size_t LFS_DIR_CACHE_SIZE{4};
+constexpr size_t LFS_READ_AHEAD_BUFFERS{2};
+
+/**
+ * @brief Settings applied to a filesystem instance at construction time
+ *
+ * Buffers are sized from these values so that, for example, devices with plenty of RAM
+ * can use larger caches whilst others retain the default (small) footprint.
+ *
+ * Block geometry is normally taken from the partition at mount time:
+ *
+ * - An existing volume keeps the block size recorded in its superblock, read from whichever
+ *   of the two copies is newer so an erased or part-written block 0 doesn't change it
+ * - Otherwise the device erase size is used, if it is at least LFS_MIN_BLOCK_SIZE,
+ *   or LFS_BLOCK_SIZE for devices with no meaningful erase size (e.g. FileDevice)
+ * - Sector devices (SD card, disk) have read/prog sizes raised to the sector size
+ *
+ * Constraints (checked by `mount()`):
+ *
+ * - cacheSize must be a multiple of both readSize and progSize
+ * - cacheSize must be a factor of the block size
+ * - block size must be a multiple of the device erase size
+ * - lookaheadSize must be a non-zero multiple of 8
+ * - readAheadSize must be a multiple of readSize
+ */
+struct Config {
+	size_t blockSize{0};							 ///< Set to override block size, 0 to derive from partition
+	size_t readSize{LFS_READ_SIZE};					 ///< Minimum size of a block read
+	size_t progSize{LFS_PROG_SIZE};					 ///< Minimum size of a block program
+	size_t cacheSize{LFS_CACHE_SIZE};				 ///< Read and program caches, plus per-file buffers
+	size_t lookaheadSize{LFS_LOOKAHEAD_SIZE};		 ///< Lookahead buffer size, tracks 8 blocks per byte
+	size_t maxFiles{LFS_MAX_FDS};					 ///< Maximum number of open files, up to LFS_FDS_LIMIT
+	size_t statCacheSize{LFS_STAT_CACHE_SIZE};		 ///< Number of `stat()` results to cache, 0 to disable
+	size_t dirCacheSize{LFS_DIR_CACHE_SIZE};		 ///< Number of directory locations to cache for `opendir()`, 0 to disable
+	size_t readAheadSize{0};						 ///< Size of read-ahead buffers for sequential reads, 0 to disable
+	size_t readAheadBuffers{LFS_READ_AHEAD_BUFFERS}; ///< Number of read-ahead buffers shared between open files
+	size_t writeBehindSize{0};						 ///< Default for `FileSystem::setWriteBehind()`, 0 to disable
+	uint32_t writeBehindTime{0};					 ///< Default for `FileSystem::setWriteBehind()`, in milliseconds
+	bool formatOnFail{true};						 ///< Format volume if it cannot be mounted, otherwise `mount()` returns an error
+	bool compressNewFiles{false};					 ///< Compress files created for writing, see `FileSystem::enableCompression()`
+	int32_t blockCycles{LFS_BLOCK_CYCLES};			 ///< Erases before metadata is moved to another block, -1 to disable
+	bool trackWear{false};							 ///< Count erases for each block, see `FileSystem::getWearStats()`
+};
+
+} // namespace LittleFS
+} // namespace IFS
@@ -0,0 +1,62 @@
+/****
+ * Delta.h - Block-level image updates
+ *
+ * Copyright 2021 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the Sming-LittleFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace IFS
+{
+namespace LittleFS
+{
+/**
+ * @brief Block-level differences between two filesystem images
+ *
+ * A delta lists the blocks which differ between a base image and a target image so
+ * a device holding the base image can be updated by transferring only those blocks.
+ * Deltas are created using the `fscopy` tool and applied using `FileSystem::applyDelta()`.
+ *
+ * Layout is a `Header` followed by `Header::recordCount` records,
+ * each a 32-bit block number followed by the block content.
+ * All values are little-endian.
+ */
+namespace Delta
+{
+constexpr uint32_t magic{0x44534c46}; ///< "LFSD"
+
+struct Header {
+	uint32_t magic;
+	uint32_t blockSize;	  ///< Size of each record, a multiple of the partition erase size
+	uint32_t blockCount;  ///< Image size in blocks
+	uint32_t recordCount; ///< Number of changed blocks
+	uint32_t baseCrc;	  ///< CRC of entire base image
+	uint32_t targetCrc;	  ///< CRC of entire target image
+	uint32_t headerCrc;	  ///< CRC of preceding header fields
+};
+
+/**
+ * @brief Calculate CRC as used for delta images
+ * @param crc Initial value, 0xffffffff for a new calculation
+ */
+uint32_t crc(uint32_t crc, const void* data, size_t size);
+
+} // namespace Delta
+} // namespace LittleFS
+} // namespace IFS
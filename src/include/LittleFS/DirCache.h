@@ -0,0 +1,164 @@
+/****
+ * DirCache.h - Cache of directory locations
+ *
+ * Copyright 2021 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the Sming-LittleFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#pragma once
+
+#include "../../littlefs/lfs.h"
+#include "StatCache.h"
+#include <memory>
+
+namespace IFS
+{
+namespace LittleFS
+{
+/**
+ * @brief Bounded LRU cache mapping directory paths to their metadata pair
+ *
+ * Entries are located by path hash and the path is compared, as for `StatCache`.
+ *
+ * A directory's metadata pair moves when littlefs relocates it, which always involves erasing
+ * a block. Each entry therefore records the filesystem erase count when it was stored,
+ * and the pair is only returned if no erase has occurred since.
+ *
+ * Directory existence is unaffected by relocation so `exists()` ignores the erase count.
+ * Callers must invalidate entries on remove and rename.
+ *
+ * Entries are added by `FileSystem::opendir()` and only used by it and `FileSystem::mkdir()`.
+ * Other path-based calls resolve the whole path from the root as usual: littlefs has no public
+ * API to look up an entry starting from a given directory pair.
+ */
+class DirCache
+{
+public:
+	/**
+	 * @brief Set number of entries, 0 disables the cache
+	 */
+	void setSize(size_t size)
+	{
+		if(size != this->size) {
+			entries.reset(size ? new Entry[size] : nullptr);
+			this->size = entries ? size : 0;
+		}
+		clear();
+	}
+
+	/**
+	 * @brief Get metadata pair for a directory
+	 * @param hash Path hash
+	 * @param path Path which produced `hash`
+	 * @param eraseCount Current filesystem erase count
+	 * @param pair OUT: Directory pair
+	 * @retval bool true if found and still valid
+	 */
+	bool get(uint32_t hash, const char* path, uint32_t eraseCount, lfs_block_t pair[2])
+	{
+		auto e = find(hash, path);
+		if(e == nullptr || e->eraseCount != eraseCount) {
+			return false;
+		}
+		e->lastUsed = ++useCount;
+		pair[0] = e->pair[0];
+		pair[1] = e->pair[1];
+		return true;
+	}
+
+	/**
+	 * @brief Determine if a directory is known to exist
+	 */
+	bool exists(uint32_t hash, const char* path)
+	{
+		return find(hash, path) != nullptr;
+	}
+
+	void put(uint32_t hash, const char* path, uint32_t eraseCount, const lfs_block_t pair[2])
+	{
+		if(hash == 0 || size == 0) {
+			return;
+		}
+		auto e = find(hash, path);
+		if(e == nullptr) {
+			e = &entries[0];
+			for(unsigned i = 1; i < size && e->hash != 0; ++i) {
+				auto& entry = entries[i];
+				if(entry.hash == 0 || entry.lastUsed < e->lastUsed) {
+					e = &entry;
+				}
+			}
+			e->path = normalisePath(nullptr, path);
+		}
+		e->hash = hash;
+		e->lastUsed = ++useCount;
+		e->eraseCount = eraseCount;
+		e->pair[0] = pair[0];
+		e->pair[1] = pair[1];
+	}
+
+	/**
+	 * @brief Discard any entries for the given path hash
+	 */
+	void invalidate(uint32_t hash)
+	{
+		if(hash == 0) {
+			return;
+		}
+		for(unsigned i = 0; i < size; ++i) {
+			if(entries[i].hash == hash) {
+				entries[i] = Entry{};
+			}
+		}
+	}
+
+	void clear()
+	{
+		for(unsigned i = 0; i < size; ++i) {
+			entries[i] = Entry{};
+		}
+		useCount = 0;
+	}
+
+private:
+	struct Entry {
+		uint32_t hash{0};
+		uint32_t lastUsed{0};
+		uint32_t eraseCount{0};
+		lfs_block_t pair[2]{};
+		CString path;
+	};
+
+	Entry* find(uint32_t hash, const char* path)
+	{
+		if(hash == 0) {
+			return nullptr;
+		}
+		for(unsigned i = 0; i < size; ++i) {
+			auto& e = entries[i];
+			if(e.hash == hash && isSamePath(e.path.c_str(), nullptr, path)) {
+				return &e;
+			}
+		}
+		return nullptr;
+	}
+
+	std::unique_ptr<Entry[]> entries;
+	size_t size{0};
+	uint32_t useCount{0};
+};
+
+} // namespace LittleFS
+} // namespace IFS
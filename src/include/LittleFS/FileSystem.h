@@ -21,9 +21,26 @@
 
 #include <IFS/FileSystem.h>
 #include "Error.h"
+#include "Config.h"
+#include "ObjectPool.h"
+#include "ObjectTable.h"
+#include "FlashMap.h"
+#include "StatCache.h"
+#include "DirCache.h"
+#include "BufferPool.h"
+#include "Checker.h"
+#include "Profiler.h"
+#include "Mutex.h"
+#include "Delta.h"
+#include "Compress.h"
+#include "Attributes.h"
 #include "../../littlefs/lfs.h"
+#include <Platform/Timers.h>
+#include <Platform/Clock.h>
 #include <memory>
 
+class IDataSourceStream;
+
 namespace IFS
 {
 namespace LittleFS
@@ -33,20 +50,33 @@ namespace LittleFS
 #define LFS_HANDLE_MIN 200
 #endif
 
-// Maximum number of file descriptors
-#ifndef LFS_MAX_FDS
-#define LFS_MAX_FDS 5
+// Number of directory objects held in pool, more are allocated from heap as required
+#ifndef LFS_MAX_DIRS
+#define LFS_MAX_DIRS 2
 #endif
 
-// Maximum file handle value
-#define LFS_HANDLE_MAX (LFS_HANDLE_MIN + LFS_MAX_FDS - 1)
+// Number of consecutive sequential reads before read-ahead is used
+#ifndef LFS_READ_AHEAD_TRIGGER
+#define LFS_READ_AHEAD_TRIGGER 2
+#endif
+
+// Number of attribute changes per file which may be held until the file is committed
+#ifndef LFS_MAX_PENDING_ATTRS
+#define LFS_MAX_PENDING_ATTRS 4
+#endif
+
+// Largest attribute value which may be held pending commit, larger values are written immediately
+#ifndef LFS_PENDING_ATTR_SIZE
+#define LFS_PENDING_ATTR_SIZE 16
+#endif
 
-constexpr size_t LFS_READ_SIZE{16};
-constexpr size_t LFS_PROG_SIZE{16};
-constexpr size_t LFS_BLOCK_SIZE{4096};
-constexpr size_t LFS_BLOCK_CYCLES{500};
-constexpr size_t LFS_CACHE_SIZE{32};
-constexpr size_t LFS_LOOKAHEAD_SIZE{16};
+// gc() refills the lookahead window once fewer than 1/N of its blocks remain free
+#ifndef LFS_GC_LOOKAHEAD_THRESHOLD
+#define LFS_GC_LOOKAHEAD_THRESHOLD 4
+#endif
+
+// Maximum file handle value
+#define LFS_HANDLE_MAX (LFS_HANDLE_MIN + LFS_FDS_LIMIT - 1)
 
 template <typename T> constexpr lfs_attr makeAttr(AttributeTag tag, T& value)
 {
@@ -54,8 +84,9 @@ template <typename T> constexpr lfs_attr makeAttr(AttributeTag tag, T& value)
 }
 
 struct StatAttr {
-	static constexpr size_t count{5};
+	static constexpr size_t count{6};
 	struct lfs_attr attrs[count];
+	Compress::Info compress{};
 
 	StatAttr(Stat& stat)
 		: attrs{
@@ -64,33 +95,260 @@ struct StatAttr {
 			  makeAttr(AttributeTag::ReadAce, stat.acl.readAccess),
 			  makeAttr(AttributeTag::WriteAce, stat.acl.writeAccess),
 			  makeAttr(AttributeTag::Compression, stat.compression),
+			  {LFS_ATTR_COMPRESS, &compress, sizeof(compress)},
 		  }
 	{
 	}
+
+	/**
+	 * @brief Report uncompressed size for compressed files
+	 */
+	void update(Stat& stat) const
+	{
+		if(compress.chunkSize != 0) {
+			stat.size = compress.size;
+		}
+	}
+};
+
+/**
+ * @brief Space used by a directory tree, see `FileSystem::dirUsage()`
+ */
+struct DirUsage {
+	uint32_t files;
+	uint32_t directories; ///< Subdirectories, not including the starting directory
+	uint64_t size;		  ///< Total size of files, as reported by `stat()`
+	uint32_t blocks;	  ///< Blocks used by file content and directory metadata
+};
+
+/**
+ * @brief Block erase statistics, see `FileSystem::getWearStats()`
+ */
+struct WearStats {
+	uint32_t blockCount;
+	uint64_t totalErases;
+	uint32_t maxErases;
+	uint32_t maxBlock;			   ///< Most worn block
+	Profiler::Histogram histogram; ///< Number of blocks by erase count
+
+	uint32_t meanErases() const
+	{
+		return blockCount ? totalErases / blockCount : 0;
+	}
+
+	/**
+	 * @brief Estimate number of further erases before the most worn block reaches its rated endurance
+	 * @param ratedCycles Endurance from device datasheet, typically 100000 for NOR flash
+	 * @retval uint64_t Assumes wear continues to be distributed as it has been so far
+	 *
+	 * Divide by the observed erase rate to obtain a projected lifetime.
+	 */
+	uint64_t projectedErases(uint32_t ratedCycles) const
+	{
+		if(maxErases >= ratedCycles) {
+			return 0;
+		}
+		if(maxErases == 0) {
+			return uint64_t(ratedCycles) * blockCount;
+		}
+		return totalErases * (ratedCycles - maxErases) / maxErases;
+	}
 };
 
 /**
  * @brief Details for an open file
  */
 struct FileDescriptor {
-	CString name;
+	CString path; ///< Relative to root, as opened and updated by `FileSystem::rename()`
 	lfs_file_t file{};
 	TimeStamp mtime{};
-	uint8_t buffer[LFS_CACHE_SIZE];
+	uint32_t pathHash{0};
+	std::unique_ptr<uint8_t[]> buffer; ///< Retained for re-use when descriptor is released
+	size_t bufferSize{0};
 	struct lfs_file_config config {
-		buffer
 	};
+	/*
+	 * Attributes committed with file data: modification time followed by pending changes.
+	 * `config.attr_count` indicates how many are in use.
+	 *
+	 * littlefs marks a writeable file as dirty if it has any attributes, so for those
+	 * the modification time is only attached (via `attachMeta()`) once something changes.
+	 */
+	lfs_attr attrs[1 + LFS_MAX_PENDING_ATTRS]{};
+	uint8_t attrValues[LFS_MAX_PENDING_ATTRS][LFS_PENDING_ATTR_SIZE];
 	enum class Flag {
 		TimeChanged,
 		IsRoot,
-		Write, ///< LFS throws asserts so we need to pre-check
+		Write,	 ///< LFS throws asserts so we need to pre-check
+		Removed, ///< Deleted via `FileSystem::fremove()`, awaiting close
+	};
+	BitSet<uint8_t, Flag, 4> flags;
+	FlashMapping mapping;					   ///< Set by `FileSystem::mmap()`
+	std::unique_ptr<Compress::State> compress; ///< Set for compressed files
+
+	/**
+	 * @brief Read-ahead state
+	 *
+	 * A buffer is borrowed from the pool when sequential access is detected.
+	 * Whilst held, the littlefs file position is at the end of the buffered data.
+	 */
+	struct ReadAhead {
+		uint8_t* buffer{nullptr};
+		lfs_off_t pos{0};	  ///< File position of buffer[0]
+		lfs_size_t length{0}; ///< Number of bytes in buffer
+		lfs_size_t offset{0}; ///< Current read position within buffer
+		lfs_off_t nextPos{0}; ///< Position following previous read
+		uint8_t seqCount{0};  ///< Number of consecutive sequential reads
+	};
+	ReadAhead readAhead;
+
+	/**
+	 * @brief Write-behind state
+	 */
+	struct WriteBehind {
+		size_t maxPending{0}; ///< 0 if write-behind is disabled
+		uint32_t maxDelay{0}; ///< Milliseconds, 0 for no time limit
+		size_t pending{0};	  ///< Uncommitted changes, in bytes
+		OneShotFastMs timer;  ///< Started on first uncommitted change
 	};
-	BitSet<uint8_t, Flag, 3> flags;
+	WriteBehind writeBehind;
+
+	const char* getName() const
+	{
+		auto s = path.c_str();
+		auto p = strrchr(s, '/');
+		return p ? p + 1 : s;
+	}
 
 	void touch()
 	{
 		mtime = fsGetTimeUTC();
 		flags += Flag::TimeChanged;
+		attachMeta();
+	}
+
+	/**
+	 * @brief Ensure modification time is written with the next commit
+	 */
+	void attachMeta()
+	{
+		if(config.attr_count == 0) {
+			config.attr_count = 1;
+		}
+	}
+
+	/**
+	 * @brief Find an attribute change waiting to be committed
+	 */
+	const lfs_attr* findPendingAttr(uint8_t tag) const
+	{
+		for(unsigned i = 1; i < config.attr_count; ++i) {
+			if(attrs[i].type == tag) {
+				return &attrs[i];
+			}
+		}
+		return nullptr;
+	}
+
+	/**
+	 * @brief Hold an attribute change until the file is committed
+	 * @retval bool false if there's no space, caller should write attribute directly
+	 */
+	bool setPendingAttr(uint8_t tag, const void* data, size_t size)
+	{
+		if(size > LFS_PENDING_ATTR_SIZE) {
+			return false;
+		}
+		attachMeta();
+		auto attr = const_cast<lfs_attr*>(findPendingAttr(tag));
+		if(attr == nullptr) {
+			if(config.attr_count >= ARRAY_SIZE(attrs)) {
+				return false;
+			}
+			attr = &attrs[config.attr_count];
+			attr->type = tag;
+			attr->buffer = attrValues[config.attr_count - 1];
+			++config.attr_count;
+		}
+		memcpy(attr->buffer, data, size);
+		attr->size = size;
+		file.flags |= LFS_F_DIRTY;
+		return true;
+	}
+
+	void removePendingAttr(uint8_t tag)
+	{
+		auto attr = findPendingAttr(tag);
+		if(attr == nullptr) {
+			return;
+		}
+		auto i = attr - attrs;
+		// Move last entry into the gap
+		auto& last = attrs[config.attr_count - 1];
+		if(&attrs[i] != &last) {
+			memcpy(attrs[i].buffer, last.buffer, last.size);
+			attrs[i].type = last.type;
+			attrs[i].size = last.size;
+		}
+		--config.attr_count;
+	}
+
+	bool hasPendingAttrs() const
+	{
+		return config.attr_count > 1;
+	}
+
+	void clearPendingAttrs()
+	{
+		if(config.attr_count > 1) {
+			config.attr_count = 1;
+		}
+	}
+
+	bool allocateBuffer(size_t size)
+	{
+		if(size != bufferSize) {
+			buffer.reset(new uint8_t[size]);
+			bufferSize = buffer ? size : 0;
+		}
+		config.buffer = buffer.get();
+		return bufferSize != 0;
+	}
+
+	void reset()
+	{
+		path = nullptr;
+		file = lfs_file_t{};
+		mtime = 0;
+		pathHash = 0;
+		config = lfs_file_config{};
+		for(auto& attr : attrs) {
+			attr = lfs_attr{};
+		}
+		memset(attrValues, 0, sizeof(attrValues));
+		flags.clear();
+		unmapFlash(mapping);
+		readAhead = ReadAhead{};
+		writeBehind = WriteBehind{};
+		compress.reset();
+	}
+};
+
+/**
+ * @brief LittleFS directory object
+ */
+struct FileDir {
+	lfs_dir_t dir;
+	uint32_t pathHash;
+	CString path;
+	uint16_t readCount; ///< Entries read since opening or rewinding
+
+	void reset()
+	{
+		dir = lfs_dir_t{};
+		pathHash = 0;
+		path = nullptr;
+		readCount = 0;
 	}
 };
 
@@ -100,8 +358,11 @@ struct FileDescriptor {
 class FileSystem : public IFileSystem
 {
 public:
-	FileSystem(Storage::Partition partition) : partition(partition)
+	FileSystem(Storage::Partition partition, const Config& config = {}) : partition(partition), config(config)
 	{
+		fileDescriptors.setLimit(config.maxFiles);
+		statCache.setSize(config.statCacheSize);
+		dirCache.setSize(config.dirCacheSize);
 	}
 
 	~FileSystem();
@@ -114,6 +375,13 @@ public:
 	int readdir(DirHandle dir, Stat& stat) override;
 	int rewinddir(DirHandle dir) override;
 	int closedir(DirHandle dir) override;
+	/**
+	 * @brief Create a directory
+	 *
+	 * The modification time is written by a second commit after the directory is created.
+	 * Unlike files, which are opened with their attributes via `lfs_file_opencfg()`,
+	 * littlefs has no API to create a directory with attributes.
+	 */
 	int mkdir(const char* path) override;
 	int stat(const char* path, Stat* stat) override;
 	int fstat(FileHandle file, Stat* stat) override;
@@ -134,13 +402,327 @@ public:
 	int fgetextents(FileHandle file, Storage::Partition* part, Extent* list, uint16_t extcount) override;
 	int rename(const char* oldpath, const char* newpath) override;
 	int remove(const char* path) override;
+	/**
+	 * @brief Delete an open file, discarding unwritten data
+	 *
+	 * littlefs only deletes entries by path, so the path recorded for the handle (see `getFilePath()`)
+	 * is resolved from the root as for `remove()`. This saves applications keeping their own copy
+	 * of the path, not the lookup. The handle must still be closed afterwards.
+	 */
 	int fremove(FileHandle file) override;
 	int format() override;
 	int check() override;
 
+	/**
+	 * @brief Obtain a pointer to file content in memory-mapped flash
+	 * @param file Handle to open file
+	 * @param offset Position within file
+	 * @param length IN: Number of bytes required, OUT: Number of contiguous bytes mapped
+	 * @param data OUT: Pointer to file data
+	 * @retval int error code
+	 *
+	 * Data is stored in blocks so the returned length may be less than requested:
+	 * call again with an updated offset to map the following block.
+	 * The mapping remains valid until the next call to `mmap`, `munmap` or `close` for this file,
+	 * or until the file is modified.
+	 *
+	 * Returns Error::NotSupported if the partition is not in memory-mapped flash.
+	 *
+	 * @note On the ESP8266 mapped flash must be read using aligned 32-bit accesses.
+	 */
+	int mmap(FileHandle file, file_offset_t offset, size_t& length, const void*& data);
+
+	/**
+	 * @brief Release any mapping obtained via `mmap()`
+	 */
+	int munmap(FileHandle file);
+
+	/**
+	 * @brief Prepare to write a file of known size into consecutive blocks
+	 * @param file Handle to file open for writing
+	 * @param size Expected final size of the file
+	 * @retval int error code
+	 *
+	 * Searches for a run of free blocks large enough to hold the file and primes the allocator
+	 * to start there. Subsequent writes to this file then occupy consecutive blocks, provided
+	 * no other files are written in the meantime. If there is no run long enough then the
+	 * longest available is used.
+	 *
+	 * Blocks are not reserved on-disk: this is purely an allocation hint so has no effect
+	 * on the volume format.
+	 */
+	int fallocate(FileHandle file, file_size_t size);
+
+	/**
+	 * @brief Defer commits for a file open for writing
+	 * @param file Handle to open file
+	 * @param maxPending Commit once this many bytes have been written, 0 to disable write-behind
+	 * @param maxDelay Commit once the oldest uncommitted change is this many milliseconds old, 0 for no limit
+	 * @retval int error code
+	 *
+	 * Each commit appends to the directory's metadata log, so frequent small appends followed by `flush()`
+	 * (typical for loggers) cause excessive metadata writes and compaction.
+	 * With write-behind enabled, `flush()` only commits when one of these limits is reached.
+	 * `close()` always commits.
+	 *
+	 * The defaults for newly opened files are set via `Config::writeBehindSize` and `Config::writeBehindTime`.
+	 *
+	 * @note Uncommitted data is lost on power failure.
+	 * The time limit is checked by `write()` and `flush()`, so call `commitPending()` periodically
+	 * if these may not be called for some time.
+	 */
+	int setWriteBehind(FileHandle file, size_t maxPending, uint32_t maxDelay);
+
+	/**
+	 * @brief Commit changes to any write-behind files whose time limit has expired
+	 * @retval int error code
+	 */
+	int commitPending();
+
+	/**
+	 * @brief Get number of blocks in use
+	 * @param exact true to traverse the filesystem, false to use the cached value
+	 * @retval int Number of blocks, or error code
+	 *
+	 * The filesystem is traversed on first call after mounting, then the count is
+	 * updated as blocks are allocated. littlefs does not report blocks it frees, so the cached
+	 * value may over-estimate usage after files are modified, truncated or removed.
+	 * `gc()` refreshes it when idle.
+	 *
+	 * `getinfo()` uses the cached value.
+	 */
+	int getUsedBlockCount(bool exact);
+
+	/**
+	 * @brief Save allocator state so the next mount needn't traverse the filesystem
+	 * @retval int error code
+	 *
+	 * Following mount, littlefs must traverse the entire filesystem before it can allocate a block,
+	 * and `getinfo()` needs the same information to report free space.
+	 * This stores a map of used blocks and the allocator position in a root directory attribute,
+	 * which the next `mount()` uses instead.
+	 *
+	 * The attribute is removed by the first modification after mounting so it is never used
+	 * once stale. Call this just before an expected power-down, such as deep sleep.
+	 * The map requires one bit per block, so is limited by the maximum attribute size
+	 * (8160 blocks for the default of 1022 bytes).
+	 *
+	 * @note The volume must not be modified by other software whilst the attribute is present.
+	 * The `lookaheadSize` configuration value determines how many blocks are loaded from the map.
+	 */
+	int saveAllocState();
+
+	/**
+	 * @brief Get erase statistics for all blocks
+	 * @param stats OUT: Results
+	 * @retval int error code, `Error::NotSupported` if `Config::trackWear` is not set
+	 *
+	 * Counts are kept from construction, plus any previously stored using `saveWearState()`.
+	 */
+	int getWearStats(WearStats& stats);
+
+	/**
+	 * @brief Get number of times a block has been erased
+	 * @retval uint32_t Count, 0 if wear tracking is disabled
+	 */
+	uint32_t getBlockEraseCount(lfs_block_t block) const
+	{
+		return (wearCounts && block < lfsConfig.block_count) ? wearCounts[block] : 0;
+	}
+
+	/**
+	 * @brief Store block erase counts so they accumulate across restarts
+	 * @retval int error code
+	 *
+	 * Counts are held in a root directory attribute, which is loaded on the next `mount()`.
+	 * Each save is a metadata commit so call this occasionally, such as before an expected power-down.
+	 *
+	 * Each block requires four bytes plus an 8-byte header, limited by the maximum attribute size:
+	 * 253 blocks for the default of 1022 bytes. Larger volumes return `Error::TooBig`, and a warning
+	 * is logged when the filesystem is configured. Counts are still tracked in RAM.
+	 */
+	int saveWearState();
+
+	/**
+	 * @brief Perform deferred housekeeping, call when the application is idle
+	 * @param budget Maximum number of operations to perform
+	 * @retval int 0 when there is nothing more to do, 1 if more work remains, or error code
+	 *
+	 * Each operation is one of:
+	 *
+	 * - Commit a write-behind file whose time limit has expired (see `commitPending()`)
+	 * - Refill the block allocator's lookahead window, which requires a traversal of the whole filesystem.
+	 *   This is done once most of the current window has been allocated.
+	 *   The same traversal refreshes the count of used blocks (see `getUsedBlockCount()`) if files have been changed.
+	 *
+	 * This moves work which would otherwise be done by the next `write()`, `flush()` or `close()` call
+	 * to a time of the application's choosing.
+	 *
+	 * @note Metadata compaction cannot be scheduled in advance and still occurs when a commit does not fit.
+	 */
+	int gc(unsigned budget);
+
+	/**
+	 * @brief Set profiler to record timing and operation statistics as well as device accesses
+	 * @param profiler nullptr to detach
+	 * @param blockCounts Enable per-block counts in the profiler using the filesystem geometry (must be mounted)
+	 * @retval int error code
+	 *
+	 * This replaces any profiler set via `setProfiler()`.
+	 */
+	int attachProfiler(Profiler* profiler, bool blockCounts = false);
+
+	/**
+	 * @brief Perform part of a consistency check
+	 * @param budget Maximum number of steps to perform in this call
+	 * @retval int 0 when check is complete, 1 if more work remains, or error code
+	 *
+	 * A step fetches and validates one metadata pair (reading up to two blocks),
+	 * checks one directory entry, or follows one file block pointer.
+	 *
+	 * Call repeatedly (e.g. from the task queue) until it returns 0, then use `getCheckReport()`.
+	 * A further call then starts a new check.
+	 * If the filesystem is modified between calls the check starts again.
+	 *
+	 * This may be used on a volume which failed to mount, see `Config::formatOnFail`.
+	 */
+	int checkIncremental(unsigned budget);
+
+	/**
+	 * @brief Get results of last check
+	 */
+	const CheckReport& getCheckReport() const;
+
+	/**
+	 * @brief Update volume content by applying a block-level delta
+	 * @param delta Stream containing delta, see `Delta`
+	 * @retval int error code
+	 *
+	 * The volume is unmounted, changed blocks are written directly to the partition
+	 * and the volume is then re-mounted. There must be no open files.
+	 *
+	 * The partition must contain exactly the image the delta was created from:
+	 * this is verified before anything is written, and the result is verified afterwards.
+	 * If power is lost or the stream fails part-way through, the volume is left in
+	 * an intermediate state and must be re-flashed in full.
+	 */
+	int applyDelta(IDataSourceStream& delta);
+
+	/**
+	 * @brief Store file content compressed
+	 * @param file Empty file opened for writing
+	 * @retval int error code
+	 *
+	 * Content is compressed in chunks of LFS_COMPRESS_CHUNK_SIZE bytes so text and similar files
+	 * occupy fewer blocks, and reading them transfers less data from flash.
+	 * This is transparent: reads return uncompressed data and `stat()` reports the uncompressed size.
+	 *
+	 * Compressed files may be read from any position but must be written sequentially, appending to the end.
+	 * They may only be truncated to 0, and cannot be mapped into memory.
+	 *
+	 * All files created for writing are compressed if `Config::compressNewFiles` is set.
+	 */
+	int enableCompression(FileHandle file);
+
+	/**
+	 * @brief Read multiple directory entries
+	 * @param dir
+	 * @param list Array to receive entries. Names are only returned for entries given a buffer, see `Stat::name`.
+	 * @param count Number of entries in list
+	 * @param withAttributes false to read only name, size and type, without timestamps, ACLs, etc.
+	 * @retval int Number of entries read, 0 at end of directory, or error code
+	 *
+	 * This is more efficient than calling `readdir()` for each entry. Skipping attributes
+	 * avoids searching metadata for each of them so is quicker still.
+	 */
+	int readdirBatch(DirHandle dir, Stat* list, unsigned count, bool withAttributes = true);
+
+	/**
+	 * @brief Get total space used by a directory and everything below it
+	 * @param path Directory path
+	 * @param usage OUT: Totals
+	 * @retval int error code
+	 *
+	 * Subdirectories are visited directly from the on-disk structures without resolving paths,
+	 * and without reading attributes other than those required for file sizes.
+	 */
+	int dirUsage(const char* path, DirUsage& usage);
+
+	/**
+	 * @brief Remove a directory and all its content
+	 * @param path Directory path, or a file. Root content is removed but the root itself remains.
+	 * @retval int error code
+	 *
+	 * Entries are enumerated directly from the on-disk structures, so directories are not opened
+	 * by path as when listing them via the IFS API. littlefs only deletes entries by path, however,
+	 * so each removal looks up its parent directory from the root: for deep trees this dominates.
+	 *
+	 * Fails with `Error::ReadOnly` without removing anything if the directory itself is marked read-only.
+	 * Otherwise stops at the first entry marked read-only, returning `Error::ReadOnly`
+	 * with everything preceding it removed.
+	 */
+	int removeTree(const char* path);
+
+	/**
+	 * @brief Get full path of an open file
+	 * @param file Handle to open file
+	 * @param path OUT: Path of file relative to root, without leading separator
+	 * @retval int error code
+	 *
+	 * The path is recorded when the file is opened and kept up to date by `rename()`,
+	 * including renaming of any parent directory.
+	 */
+	int getFilePath(FileHandle file, String& path);
+
 private:
+	size_t readSuperblockBlockSize();
+	int configure(bool useExisting);
 	int tryMount();
+	void unmount();
+	uint32_t partitionCrc(uint8_t* buffer, size_t bufSize);
+	int writeDelta(IDataSourceStream& delta, const Delta::Header& header, uint8_t* buffer);
+	uint32_t startTiming() const
+	{
+		return (lfsProfiler != nullptr) ? micros() : 0;
+	}
+	void endTiming(Profiler::Device device, uint32_t start)
+	{
+		if(lfsProfiler != nullptr) {
+			lfsProfiler->recordTime(device, micros() - start);
+		}
+	}
+	uint32_t getModifyCount() const
+	{
+		return eraseCount + progCount;
+	}
 	void flushMeta(FileDescriptor& fd);
+	int commit(FileDescriptor& fd);
+	void notePending(FileDescriptor& fd, size_t size);
+	bool isCommitDue(FileDescriptor& fd);
+	int openDirAt(lfs_dir_t& dir, const lfs_block_t pair[2]);
+	int getUsedMap(std::unique_ptr<uint32_t[]>& map);
+	void setUsedMap(std::unique_ptr<uint32_t[]>&& map);
+	void loadAllocState();
+	void loadWearState();
+	int dropAllocState();
+	const ACL& getRootAcl();
+	void noteErase(lfs_block_t block);
+	int readBuffered(FileDescriptor& fd, void* data, size_t size);
+	int readEntry(FileDir& d, Stat& stat, bool withAttributes);
+	int getChildPair(const lfs_dir_t& dir, lfs_block_t pair[2]);
+	int usageAt(lfs_dir_t& dir, DirUsage& usage);
+	int removeAt(lfs_dir_t& dir, String& path);
+	int openCompressed(FileDescriptor& fd, bool create);
+	int readCompressed(FileDescriptor& fd, void* data, size_t size);
+	int writeCompressed(FileDescriptor& fd, const void* data, size_t size);
+	int flushCompressed(FileDescriptor& fd);
+	int readStored(lfs_file_t& file, lfs_off_t offset, void* buffer, lfs_size_t size);
+	int loadChunk(FileDescriptor& fd, lfs_off_t pos);
+	int setCompressInfo(FileDescriptor& fd);
+	int storeUncompressed(FileDescriptor& fd);
+	int dropReadAhead(FileDescriptor& fd);
+	void releaseDir(FileDir* d);
+	void renameOpenFiles(const char* oldpath, const char* newpath);
 	void checkRootAcl(AttributeTag tag, const void* value);
 
 	template <typename T> int get_attr(const char* path, AttributeTag tag, T& attr)
@@ -183,8 +765,11 @@ private:
 	{
 		auto fs = static_cast<FileSystem*>(c->context);
 		assert(fs != nullptr);
-		uint32_t addr = (block * LFS_BLOCK_SIZE) + off;
-		if(!fs->partition.read(addr, buffer, size)) {
+		uint32_t addr = (block * c->block_size) + off;
+		auto start = fs->startTiming();
+		bool ok = fs->partition.read(addr, buffer, size);
+		fs->endTiming(Profiler::Device::read, start);
+		if(!ok) {
 			return LFS_ERR_IO_READ;
 		}
 		if(fs->profiler != nullptr) {
@@ -197,57 +782,89 @@ private:
 	{
 		auto fs = static_cast<FileSystem*>(c->context);
 		assert(fs != nullptr);
-		uint32_t addr = (block * LFS_BLOCK_SIZE) + off;
+		uint32_t addr = (block * c->block_size) + off;
+		++fs->progCount;
 		if(fs->profiler != nullptr) {
 			fs->profiler->write(addr, buffer, size);
 		}
-		return fs->partition.write(addr, buffer, size) ? LFS_ERR_OK : LFS_ERR_IO_WRITE;
+		auto start = fs->startTiming();
+		bool ok = fs->partition.write(addr, buffer, size);
+		fs->endTiming(Profiler::Device::prog, start);
+		return ok ? LFS_ERR_OK : LFS_ERR_IO_WRITE;
 	}
 
 	static int f_erase(const struct lfs_config* c, lfs_block_t block)
 	{
 		auto fs = static_cast<FileSystem*>(c->context);
 		assert(fs != nullptr);
-		uint32_t addr = block * LFS_BLOCK_SIZE;
-		size_t size = LFS_BLOCK_SIZE;
+		uint32_t addr = block * c->block_size;
+		size_t size = c->block_size;
+		fs->noteErase(block);
 		if(fs->profiler != nullptr) {
 			fs->profiler->erase(addr, size);
 		}
-		return fs->partition.erase_range(addr, size) ? LFS_ERR_OK : LFS_ERR_IO_ERASE;
+		auto start = fs->startTiming();
+		bool ok = fs->partition.erase_range(addr, size);
+		fs->endTiming(Profiler::Device::erase, start);
+		return ok ? LFS_ERR_OK : LFS_ERR_IO_ERASE;
 	}
 
 	static int f_sync(const struct lfs_config* c)
 	{
 		auto fs = static_cast<FileSystem*>(c->context);
 		assert(fs != nullptr);
-		return fs->partition.sync() ? LFS_ERR_OK : LFS_ERR_IO_WRITE;
+		if(fs->lfsProfiler != nullptr) {
+			fs->lfsProfiler->sync();
+		}
+		auto start = fs->startTiming();
+		bool ok = fs->partition.sync();
+		fs->endTiming(Profiler::Device::sync, start);
+		return ok ? LFS_ERR_OK : LFS_ERR_IO_WRITE;
 	}
 
+	Mutex mutex;
 	Storage::Partition partition;
 	IProfiler* profiler{nullptr};
-	uint8_t readBuffer[LFS_CACHE_SIZE];
-	uint8_t progBuffer[LFS_CACHE_SIZE];
-	uint8_t lookaheadBuffer[LFS_LOOKAHEAD_SIZE];
-	lfs_config config{
+	Profiler* lfsProfiler{nullptr}; ///< Set by `attachProfiler()` for timing and operation tracking
+	Config config;
+	std::unique_ptr<uint8_t[]> readBuffer;
+	std::unique_ptr<uint8_t[]> progBuffer;
+	std::unique_ptr<uint32_t[]> lookaheadBuffer; // Must be 32-bit aligned
+	lfs_config lfsConfig{
 		.context = this,
 		.read = f_read,
 		.prog = f_prog,
 		.erase = f_erase,
 		.sync = f_sync,
-		.read_size = LFS_READ_SIZE,
-		.prog_size = LFS_PROG_SIZE,
-		.block_size = LFS_BLOCK_SIZE,
+		.read_size = 0,
+		.prog_size = 0,
+		.block_size = 0,
 		.block_count = 0,
 		.block_cycles = LFS_BLOCK_CYCLES,
-		.cache_size = LFS_CACHE_SIZE,
-		.lookahead_size = LFS_LOOKAHEAD_SIZE,
-		.read_buffer = readBuffer,
-		.prog_buffer = progBuffer,
-		.lookahead_buffer = lookaheadBuffer,
+		.cache_size = 0,
+		.lookahead_size = 0,
+		.read_buffer = nullptr,
+		.prog_buffer = nullptr,
+		.lookahead_buffer = nullptr,
 	};
 	lfs_t lfs{};
-	std::unique_ptr<FileDescriptor> fileDescriptors[LFS_MAX_FDS];
+	ObjectTable<FileDescriptor, LFS_MAX_FDS, LFS_FDS_LIMIT> fileDescriptors;
+	ObjectPool<FileDir, LFS_MAX_DIRS> fileDirs;
+	StatCache statCache;
+	DirCache dirCache;
+	BufferPool readAheadPool;
+	uint32_t eraseCount{0}; ///< Used to detect metadata relocation
+	uint32_t progCount{0};
+	std::unique_ptr<uint32_t[]> usedMap; ///< Blocks in use as of last traversal, plus any erased since
+	lfs_size_t usedBlockCount{0};
+	std::unique_ptr<uint32_t[]> wearCounts; ///< Erases per block, if `Config::trackWear` is set
+	bool wearStateLoaded{false};
+	uint32_t usedMapProgCount{0}; ///< Value of `progCount` when map was built
+	std::unique_ptr<Checker> checker;
+	uint32_t checkModifyCount{0};
 	ACL rootAcl{};
+	bool rootAclLoaded{false};
+	bool allocStateSaved{false}; ///< Root has allocator state attribute
 	bool mounted{false};
 };
 
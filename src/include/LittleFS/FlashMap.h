@@ -0,0 +1,58 @@
+/****
+ * FlashMap.h - Access to memory-mapped flash
+ *
+ * Copyright 2021 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the Sming-LittleFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#pragma once
+
+#include <Storage/Partition.h>
+
+namespace IFS
+{
+namespace LittleFS
+{
+/**
+ * @brief A region of flash mapped into the CPU address space
+ */
+struct FlashMapping {
+	const void* data{nullptr};
+	uint32_t handle{0}; ///< Architecture-specific, e.g. ESP32 mmap handle
+
+	explicit operator bool() const
+	{
+		return data != nullptr;
+	}
+};
+
+/**
+ * @brief Map a region of a partition into memory
+ * @param partition Must be on the internal flash device
+ * @param offset Offset from start of partition
+ * @param size Number of bytes required
+ * @param mapping OUT: Mapping details
+ * @retval bool false if mapping is not possible on this platform, or region is outside mapped window
+ * @note On the ESP8266 mapped flash must be accessed using 32-bit aligned reads
+ */
+bool mapFlash(Storage::Partition& partition, storage_size_t offset, size_t size, FlashMapping& mapping);
+
+/**
+ * @brief Release a mapping obtained from `mapFlash()`
+ */
+void unmapFlash(FlashMapping& mapping);
+
+} // namespace LittleFS
+} // namespace IFS
@@ -0,0 +1,146 @@
+/****
+ * LogFile.h - Circular record log stored as a rotating set of segment files
+ *
+ * Copyright 2021 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the Sming-LittleFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#pragma once
+
+#include "FileSystem.h"
+
+namespace IFS
+{
+namespace LittleFS
+{
+/**
+ * @brief Append-only log of records using a fixed amount of storage
+ *
+ * Records are appended to segment files within a directory, named by sequence number.
+ * When the current segment is full a new one is started and, once the budget is reached,
+ * the oldest segment is deleted: no file is ever truncated, rewritten or renamed.
+ *
+ * Each record is stored as a 16-bit little-endian length followed by the data, using a single write.
+ * littlefs only commits file content on sync so following power loss a segment always ends on
+ * a record boundary and opening the log simply seeks to the end of the newest segment.
+ *
+ * Records are committed when `flush()` is called, when a segment is completed,
+ * or according to the filesystem write-behind settings.
+ */
+class LogFile
+{
+public:
+	struct Config {
+		size_t segmentSize{16384};	 ///< Maximum size of each segment file
+		unsigned segmentCount{4};	 ///< Number of segments retained
+		uint16_t maxRecordSize{256}; ///< Largest record which may be appended
+	};
+
+	LogFile(FileSystem& fs) : fs(fs)
+	{
+	}
+
+	~LogFile()
+	{
+		close();
+	}
+
+	/**
+	 * @brief Open a log, creating it if required
+	 * @param path Directory to contain segment files
+	 * @param config Limits for this log, may differ from those used previously
+	 * @retval int error code
+	 */
+	int open(const String& path, const Config& config);
+
+	int open(const String& path)
+	{
+		return open(path, Config{});
+	}
+
+	int close();
+
+	/**
+	 * @brief Append a record to the log
+	 * @param data
+	 * @param size Must be non-zero and no larger than `Config::maxRecordSize`
+	 * @retval int error code
+	 *
+	 * If a new segment cannot be started the log is closed and must be re-opened.
+	 */
+	int append(const void* data, uint16_t size);
+
+	/**
+	 * @brief Commit appended records to storage
+	 */
+	int flush();
+
+	/**
+	 * @brief Start reading from the oldest record
+	 */
+	int rewind();
+
+	/**
+	 * @brief Read the next record
+	 * @param buffer
+	 * @param bufSize Record is truncated if larger than this
+	 * @retval int Size of record, 0 if there are no more records, or error code
+	 *
+	 * Only committed records are visible.
+	 */
+	int read(void* buffer, size_t bufSize);
+
+	bool isOpen() const
+	{
+		return writeFile >= 0;
+	}
+
+	/**
+	 * @brief Get sequence number of oldest segment
+	 */
+	uint32_t getFirstSegment() const
+	{
+		return firstSeq;
+	}
+
+	/**
+	 * @brief Get sequence number of segment currently being written
+	 */
+	uint32_t getLastSegment() const
+	{
+		return lastSeq;
+	}
+
+private:
+	String getSegmentPath(uint32_t seq) const;
+	int startSegment(uint32_t seq);
+	int removeOldest();
+	void closeReader();
+
+	FileSystem& fs;
+	String path;
+	Config config;
+	std::unique_ptr<uint8_t[]> buffer; ///< Record is assembled here so it's written in one operation
+	uint32_t firstSeq{0};
+	uint32_t lastSeq{0};
+	FileHandle writeFile{-1};
+	size_t writePos{0};
+	FileHandle readFile{-1}; ///< Only held whilst records remain in segment
+	uint32_t readSeq{0};
+	size_t readPos{0};
+};
+
+} // namespace LittleFS
+} // namespace IFS
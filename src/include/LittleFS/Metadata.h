@@ -0,0 +1,196 @@
+/****
+ * Metadata.h - Direct access to littlefs on-disk structures
+ *
+ * Copyright 2021 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the Sming-LittleFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#pragma once
+
+#include "../../littlefs/lfs.h"
+
+namespace IFS
+{
+namespace LittleFS
+{
+constexpr lfs_block_t BLOCK_NULL{0xffffffff}; ///< Same as LFS_BLOCK_NULL
+
+/*
+ * On-disk values are little-endian, except tags which are big-endian
+ */
+inline uint32_t fromle32(const uint8_t* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | (uint32_t(p[3]) << 24);
+}
+
+inline uint32_t frombe32(const uint8_t* p)
+{
+	return (uint32_t(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/**
+ * @brief Metadata tag, decoded
+ *
+ * See littlefs SPEC.md. Bit layout is:
+ *
+ * 	[1] valid (0 = valid)
+ * 	[11] type
+ * 	[10] id
+ * 	[10] length
+ */
+struct Tag {
+	uint32_t value;
+
+	static constexpr uint32_t make(uint16_t type, uint16_t id, uint16_t size)
+	{
+		return (uint32_t(type) << 20) | (uint32_t(id) << 10) | size;
+	}
+
+	bool isValid() const
+	{
+		return !(value & 0x80000000);
+	}
+
+	uint16_t type() const
+	{
+		return (value & 0x7ff00000) >> 20;
+	}
+
+	uint16_t type1() const
+	{
+		return (value & 0x70000000) >> 20;
+	}
+
+	uint8_t chunk() const
+	{
+		return (value & 0x0ff00000) >> 20;
+	}
+
+	int8_t splice() const
+	{
+		return int8_t(chunk());
+	}
+
+	uint16_t id() const
+	{
+		return (value & 0x000ffc00) >> 10;
+	}
+
+	uint16_t size() const
+	{
+		return value & 0x000003ff;
+	}
+
+	bool isDelete() const
+	{
+		return size() == 0x3ff;
+	}
+
+	/**
+	 * @brief Determine if this tag ends a commit
+	 *
+	 * The lowest chunk bit gives the valid bit for the next commit, so is ignored.
+	 * Other tags share type1 `LFS_TYPE_CRC`, such as the FCRC tag added in littlefs v2.6.
+	 */
+	bool isCommitCrc() const
+	{
+		return (type() & ~1U) == LFS_TYPE_CRC;
+	}
+
+	/**
+	 * @brief Size of tag plus its data
+	 */
+	uint32_t dsize() const
+	{
+		return sizeof(value) + (isDelete() ? 0 : size());
+	}
+};
+
+/**
+ * @brief Read littlefs structures directly from the block device
+ *
+ * Reads go through the filesystem's block device callback so they are seen by any profiler.
+ * The on-disk state is only consistent between littlefs API calls.
+ */
+class MetaReader
+{
+public:
+	/**
+	 * @brief Callback for CTZ traversal
+	 * @param index Block index within file, starting at 0
+	 * @param block Block number
+	 * @param start Offset of first byte of file data within block
+	 * @param end Offset following last byte of file data within block
+	 * @retval int LFS error code, non-zero to stop traversal
+	 */
+	using CtzCallback = int (*)(void* param, lfs_off_t index, lfs_block_t block, lfs_off_t start, lfs_off_t end);
+
+	MetaReader(const lfs_config& cfg, const lfs_t* lfs = nullptr) : cfg(cfg), lfs(lfs)
+	{
+	}
+
+	int read(lfs_block_t block, lfs_off_t off, void* buffer, lfs_size_t size) const;
+
+	/**
+	 * @brief Get the index of the CTZ block containing a file offset
+	 * @param off IN: File offset, OUT: Offset within block
+	 * @retval lfs_off_t Block index
+	 */
+	lfs_off_t ctzIndex(lfs_off_t& off) const;
+
+	/**
+	 * @brief Offset of file data within a CTZ block, following the skip-list pointers
+	 */
+	static lfs_off_t ctzDataOffset(lfs_off_t index)
+	{
+		return (index == 0) ? 0 : sizeof(lfs_block_t) * (__builtin_ctz(index) + 1);
+	}
+
+	/**
+	 * @brief Find block containing a file position
+	 * @param head Last block in list
+	 * @param size File size
+	 * @param pos File position
+	 * @param block OUT: Block containing position
+	 * @param off OUT: Offset of position within block
+	 * @note Uses skip-list pointers so requires O(log n) reads
+	 */
+	int ctzFind(lfs_block_t head, lfs_size_t size, lfs_off_t pos, lfs_block_t& block, lfs_off_t& off) const;
+
+	/**
+	 * @brief Visit every block in a CTZ list, last block first
+	 *
+	 * Each block is read once, following the first (immediate predecessor) pointer.
+	 */
+	int ctzTraverse(lfs_block_t head, lfs_size_t size, CtzCallback callback, void* param) const;
+
+	/**
+	 * @brief Find the most recent tag matching a mask within a metadata pair
+	 * @param dir Fetched metadata pair
+	 * @param gmask Bits to compare
+	 * @param gtag Value to match
+	 * @param dataOffset OUT: Offset of tag data within dir.pair[0]
+	 * @retval int32_t Tag value, or LFS error code
+	 * @note This mirrors `lfs_dir_getslice`, including id adjustment for creates/deletes
+	 */
+	int32_t findTag(const lfs_mdir_t& dir, uint32_t gmask, uint32_t gtag, lfs_off_t& dataOffset) const;
+
+private:
+	const lfs_config& cfg;
+	const lfs_t* lfs;
+};
+
+} // namespace LittleFS
+} // namespace IFS
@@ -0,0 +1,138 @@
+/****
+ * Mutex.h - Optional locking for multi-threaded access
+ *
+ * Copyright 2021 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the Sming-LittleFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#pragma once
+
+#ifndef LFS_ENABLE_LOCKING
+#define LFS_ENABLE_LOCKING 0
+#endif
+
+#if LFS_ENABLE_LOCKING
+#if defined(ARCH_ESP32)
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#elif defined(ARCH_RP2040)
+#include <pico/mutex.h>
+#elif defined(ARCH_HOST)
+#include <mutex>
+#endif
+#endif
+
+namespace IFS
+{
+namespace LittleFS
+{
+/**
+ * @brief Recursive mutex guarding a filesystem instance
+ *
+ * Compiles to nothing unless LFS_ENABLE_LOCKING=1, or on architectures without threads.
+ * Recursive since filesystem methods may call each other.
+ */
+class Mutex
+{
+public:
+#if LFS_ENABLE_LOCKING && defined(ARCH_ESP32)
+	Mutex() : handle(xSemaphoreCreateRecursiveMutex())
+	{
+	}
+
+	~Mutex()
+	{
+		vSemaphoreDelete(handle);
+	}
+
+	void lock()
+	{
+		xSemaphoreTakeRecursive(handle, portMAX_DELAY);
+	}
+
+	void unlock()
+	{
+		xSemaphoreGiveRecursive(handle);
+	}
+
+private:
+	SemaphoreHandle_t handle;
+#elif LFS_ENABLE_LOCKING && defined(ARCH_RP2040)
+	Mutex()
+	{
+		recursive_mutex_init(&mutex);
+	}
+
+	void lock()
+	{
+		recursive_mutex_enter_blocking(&mutex);
+	}
+
+	void unlock()
+	{
+		recursive_mutex_exit(&mutex);
+	}
+
+private:
+	recursive_mutex_t mutex;
+#elif LFS_ENABLE_LOCKING && defined(ARCH_HOST)
+	void lock()
+	{
+		mutex.lock();
+	}
+
+	void unlock()
+	{
+		mutex.unlock();
+	}
+
+private:
+	std::recursive_mutex mutex;
+#else
+	void lock()
+	{
+	}
+
+	void unlock()
+	{
+	}
+#endif
+};
+
+/**
+ * @brief Holds a mutex for the lifetime of this object
+ */
+class MutexLock
+{
+public:
+	MutexLock(Mutex& mutex) : mutex(mutex)
+	{
+		mutex.lock();
+	}
+
+	~MutexLock()
+	{
+		mutex.unlock();
+	}
+
+	MutexLock(const MutexLock&) = delete;
+	MutexLock& operator=(const MutexLock&) = delete;
+
+private:
+	Mutex& mutex;
+};
+
+} // namespace LittleFS
+} // namespace IFS
@@ -0,0 +1,102 @@
+/****
+ * ObjectPool.h - Fixed pool of re-usable objects
+ *
+ * Copyright 2021 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the Sming-LittleFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#pragma once
+
+#include <cstddef>
+#include <cassert>
+
+namespace IFS
+{
+namespace LittleFS
+{
+/**
+ * @brief Pool of objects stored in-place, so allocation never touches the heap
+ * @tparam T Object type, must provide a `reset()` method to restore initial state
+ * @tparam poolSize Number of objects in the pool
+ *
+ * Objects never move, so may safely be linked into lists (as littlefs does with open files and directories).
+ */
+template <typename T, size_t poolSize> class ObjectPool
+{
+public:
+	/**
+	 * @brief Obtain a free object from the pool
+	 * @retval T* nullptr if pool is exhausted
+	 */
+	T* allocate()
+	{
+		for(unsigned i = 0; i < poolSize; ++i) {
+			if(!used[i]) {
+				used[i] = true;
+				return &items[i];
+			}
+		}
+		return nullptr;
+	}
+
+	/**
+	 * @brief Return an object to the pool
+	 */
+	void release(T* item)
+	{
+		int i = indexOf(item);
+		assert(i >= 0 && used[i]);
+		items[i].reset();
+		used[i] = false;
+	}
+
+	/**
+	 * @brief Get position of an object within the pool
+	 * @retval int -1 if object does not belong to this pool
+	 */
+	int indexOf(const T* item) const
+	{
+		if(item < &items[0] || item >= &items[poolSize]) {
+			return -1;
+		}
+		return item - &items[0];
+	}
+
+	bool contains(const T* item) const
+	{
+		return indexOf(item) >= 0;
+	}
+
+	/**
+	 * @brief Get an allocated object by index
+	 * @retval T* nullptr if index is out of range or object not allocated
+	 */
+	T* operator[](unsigned index)
+	{
+		return (index < poolSize && used[index]) ? &items[index] : nullptr;
+	}
+
+	static constexpr size_t size()
+	{
+		return poolSize;
+	}
+
+private:
+	T items[poolSize]{};
+	bool used[poolSize]{};
+};
+
+} // namespace LittleFS
+} // namespace IFS
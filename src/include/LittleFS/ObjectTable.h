@@ -0,0 +1,194 @@
+/****
+ * ObjectTable.h - Growable table of re-usable objects
+ *
+ * Copyright 2021 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the Sming-LittleFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cassert>
+#include <algorithm>
+
+namespace IFS
+{
+namespace LittleFS
+{
+/**
+ * @brief Table of objects addressed by index, with O(1) allocation via a free list
+ * @tparam T Object type, must provide a `reset()` method to restore initial state
+ * @tparam chunkSize Number of objects stored in-place, and size of each additional chunk
+ * @tparam maxItems Absolute upper limit on table size
+ *
+ * The first chunk is stored in-place. Further chunks are allocated from the heap as required,
+ * up to the limit set by `setLimit()`. Chunks are never released, so once the table has grown
+ * to accommodate peak demand no further heap allocation occurs.
+ *
+ * Objects never move, so may safely be linked into lists (as littlefs does with open files).
+ */
+template <typename T, size_t chunkSize, size_t maxItems> class ObjectTable
+{
+public:
+	static_assert(chunkSize > 0 && chunkSize <= maxItems, "Bad table size");
+	static_assert(maxItems < 0xffff, "Table too large");
+
+	ObjectTable()
+	{
+		chunks[0] = &firstChunk;
+		initChunk(0);
+	}
+
+	~ObjectTable()
+	{
+		for(unsigned i = 1; i < chunkCount; ++i) {
+			delete chunks[i];
+		}
+	}
+
+	ObjectTable(const ObjectTable&) = delete;
+	ObjectTable& operator=(const ObjectTable&) = delete;
+
+	/**
+	 * @brief Set maximum number of objects which may be allocated at once
+	 * @note Cannot be set above `maxItems`. Reducing the limit doesn't release any chunks.
+	 */
+	void setLimit(size_t limit)
+	{
+		this->limit = std::min(limit, maxItems);
+	}
+
+	/**
+	 * @brief Obtain a free object
+	 * @retval int Index of object, or -1 if table is full
+	 */
+	int allocate()
+	{
+		if(count >= limit) {
+			return -1;
+		}
+		if(freeHead == none && !grow()) {
+			return -1;
+		}
+		auto index = freeHead;
+		auto& entry = getEntry(index);
+		freeHead = entry.next;
+		entry.used = true;
+		++count;
+		return index;
+	}
+
+	/**
+	 * @brief Return an object to the table
+	 */
+	void release(unsigned index)
+	{
+		assert(index < capacity());
+		auto& entry = getEntry(index);
+		assert(entry.used);
+		entry.item.reset();
+		entry.used = false;
+		entry.next = freeHead;
+		freeHead = index;
+		--count;
+	}
+
+	/**
+	 * @brief Get an allocated object
+	 * @retval T* nullptr if index is out of range or object not allocated
+	 */
+	T* operator[](unsigned index)
+	{
+		if(index >= capacity()) {
+			return nullptr;
+		}
+		auto& entry = getEntry(index);
+		return entry.used ? &entry.item : nullptr;
+	}
+
+	/**
+	 * @brief Number of objects currently allocated
+	 */
+	size_t used() const
+	{
+		return count;
+	}
+
+	/**
+	 * @brief Number of objects currently available without further heap allocation
+	 */
+	size_t capacity() const
+	{
+		return chunkCount * chunkSize;
+	}
+
+private:
+	static constexpr uint16_t none{0xffff};
+	static constexpr size_t maxChunks{(maxItems + chunkSize - 1) / chunkSize};
+
+	struct Entry {
+		T item{};
+		uint16_t next{none}; ///< Next free entry
+		bool used{false};
+	};
+
+	struct Chunk {
+		Entry entries[chunkSize];
+	};
+
+	Entry& getEntry(unsigned index)
+	{
+		return chunks[index / chunkSize]->entries[index % chunkSize];
+	}
+
+	// Push entries for chunk onto free list, lowest index first
+	void initChunk(unsigned chunkIndex)
+	{
+		auto base = chunkIndex * chunkSize;
+		for(unsigned i = chunkSize; i != 0; --i) {
+			auto index = base + i - 1;
+			if(index >= maxItems) {
+				continue;
+			}
+			getEntry(index).next = freeHead;
+			freeHead = index;
+		}
+	}
+
+	bool grow()
+	{
+		if(chunkCount >= maxChunks) {
+			return false;
+		}
+		auto chunk = new Chunk;
+		if(chunk == nullptr) {
+			return false;
+		}
+		chunks[chunkCount] = chunk;
+		initChunk(chunkCount++);
+		return true;
+	}
+
+	Chunk firstChunk;
+	Chunk* chunks[maxChunks]{};
+	uint16_t chunkCount{1};
+	uint16_t freeHead{none};
+	uint16_t count{0};
+	size_t limit{chunkSize};
+};
+
+} // namespace LittleFS
+} // namespace IFS
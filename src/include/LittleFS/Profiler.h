@@ -0,0 +1,235 @@
+/****
+ * Profiler.h - Device access statistics for littlefs
+ *
+ * Copyright 2021 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the Sming-LittleFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#pragma once
+
+#include <IFS/Profiler.h>
+#include <Print.h>
+#include <WString.h>
+#include <memory>
+
+/**
+ * @brief Filesystem operations to which device accesses are attributed
+ */
+#define LFS_PROFILER_OPERATION_MAP(XX)                                                                                 \
+	XX(other)                                                                                                          \
+	XX(mount)                                                                                                          \
+	XX(format)                                                                                                         \
+	XX(check)                                                                                                          \
+	XX(info)                                                                                                           \
+	XX(open)                                                                                                           \
+	XX(close)                                                                                                          \
+	XX(read)                                                                                                           \
+	XX(write)                                                                                                          \
+	XX(seek)                                                                                                           \
+	XX(flush)                                                                                                          \
+	XX(truncate)                                                                                                       \
+	XX(stat)                                                                                                           \
+	XX(attr)                                                                                                           \
+	XX(dir)                                                                                                            \
+	XX(mkdir)                                                                                                          \
+	XX(rename)                                                                                                         \
+	XX(remove)                                                                                                         \
+	XX(gc)
+
+namespace IFS
+{
+namespace LittleFS
+{
+/**
+ * @brief Records detailed statistics for littlefs device accesses
+ *
+ * Attach to a filesystem using `FileSystem::attachProfiler()`. This records:
+ *
+ * - Number of calls, bytes and time taken for each type of device access (read, prog, erase, sync)
+ * - Histograms of access sizes and latencies
+ * - Per-block access counts, if enabled via `setGeometry()`
+ * - Which filesystem operation caused each access
+ *
+ * It may also be used with `setProfiler()` on any filesystem, but then only sizes and block counts are recorded.
+ */
+class Profiler : public IProfiler
+{
+public:
+	enum class Operation {
+#define XX(name) name,
+		LFS_PROFILER_OPERATION_MAP(XX)
+#undef XX
+	};
+	static constexpr size_t operationCount{0
+#define XX(name) +1
+											   LFS_PROFILER_OPERATION_MAP(XX)
+#undef XX
+	};
+
+	enum class Device {
+		read,
+		prog,
+		erase,
+		sync,
+	};
+	static constexpr size_t deviceCount{4};
+
+	/**
+	 * @brief Power-of-two histogram
+	 *
+	 * Bucket 0 counts zero values, bucket n counts values from 2^(n-1) to 2^n - 1.
+	 * The final bucket also counts anything larger.
+	 */
+	struct Histogram {
+		static constexpr size_t bucketCount{20};
+		uint32_t buckets[bucketCount];
+
+		void add(uint32_t value);
+		size_t printTo(Print& p) const;
+	};
+
+	struct DeviceStats {
+		uint32_t count;
+		uint64_t bytes;
+		uint64_t time; ///< Total time in microseconds
+		uint32_t maxTime;
+		Histogram sizes;
+		Histogram times;
+	};
+
+	struct OperationStats {
+		uint32_t calls; ///< Number of filesystem calls
+		uint32_t count[deviceCount];
+		uint64_t bytes[deviceCount];
+		uint64_t time; ///< Total device time in microseconds
+	};
+
+	/**
+	 * @brief Sets the current filesystem operation for the lifetime of this object
+	 *
+	 * Nested scopes for the same operation count as a single call.
+	 */
+	class Scope
+	{
+	public:
+		Scope(Profiler* profiler, Operation operation) : profiler(profiler)
+		{
+			if(profiler != nullptr) {
+				prevOperation = profiler->operation;
+				profiler->operation = operation;
+				if(operation != prevOperation) {
+					++profiler->operations[unsigned(operation)].calls;
+				}
+			}
+		}
+
+		~Scope()
+		{
+			if(profiler != nullptr) {
+				profiler->operation = prevOperation;
+			}
+		}
+
+	private:
+		Profiler* profiler;
+		Operation prevOperation{};
+	};
+
+	/**
+	 * @brief Enable per-block counts
+	 * @param blockSize Size of each block, normally the filesystem block size
+	 * @param blockCount Number of blocks, 0 to disable
+	 * @retval bool false on allocation failure
+	 *
+	 * Three counters are required for each block so this may use a lot of RAM.
+	 */
+	bool setGeometry(size_t blockSize, size_t blockCount);
+
+	/**
+	 * @brief Clear all statistics
+	 */
+	void reset();
+
+	void read(storage_size_t address, const void* buffer, size_t size) override
+	{
+		(void)buffer;
+		record(Device::read, address, size);
+	}
+
+	void write(storage_size_t address, const void* buffer, size_t size) override
+	{
+		(void)buffer;
+		record(Device::prog, address, size);
+	}
+
+	void erase(storage_size_t address, size_t size) override
+	{
+		record(Device::erase, address, size);
+	}
+
+	void sync()
+	{
+		record(Device::sync, 0, 0);
+	}
+
+	/**
+	 * @brief Record the time taken by a device access, called after the corresponding `read()`, etc.
+	 */
+	void recordTime(Device device, uint32_t time);
+
+	const DeviceStats& getDeviceStats(Device device) const
+	{
+		return devices[unsigned(device)];
+	}
+
+	const OperationStats& getOperationStats(Operation operation) const
+	{
+		return operations[unsigned(operation)];
+	}
+
+	/**
+	 * @brief Get number of accesses for a specific block
+	 * @param device One of read, prog or erase
+	 * @param block
+	 * @retval uint32_t Access count, 0 if per-block counts are not enabled
+	 */
+	uint32_t getBlockCount(Device device, uint32_t block) const;
+
+	/**
+	 * @brief Print summary of device and operation statistics
+	 */
+	size_t printTo(Print& p) const;
+
+	/**
+	 * @brief Print per-block access counts, 8 blocks per line
+	 */
+	size_t printHeatmap(Print& p, Device device) const;
+
+private:
+	void record(Device device, storage_size_t address, size_t size);
+
+	DeviceStats devices[deviceCount]{};
+	OperationStats operations[operationCount]{};
+	std::unique_ptr<uint32_t[]> blockCounts; ///< Read, prog then erase counts for each block
+	size_t blockSize{0};
+	size_t blockCount{0};
+	Operation operation{Operation::other};
+};
+
+String toString(Profiler::Operation operation);
+String toString(Profiler::Device device);
+
+} // namespace LittleFS
+} // namespace IFS
@@ -0,0 +1,128 @@
+/****
+ * StatCache.h - Cache of recently accessed file information
+ *
+ * Copyright 2021 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the Sming-LittleFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#pragma once
+
+#include <IFS/Stat.h>
+#include <Data/CString.h>
+#include <memory>
+
+namespace IFS
+{
+namespace LittleFS
+{
+/**
+ * @brief Compute hash of a path
+ * @param path Path to hash, may be nullptr
+ * @param hash Hash of parent directory
+ * @retval uint32_t 0 if path cannot be cached
+ *
+ * Paths are normalised by component so "a/b", "/a/b" and "a//b/" give the same value.
+ * Appending a name to a directory hash gives the same result as hashing the full path.
+ * Paths containing "." or ".." components are not cached.
+ */
+uint32_t getPathHash(const char* path, uint32_t hash = 0);
+
+/**
+ * @brief Join and normalise path components for storing in a cache
+ * @param dir Directory path, may be nullptr
+ * @param name Name within `dir`, or full path
+ * @retval String Path without leading, trailing or repeated separators
+ */
+String normalisePath(const char* dir, const char* name);
+
+/**
+ * @brief Compare a path stored by `normalisePath()` with one given by the application
+ */
+bool isSamePath(const char* stored, const char* dir, const char* name);
+
+/**
+ * @brief Bounded LRU cache of `Stat` information, including attributes
+ *
+ * Entries are located by path hash, and the full path is stored and compared
+ * so hash collisions cannot return information for the wrong file.
+ * Callers must invalidate entries when the corresponding file or directory changes.
+ */
+class StatCache
+{
+public:
+	/**
+	 * @brief Set number of entries, 0 disables the cache
+	 */
+	void setSize(size_t size);
+
+	size_t getSize() const
+	{
+		return size;
+	}
+
+	/**
+	 * @brief Fetch cached information
+	 * @param hash Value returned from `getPathHash()`
+	 * @param path Path which produced `hash`
+	 * @param stat On success, everything except `fs` and `id` is filled in
+	 * @retval bool true if found
+	 */
+	bool get(uint32_t hash, const char* path, Stat& stat);
+
+	/**
+	 * @brief Store information, replacing the least recently used entry if necessary
+	 * @param hash Value returned from `getPathHash()`
+	 * @param dir Path of containing directory, may be nullptr
+	 * @param name Name of file within `dir`, or full path
+	 * @param stat
+	 */
+	void put(uint32_t hash, const char* dir, const char* name, const Stat& stat);
+
+	void put(uint32_t hash, const char* path, const Stat& stat)
+	{
+		put(hash, nullptr, path, stat);
+	}
+
+	/**
+	 * @brief Discard any entries for the given path hash
+	 */
+	void invalidate(uint32_t hash);
+
+	/**
+	 * @brief Discard all entries
+	 */
+	void clear();
+
+private:
+	struct Entry {
+		uint32_t hash{0};
+		uint32_t lastUsed{0};
+		CString path; ///< Normalised, without leading or repeated separators
+		file_size_t size{0};
+		TimeStamp mtime{};
+		ACL acl{};
+		FileAttributes attr{};
+		Compression compression{};
+	};
+
+	Entry* find(uint32_t hash, const char* dir, const char* name);
+
+	std::unique_ptr<Entry[]> entries;
+	size_t size{0};
+	uint32_t useCount{0};
+};
+
+} // namespace LittleFS
+} // namespace IFS
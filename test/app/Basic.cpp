@@ -1,22 +1,1191 @@
+#include "SimFlash.h"
 #include <SmingTest.h>
 #include <IFS/Helpers.h>
+#include <IFS/FileCopier.h>
 #include <IFS/FWFS/ArchiveStream.h>
 #include <Storage/FileDevice.h>
 #include <LittleFS.h>
+#include <LittleFS/FileSystem.h>
+#include <Data/Stream/MemoryDataStream.h>
+#include <vector>
+#include <algorithm>
+#if LFS_ENABLE_LOCKING
+#include <thread>
+#include <atomic>
+#endif
+
+/*
+ * Functional tests for driver features, run against a simulated flash device
+ */
+namespace
+{
+constexpr size_t flashSize{256 * 1024};
+constexpr size_t blockSize{4096};
+
+} // namespace
 
 class BasicTest : public TestGroup
 {
 public:
-	BasicTest() : TestGroup(_F("Basic"))
+	BasicTest() : TestGroup(_F("Basic")), flash("SIM", flashSize)
 	{
+		partition = flash.editablePartitions().add("sim", Storage::Partition::SubType::Data::littlefs, 0, flashSize);
 	}
 
 	void execute() override
 	{
+		TEST_CASE("Superblock copies")
+		{
+			using namespace IFS;
+			LittleFS::Config config;
+			config.blockSize = 2 * blockSize;
+			remount(config, true);
+			writeFile("file", "content");
+			fs.reset();
+
+			// Block 0 lost, as during compaction
+			REQUIRE(flash.erase_range(0, 2 * blockSize));
+
+			// Guessing from the erase size fails
+			config.formatOnFail = false;
+			config.blockSize = blockSize;
+			fs.reset(new LittleFS::FileSystem(partition, config));
+			REQUIRE(fs->mount() < 0);
+
+			// Block size is read from block 1
+			config.blockSize = 0;
+			remount(config);
+			REQUIRE_EQ(readFile("file"), "content");
+			REQUIRE_EQ(fs->check(), FS_OK);
+		}
+
+		TEST_CASE("File handle limit")
+		{
+			const unsigned limits[]{3, LFS_MAX_FDS + 2};
+			for(auto maxFiles : limits) {
+				IFS::LittleFS::Config config;
+				config.maxFiles = maxFiles;
+				remount(config, true);
+				std::vector<FileHandle> handles;
+				for(unsigned i = 0; i < maxFiles; ++i) {
+					auto file = fs->open(String(i).c_str(), File::CreateNewAlways | File::WriteOnly);
+					REQUIRE(file >= 0);
+					handles.push_back(file);
+				}
+				REQUIRE_EQ(fs->open("extra", File::CreateNewAlways | File::WriteOnly), IFS::FileHandle(IFS::Error::OutOfFileDescs));
+				// Releasing a handle makes one available again
+				REQUIRE_EQ(fs->close(handles.back()), FS_OK);
+				handles.back() = fs->open("extra", File::CreateNewAlways | File::WriteOnly);
+				REQUIRE(handles.back() >= 0);
+				for(auto file : handles) {
+					REQUIRE_EQ(fs->close(file), FS_OK);
+				}
+			}
+		}
+
+		TEST_CASE("File extents")
+		{
+			using namespace IFS;
+			remount({}, true);
+			writeFile("small", "inline");
+			REQUIRE_EQ(checkExtents("small", "inline"), 1);
+
+			auto content = makeContent(3 * blockSize + 100);
+			writeFile("big", content);
+			auto count = checkExtents("big", content);
+			REQUIRE(count >= 4);
+
+			// Count is returned even when the list is short
+			auto file = fs->open("big", File::ReadWrite);
+			REQUIRE(file >= 0);
+			Extent list[2]{};
+			REQUIRE_EQ(fs->fgetextents(file, nullptr, list, 2), count);
+			REQUIRE(list[0].length != 0 && list[1].length != 0);
+
+			// Pending writes are committed first, and file position is unchanged
+			REQUIRE_EQ(fs->lseek(file, 0, SeekOrigin::End), file_offset_t(content.length()));
+			REQUIRE_EQ(fs->write(file, "tail", 4), 4);
+			REQUIRE_EQ(fs->fgetextents(file, nullptr, nullptr, 0), count);
+			REQUIRE_EQ(fs->tell(file), file_offset_t(content.length() + 4));
+			REQUIRE_EQ(fs->close(file), FS_OK);
+			REQUIRE_EQ(checkExtents("big", content + "tail"), count);
+		}
+
+		TEST_CASE("Memory-mapped reads")
+		{
+			using namespace IFS;
+			remount({}, true);
+			writeFile("small", "inline");
+			writeFile("big", makeContent(3 * blockSize));
+
+			// Simulated flash isn't memory-mapped so data is located, then mapping fails
+			const struct {
+				const char* path;
+				file_offset_t offset;
+			} reads[]{
+				{"small", 1},
+				{"big", 1},
+				{"big", 2 * blockSize + 10},
+			};
+			for(auto& r : reads) {
+				auto file = fs->open(r.path, File::ReadOnly);
+				REQUIRE(file >= 0);
+				size_t length{16};
+				const void* data = &length;
+				REQUIRE_EQ(fs->mmap(file, r.offset, length, data), int(Error::NotSupported));
+				REQUIRE_EQ(length, 0U);
+				REQUIRE(data == nullptr);
+
+				// Nothing to map at end of file
+				length = 16;
+				REQUIRE_EQ(fs->mmap(file, 3 * blockSize, length, data), FS_OK);
+				REQUIRE_EQ(length, 0U);
+				REQUIRE_EQ(fs->mmap(file, -1, length, data), int(Error::BadParam));
+				REQUIRE_EQ(fs->munmap(file), FS_OK);
+				REQUIRE_EQ(fs->close(file), FS_OK);
+			}
+		}
+
+		TEST_CASE("Preallocated files")
+		{
+			using namespace IFS;
+			remount({}, true);
+			// Leave single free blocks scattered through the volume
+			char name[8];
+			for(unsigned i = 0; i < 16; ++i) {
+				m_snprintf(name, sizeof(name), "f%u", i);
+				writeFile(name, makeContent(blockSize));
+			}
+			for(unsigned i = 0; i < 16; i += 2) {
+				m_snprintf(name, sizeof(name), "f%u", i);
+				REQUIRE_EQ(fs->remove(name), FS_OK);
+			}
+
+			// Six blocks including CTZ pointers
+			constexpr unsigned blocks{6};
+			auto content = makeContent(blocks * blockSize - 100);
+			auto file = fs->open("alloc", File::CreateNewAlways | File::WriteOnly);
+			REQUIRE(file >= 0);
+			REQUIRE_EQ(fs->fallocate(file, content.length()), FS_OK);
+			for(size_t pos = 0; pos < content.length(); pos += 1024) {
+				auto len = std::min(content.length() - pos, size_t(1024));
+				REQUIRE_EQ(fs->write(file, content.c_str() + pos, len), int(len));
+			}
+			REQUIRE_EQ(fs->close(file), FS_OK);
+			REQUIRE_EQ(readFile("alloc"), content);
+
+			file = fs->open("alloc", File::ReadOnly);
+			REQUIRE(file >= 0);
+			Extent list[blocks];
+			REQUIRE_EQ(fs->fgetextents(file, nullptr, list, blocks), int(blocks));
+			for(unsigned i = 1; i < blocks; ++i) {
+				REQUIRE_EQ(list[i].offset / blockSize, list[i - 1].offset / blockSize + 1);
+			}
+			REQUIRE_EQ(fs->fallocate(file, 2 * content.length()), int(Error::ReadOnly));
+			REQUIRE_EQ(fs->close(file), FS_OK);
+
+			// Nothing to do if file already has the space
+			file = fs->open("alloc", File::WriteOnly);
+			REQUIRE(file >= 0);
+			REQUIRE_EQ(fs->fallocate(file, blockSize), FS_OK);
+			REQUIRE_EQ(fs->close(file), FS_OK);
+			REQUIRE_EQ(fs->check(), FS_OK);
+		}
+
+		TEST_CASE("Stat cache")
+		{
+			using namespace IFS;
+			remount({}, true);
+			writeFile("file", "content");
+			Stat stat;
+			REQUIRE_EQ(fs->stat("file", &stat), FS_OK);
+			auto elapsed = flash.getElapsedNs();
+			REQUIRE_EQ(fs->stat("/file", &stat), FS_OK);
+			REQUIRE_EQ(flash.getElapsedNs(), elapsed);
+			REQUIRE_EQ(String(stat.name), "file");
+			REQUIRE_EQ(stat.size, 7U);
+
+			// Write, attribute change, rename and remove all invalidate
+			writeFile("file", "changed!");
+			REQUIRE_EQ(fs->stat("file", &stat), FS_OK);
+			REQUIRE_EQ(stat.size, 8U);
+			FileAttributes attr{};
+			attr += FileAttribute::Archive;
+			REQUIRE_EQ(fs->setxattr("file", AttributeTag::FileAttributes, &attr, sizeof(attr)), FS_OK);
+			REQUIRE_EQ(fs->stat("file", &stat), FS_OK);
+			REQUIRE(stat.attr[FileAttribute::Archive]);
+			REQUIRE_EQ(fs->rename("file", "moved"), FS_OK);
+			REQUIRE(fs->stat("file", &stat) < 0);
+			REQUIRE_EQ(fs->stat("moved", &stat), FS_OK);
+			REQUIRE_EQ(stat.size, 8U);
+			REQUIRE_EQ(fs->remove("moved"), FS_OK);
+			REQUIRE(fs->stat("moved", &stat) < 0);
+
+			// Paths with the same hash are distinguished
+			REQUIRE_EQ(LittleFS::getPathHash("jrnw"), LittleFS::getPathHash("2pba"));
+			writeFile("jrnw", "1");
+			writeFile("2pba", "22");
+			for(unsigned i = 0; i < 2; ++i) {
+				REQUIRE_EQ(fs->stat("jrnw", &stat), FS_OK);
+				REQUIRE_EQ(String(stat.name), "jrnw");
+				REQUIRE_EQ(stat.size, 1U);
+				REQUIRE_EQ(fs->stat("2pba", &stat), FS_OK);
+				REQUIRE_EQ(String(stat.name), "2pba");
+				REQUIRE_EQ(stat.size, 2U);
+			}
+
+			// Listing a large directory doesn't evict other entries
+			REQUIRE_EQ(fs->mkdir("dir"), FS_OK);
+			for(unsigned i = 0; i < 20; ++i) {
+				writeFile(String(F("dir/") + i).c_str(), "x");
+			}
+			// Fill the cache, most recent last
+			for(unsigned i = 0; i < 7; ++i) {
+				REQUIRE_EQ(fs->stat(String(F("dir/") + i).c_str(), &stat), FS_OK);
+			}
+			REQUIRE_EQ(fs->stat("jrnw", &stat), FS_OK);
+			DirHandle dir;
+			REQUIRE_EQ(fs->opendir("dir", dir), FS_OK);
+			unsigned count{0};
+			while(fs->readdir(dir, stat) >= 0) {
+				++count;
+			}
+			REQUIRE_EQ(fs->closedir(dir), FS_OK);
+			REQUIRE_EQ(count, 20U);
+			elapsed = flash.getElapsedNs();
+			REQUIRE_EQ(fs->stat("jrnw", &stat), FS_OK);
+			REQUIRE_EQ(flash.getElapsedNs(), elapsed);
+
+			// First entries of a listing are cached
+			REQUIRE_EQ(fs->opendir("dir", dir), FS_OK);
+			REQUIRE_EQ(fs->readdir(dir, stat), FS_OK);
+			REQUIRE_EQ(fs->closedir(dir), FS_OK);
+			String path = F("dir/");
+			path += stat.name.c_str();
+			elapsed = flash.getElapsedNs();
+			REQUIRE_EQ(fs->stat(path.c_str(), &stat), FS_OK);
+			REQUIRE_EQ(flash.getElapsedNs(), elapsed);
+		}
+
+		TEST_CASE("Directory cache")
+		{
+			using namespace IFS;
+			remount({}, true);
+			REQUIRE_EQ(fs->mkdir("jrnw"), FS_OK);
+			writeFile("jrnw/a", "a");
+			DirHandle dir;
+			REQUIRE_EQ(fs->opendir("jrnw", dir), FS_OK);
+			REQUIRE_EQ(fs->closedir(dir), FS_OK);
+
+			// Known directory needs no device access
+			auto elapsed = flash.getElapsedNs();
+			REQUIRE_EQ(fs->mkdir("/jrnw/"), FS_OK);
+			REQUIRE_EQ(flash.getElapsedNs(), elapsed);
+
+			// Directory with the same path hash is distinct
+			REQUIRE_EQ(fs->mkdir("2pba"), FS_OK);
+			Stat stat;
+			REQUIRE_EQ(fs->stat("2pba", &stat), FS_OK);
+			REQUIRE(stat.isDir());
+			writeFile("2pba/b", "b");
+
+			auto readNames = [&](const char* path) {
+				String names;
+				REQUIRE_EQ(fs->opendir(path, dir), FS_OK);
+				while(fs->readdir(dir, stat) >= 0) {
+					names += stat.name.c_str();
+				}
+				REQUIRE_EQ(fs->closedir(dir), FS_OK);
+				return names;
+			};
+			for(unsigned i = 0; i < 2; ++i) {
+				REQUIRE_EQ(readNames("jrnw"), "a");
+				REQUIRE_EQ(readNames("2pba"), "b");
+			}
+
+			// Removed directory is forgotten
+			REQUIRE_EQ(fs->remove("jrnw/a"), FS_OK);
+			REQUIRE_EQ(fs->remove("jrnw"), FS_OK);
+			REQUIRE(fs->opendir("jrnw", dir) < 0);
+			REQUIRE_EQ(fs->mkdir("jrnw"), FS_OK);
+			REQUIRE_EQ(readNames("jrnw"), "");
+			REQUIRE_EQ(fs->check(), FS_OK);
+		}
+
+		TEST_CASE("Read-ahead")
+		{
+			using namespace IFS;
+			auto content = makeContent(8 * 1024);
+			remount({}, true);
+			writeFile("data", content);
+			writeFile("data2", content);
+			auto elapsed = flash.getElapsedNs();
+			REQUIRE_EQ(readChunked("data", 16), content);
+			auto directTime = flash.getElapsedNs() - elapsed;
+
+			LittleFS::Config config;
+			config.readAheadSize = 2048;
+			config.readAheadBuffers = 1;
+			remount(config);
+			elapsed = flash.getElapsedNs();
+			REQUIRE_EQ(readChunked("data", 16), content);
+			REQUIRE(flash.getElapsedNs() - elapsed < directTime);
+
+			// Position is tracked within the buffer
+			auto file = fs->open("data", File::ReadOnly);
+			REQUIRE(file >= 0);
+			char buffer[16];
+			for(unsigned i = 0; i < 4; ++i) {
+				REQUIRE_EQ(fs->read(file, buffer, sizeof(buffer)), int(sizeof(buffer)));
+			}
+			REQUIRE_EQ(fs->tell(file), 64);
+			REQUIRE_EQ(fs->lseek(file, 40, SeekOrigin::Start), 40);
+			REQUIRE_EQ(fs->read(file, buffer, sizeof(buffer)), int(sizeof(buffer)));
+			REQUIRE(memcmp(buffer, content.c_str() + 40, sizeof(buffer)) == 0);
+
+			// Only one buffer, so a second file reads directly
+			auto file2 = fs->open("data2", File::ReadOnly);
+			REQUIRE(file2 >= 0);
+			for(unsigned pos = 0; pos < 256; pos += sizeof(buffer)) {
+				REQUIRE_EQ(fs->read(file2, buffer, sizeof(buffer)), int(sizeof(buffer)));
+				REQUIRE(memcmp(buffer, content.c_str() + pos, sizeof(buffer)) == 0);
+			}
+			REQUIRE_EQ(fs->close(file2), FS_OK);
+
+			// Seek outside buffered range, then to end
+			REQUIRE_EQ(fs->lseek(file, 5000, SeekOrigin::Start), 5000);
+			REQUIRE_EQ(fs->read(file, buffer, sizeof(buffer)), int(sizeof(buffer)));
+			REQUIRE(memcmp(buffer, content.c_str() + 5000, sizeof(buffer)) == 0);
+			REQUIRE_EQ(fs->eof(file), 0);
+			REQUIRE_EQ(fs->lseek(file, 0, SeekOrigin::End), file_offset_t(content.length()));
+			REQUIRE_EQ(fs->eof(file), 1);
+			REQUIRE_EQ(fs->read(file, buffer, sizeof(buffer)), 0);
+			REQUIRE_EQ(fs->close(file), FS_OK);
+
+			// Files open for writing bypass read-ahead
+			file = fs->open("data", File::ReadWrite);
+			REQUIRE(file >= 0);
+			for(unsigned pos = 0; pos < 256; pos += sizeof(buffer)) {
+				REQUIRE_EQ(fs->read(file, buffer, sizeof(buffer)), int(sizeof(buffer)));
+				REQUIRE(memcmp(buffer, content.c_str() + pos, sizeof(buffer)) == 0);
+			}
+			REQUIRE_EQ(fs->write(file, "changed", 7), 7);
+			REQUIRE_EQ(fs->close(file), FS_OK);
+			auto expected = content;
+			memcpy(expected.begin() + 256, "changed", 7);
+			REQUIRE_EQ(readChunked("data", 16), expected);
+		}
+
+		TEST_CASE("Unmodified files aren't committed")
+		{
+			using namespace IFS;
+			remount({}, true);
+			writeFile("file", "content");
+			TimeStamp mtime{};
+			REQUIRE_EQ(fs->getxattr("file", AttributeTag::ModifiedTime, &mtime, sizeof(mtime)), int(sizeof(mtime)));
+
+			auto writeCount = flash.getWriteCount();
+			auto eraseCount = flash.getTotalEraseCount();
+			for(auto flags : {File::WriteOnly, File::ReadWrite}) {
+				auto file = fs->open("file", flags);
+				REQUIRE(file >= 0);
+				REQUIRE_EQ(fs->close(file), FS_OK);
+			}
+			REQUIRE_EQ(flash.getWriteCount(), writeCount);
+			REQUIRE_EQ(flash.getTotalEraseCount(), eraseCount);
+
+			// Writing commits both data and modification time
+			auto file = fs->open("file", File::WriteOnly | File::Append);
+			REQUIRE(file >= 0);
+			REQUIRE_EQ(fs->write(file, "!", 1), 1);
+			REQUIRE_EQ(fs->close(file), FS_OK);
+			REQUIRE(flash.getWriteCount() != writeCount);
+			REQUIRE_EQ(readFile("file"), "content!");
+			TimeStamp mtime2{};
+			REQUIRE_EQ(fs->getxattr("file", AttributeTag::ModifiedTime, &mtime2, sizeof(mtime2)), int(sizeof(mtime2)));
+			REQUIRE(mtime2 >= mtime);
+
+			// A new file gets a modification time even if nothing is written
+			file = fs->open("empty", File::CreateNewAlways | File::WriteOnly);
+			REQUIRE(file >= 0);
+			REQUIRE_EQ(fs->close(file), FS_OK);
+			REQUIRE_EQ(fs->getxattr("empty", AttributeTag::ModifiedTime, &mtime2, sizeof(mtime2)), int(sizeof(mtime2)));
+		}
+
+		TEST_CASE("Attributes")
+		{
+			using namespace IFS;
+			remount({}, true);
+			const auto tag1 = getUserAttributeTag(1);
+			const auto tag2 = getUserAttributeTag(2);
+			char buffer[32];
+
+			writeFile("attr", "content");
+			REQUIRE_EQ(fs->setxattr("attr", tag1, "hello", 5), FS_OK);
+			REQUIRE_EQ(fs->getxattr("attr", tag1, buffer, sizeof(buffer)), 5);
+			REQUIRE(memcmp(buffer, "hello", 5) == 0);
+
+			TimeStamp mtime{};
+			REQUIRE_EQ(fs->getxattr("attr", AttributeTag::ModifiedTime, &mtime, sizeof(mtime)), int(sizeof(mtime)));
+
+			// Pending attribute is visible before commit, and written with the file
+			auto file = fs->open("attr", File::WriteOnly);
+			REQUIRE(file >= 0);
+			REQUIRE_EQ(fs->fsetxattr(file, tag2, "pending", 7), FS_OK);
+			REQUIRE_EQ(fs->fgetxattr(file, tag2, buffer, sizeof(buffer)), 7);
+			REQUIRE(memcmp(buffer, "pending", 7) == 0);
+			REQUIRE_EQ(fs->close(file), FS_OK);
+			REQUIRE_EQ(fs->getxattr("attr", tag2, buffer, sizeof(buffer)), 7);
+			REQUIRE(memcmp(buffer, "pending", 7) == 0);
+			REQUIRE_EQ(fs->getxattr("attr", tag1, buffer, sizeof(buffer)), 5);
+			REQUIRE(memcmp(buffer, "hello", 5) == 0);
+
+			// Opening and closing a file doesn't change its attributes
+			file = fs->open("attr", File::ReadOnly);
+			REQUIRE(file >= 0);
+			TimeStamp mtime2{};
+			REQUIRE_EQ(fs->fgetxattr(file, AttributeTag::ModifiedTime, &mtime2, sizeof(mtime2)), int(sizeof(mtime2)));
+			REQUIRE(mtime2 == mtime);
+			REQUIRE_EQ(fs->close(file), FS_OK);
+			REQUIRE_EQ(fs->getxattr("attr", AttributeTag::ModifiedTime, &mtime2, sizeof(mtime2)), int(sizeof(mtime2)));
+			REQUIRE(mtime2 == mtime);
+			REQUIRE_EQ(readFile("attr"), "content");
+
+			// Pending attributes don't leak into the next file using the same descriptor
+			file = fs->open("attr", File::WriteOnly);
+			REQUIRE(file >= 0);
+			REQUIRE_EQ(fs->fsetxattr(file, tag1, "changed", 7), FS_OK);
+			REQUIRE_EQ(fs->close(file), FS_OK);
+			writeFile("other", "data");
+			REQUIRE(fs->getxattr("other", tag1, buffer, sizeof(buffer)) < 0);
+			REQUIRE(fs->getxattr("other", tag2, buffer, sizeof(buffer)) < 0);
+			REQUIRE_EQ(fs->getxattr("attr", tag1, buffer, sizeof(buffer)), 7);
+			REQUIRE(memcmp(buffer, "changed", 7) == 0);
+
+			// Removal
+			REQUIRE_EQ(fs->setxattr("attr", tag1, nullptr, 0), FS_OK);
+			REQUIRE(fs->getxattr("attr", tag1, buffer, sizeof(buffer)) < 0);
+			REQUIRE_EQ(fs->getxattr("attr", tag2, buffer, sizeof(buffer)), 7);
+		}
+
+		TEST_CASE("Check detects corruption")
+		{
+			using namespace IFS;
+			remount({}, true);
+			REQUIRE_EQ(fs->mkdir("dir"), FS_OK);
+			const char* needle = "corruption-needle";
+			writeFile("dir/corruption-needle", "content");
+			writeFile("dir/big", makeContent(3 * blockSize));
+			REQUIRE_EQ(fs->check(), FS_OK);
+			auto report = fs->getCheckReport();
+			REQUIRE_EQ(report.errorCount(), 0U);
+			REQUIRE_EQ(report.files, 2U);
+
+			// Incremental check reaches the same result
+			int res;
+			unsigned calls{0};
+			while((res = fs->checkIncremental(2)) > 0) {
+				++calls;
+			}
+			REQUIRE_EQ(res, FS_OK);
+			REQUIRE(calls > 1);
+			REQUIRE_EQ(fs->getCheckReport().files, report.files);
+			REQUIRE_EQ(fs->getCheckReport().usedBlocks, report.usedBlocks);
+			fs.reset();
+
+			// Wipe commits from both blocks of the pair holding the file name, leaving the revision count
+			std::vector<uint8_t> block(blockSize);
+			std::vector<uint8_t> zeros(blockSize - 4);
+			unsigned corrupted{0};
+			for(unsigned b = 2; b < flashSize / blockSize; ++b) {
+				REQUIRE(flash.read(b * blockSize, block.data(), blockSize));
+				if(std::search(block.begin(), block.end(), needle, needle + strlen(needle)) == block.end()) {
+					continue;
+				}
+				REQUIRE(flash.write(b * blockSize + 4, zeros.data(), zeros.size()));
+				++corrupted;
+			}
+			REQUIRE(corrupted != 0);
+
+			LittleFS::Config config;
+			config.formatOnFail = false;
+			fs.reset(new LittleFS::FileSystem(partition, config));
+			REQUIRE(fs->mount() < 0);
+			REQUIRE_EQ(fs->check(), int(Error::BadFileSystem));
+			REQUIRE(fs->getCheckReport().corruptPairs != 0);
+		}
+
+		TEST_CASE("Idle-time housekeeping")
+		{
+			using namespace IFS;
+			// Volume is identical on each pass, so only gc() affects the write
+			uint64_t writeTime[2];
+			for(unsigned i = 0; i < 2; ++i) {
+				remount({}, true);
+				writeFile("a", makeContent(blockSize));
+				remount();
+				if(i != 0) {
+					// Allocator is empty following mount
+					REQUIRE_EQ(fs->gc(0), 1);
+					REQUIRE_EQ(fs->gc(1), 0);
+					REQUIRE_EQ(fs->gc(1), 0);
+				}
+				auto elapsed = flash.getElapsedNs();
+				writeFile("b", makeContent(blockSize));
+				writeTime[i] = flash.getElapsedNs() - elapsed;
+			}
+			REQUIRE(writeTime[1] < writeTime[0]);
+
+			// Write-behind files are committed once their time limit expires
+			auto file = fs->open("log", File::CreateNewAlways | File::WriteOnly);
+			REQUIRE(file >= 0);
+			REQUIRE_EQ(fs->setWriteBehind(file, 1024, 10), FS_OK);
+			auto writeCount = flash.getWriteCount();
+			REQUIRE_EQ(fs->write(file, "record", 6), 6);
+			REQUIRE_EQ(fs->flush(file), FS_OK);
+			REQUIRE_EQ(flash.getWriteCount(), writeCount);
+			OneShotFastMs timer;
+			timer.reset(15);
+			while(!timer.expired()) {
+			}
+			REQUIRE_EQ(fs->gc(0), 1);
+			REQUIRE_EQ(flash.getWriteCount(), writeCount);
+			int res;
+			while((res = fs->gc(1)) > 0) {
+			}
+			REQUIRE_EQ(res, FS_OK);
+			REQUIRE(flash.getWriteCount() != writeCount);
+			REQUIRE_EQ(fs->close(file), FS_OK);
+			REQUIRE_EQ(readFile("log"), "record");
+		}
+
+		TEST_CASE("Used block count")
+		{
+			using namespace IFS;
+			remount({}, true);
+			auto initial = fs->getUsedBlockCount(true);
+			REQUIRE(initial >= 2);
+
+			// Cached value needs no device access
+			auto elapsed = flash.getElapsedNs();
+			REQUIRE_EQ(fs->getUsedBlockCount(false), initial);
+			IFS::FileSystem::Info info;
+			REQUIRE_EQ(fs->getinfo(info), FS_OK);
+			REQUIRE_EQ(flash.getElapsedNs(), elapsed);
+			REQUIRE_EQ(info.freeSpace, (flashSize / blockSize - initial) * blockSize);
+
+			// Allocations are counted, five blocks including CTZ pointers
+			writeFile("big", makeContent(4 * blockSize));
+			auto cached = fs->getUsedBlockCount(false);
+			REQUIRE(cached >= initial + 5);
+			auto exact = fs->getUsedBlockCount(true);
+			REQUIRE(exact >= initial + 5);
+			REQUIRE(exact <= cached);
+
+			// Freed blocks aren't seen until a traversal
+			REQUIRE_EQ(fs->remove("big"), FS_OK);
+			REQUIRE(fs->getUsedBlockCount(false) >= exact);
+			int res;
+			while((res = fs->gc(1)) > 0) {
+			}
+			REQUIRE_EQ(res, FS_OK);
+			cached = fs->getUsedBlockCount(false);
+			REQUIRE(cached < exact);
+			REQUIRE_EQ(fs->getUsedBlockCount(true), cached);
+		}
+
+		TEST_CASE("Saved allocator state")
+		{
+			using namespace IFS;
+			remount({}, true);
+			writeFile("a", makeContent(2 * blockSize));
+			writeFile("b", "small");
+			REQUIRE_EQ(fs->saveAllocState(), FS_OK);
+			auto used = fs->getUsedBlockCount(true);
+
+			// Next mount loads the map so the count needs no traversal
+			remount();
+			auto elapsed = flash.getElapsedNs();
+			REQUIRE_EQ(fs->getUsedBlockCount(false), used);
+			REQUIRE_EQ(flash.getElapsedNs(), elapsed);
+			REQUIRE_EQ(readFile("a"), makeContent(2 * blockSize));
+
+			// State is held in a root attribute which applications can't see
+			char buffer[32];
+			auto stateTag = AttributeTag(LittleFS::LFS_ATTR_ALLOC_STATE);
+			REQUIRE_EQ(fs->getxattr(nullptr, stateTag, buffer, sizeof(buffer)), int(Error::BadParam));
+			auto root = fs->open(nullptr, File::ReadOnly);
+			REQUIRE(root >= 0);
+			unsigned privateCount{0};
+			REQUIRE(fs->fenumxattr(
+						root,
+						[&](AttributeEnum& e) {
+							privateCount += (unsigned(e.tag) >= LittleFS::LFS_ATTR_PRIVATE_MIN);
+							return true;
+						},
+						buffer, sizeof(buffer)) >= 0);
+			REQUIRE_EQ(fs->close(root), FS_OK);
+			REQUIRE_EQ(privateCount, 0U);
+			REQUIRE_EQ(fs->getUsedBlockCount(false), used);
+
+			// First modification discards the saved state
+			writeFile("c", makeContent(blockSize));
+			REQUIRE_EQ(readFile("c"), makeContent(blockSize));
+			remount();
+			elapsed = flash.getElapsedNs();
+			used = fs->getUsedBlockCount(false);
+			REQUIRE(flash.getElapsedNs() != elapsed);
+			REQUIRE_EQ(fs->getUsedBlockCount(true), used);
+			REQUIRE_EQ(fs->check(), FS_OK);
+		}
+
+#if LFS_ENABLE_LOCKING
+		TEST_CASE("Concurrent access")
+		{
+			using namespace IFS;
+			remount({}, true);
+			constexpr unsigned threadCount{4};
+			constexpr unsigned filesPerThread{3};
+			std::atomic<unsigned> failures{0};
+
+			// Assertions can't be made from other threads so count failures instead
+			auto worker = [&](unsigned id) {
+				auto content = makeContent(500 + id * 300);
+				char path[16];
+				for(unsigned i = 0; i < 5 * filesPerThread; ++i) {
+					m_snprintf(path, sizeof(path), "t%u-%u", id, i % filesPerThread);
+					auto file = fs->open(path, File::CreateNewAlways | File::WriteOnly);
+					if(file < 0) {
+						++failures;
+						continue;
+					}
+					if(fs->write(file, content.c_str(), content.length()) != int(content.length())) {
+						++failures;
+					}
+					if(fs->close(file) != FS_OK) {
+						++failures;
+					}
+					Stat stat;
+					if(fs->stat(path, &stat) != FS_OK || stat.size != content.length()) {
+						++failures;
+					}
+				}
+			};
+
+			std::vector<std::thread> threads;
+			for(unsigned id = 0; id < threadCount; ++id) {
+				threads.emplace_back(worker, id);
+			}
+			for(auto& thread : threads) {
+				thread.join();
+			}
+			REQUIRE_EQ(failures.load(), 0U);
+
+			char path[16];
+			for(unsigned id = 0; id < threadCount; ++id) {
+				for(unsigned i = 0; i < filesPerThread; ++i) {
+					m_snprintf(path, sizeof(path), "t%u-%u", id, i);
+					REQUIRE_EQ(readFile(path), makeContent(500 + id * 300));
+				}
+			}
+			REQUIRE_EQ(fs->check(), FS_OK);
+		}
+#endif
+
+		TEST_CASE("Reproducible images")
+		{
+			using namespace IFS;
+			remount({}, true);
+			populate();
+
+			// fscopy builds images in RAM, or directly to a file with `direct=1`: both must be identical
+			auto& hostfs = Host::getFileSystem();
+			auto file = hostfs.open("basic.bin", File::CreateNewAlways | File::ReadWrite);
+			REQUIRE(file >= 0);
+			{
+				Storage::FileDevice fileDevice("FILE", hostfs, file, flashSize);
+				REQUIRE(fileDevice.erase_range(0, flashSize));
+				SimFlash ramDevice("RAM", flashSize);
+				Storage::Device* devices[]{&fileDevice, &ramDevice};
+
+				// Modification times are recorded, so both builds must happen within the same second
+				auto time = fsGetTimeUTC();
+				while(fsGetTimeUTC() == time) {
+				}
+				for(auto device : devices) {
+					auto part = device->editablePartitions().add("dst", Storage::Partition::SubType::Data::littlefs,
+																 0, flashSize);
+					LittleFS::FileSystem dstfs(part);
+					REQUIRE_EQ(dstfs.format(), FS_OK);
+					REQUIRE_EQ(dstfs.mount(), FS_OK);
+					FileCopier copier(*fs, dstfs);
+					REQUIRE(copier.copyDir(nullptr, nullptr));
+				}
+
+				std::vector<uint8_t> block1(blockSize);
+				std::vector<uint8_t> block2(blockSize);
+				for(size_t offset = 0; offset < flashSize; offset += blockSize) {
+					REQUIRE(fileDevice.read(offset, block1.data(), blockSize));
+					REQUIRE(ramDevice.read(offset, block2.data(), blockSize));
+					REQUIRE(block1 == block2);
+				}
+			}
+			REQUIRE_EQ(hostfs.remove("basic.bin"), FS_OK);
+		}
+
+		TEST_CASE("Incremental image update")
+		{
+			using namespace IFS;
+			remount({}, true);
+			populate();
+			auto before = getExtents("dir/a");
+			std::vector<uint8_t> image(flashSize);
+			REQUIRE(flash.read(0, image.data(), flashSize));
+
+			// As for fscopy `update=1`, existing image is modified in place
+			LittleFS::Config config;
+			config.formatOnFail = false;
+			remount(config);
+			REQUIRE_EQ(fs->remove("dir/b"), FS_OK);
+			writeFile("d", "changed");
+			writeFile("e", "new");
+
+			// Data of unchanged files stays where it was
+			auto after = getExtents("dir/a");
+			REQUIRE_EQ(after.size(), before.size());
+			std::vector<uint8_t> data;
+			for(unsigned i = 0; i < after.size(); ++i) {
+				REQUIRE_EQ(after[i].offset, before[i].offset);
+				REQUIRE_EQ(after[i].length, before[i].length);
+				data.resize(after[i].length);
+				REQUIRE(flash.read(after[i].offset, data.data(), data.size()));
+				REQUIRE(memcmp(data.data(), &image[before[i].offset], data.size()) == 0);
+			}
+			REQUIRE_EQ(readFile("dir/a"), makeContent(3 * blockSize));
+			REQUIRE_EQ(readFile("c"), makeContent(blockSize + 100));
+			REQUIRE_EQ(readFile("d"), "changed");
+			REQUIRE_EQ(readFile("e"), "new");
+			Stat stat;
+			REQUIRE(fs->stat("dir/b", &stat) < 0);
+			REQUIRE_EQ(fs->check(), FS_OK);
+		}
+
+		TEST_CASE("Delta update")
+		{
+			using namespace IFS;
+			remount({}, true);
+			populate();
+			fs.reset();
+			std::vector<uint8_t> base(flashSize);
+			REQUIRE(flash.read(0, base.data(), flashSize));
+			remount();
+			REQUIRE_EQ(fs->remove("dir/b"), FS_OK);
+			writeFile("d", "changed");
+			writeFile("e", makeContent(2 * blockSize));
+			fs.reset();
+			std::vector<uint8_t> target(flashSize);
+			REQUIRE(flash.read(0, target.data(), flashSize));
+
+			// Partition must hold the base image, and nothing is written if it doesn't
+			remount();
+			auto writeCount = flash.getWriteCount();
+			{
+				MemoryDataStream delta;
+				makeDelta(delta, base, target);
+				REQUIRE_EQ(fs->applyDelta(delta), int(Error::BadFileSystem));
+			}
+			REQUIRE_EQ(flash.getWriteCount(), writeCount);
+			REQUIRE_EQ(readFile("d"), "changed");
+
+			// Restore base image
+			fs.reset();
+			REQUIRE(flash.erase_range(0, flashSize));
+			REQUIRE(flash.write(0, base.data(), flashSize));
+			remount();
+			writeCount = flash.getWriteCount();
+
+			// Files must be closed
+			auto file = fs->open("d", File::ReadOnly);
+			REQUIRE(file >= 0);
+			{
+				MemoryDataStream delta;
+				makeDelta(delta, base, target);
+				REQUIRE_EQ(fs->applyDelta(delta), int(Error::Denied));
+			}
+			REQUIRE_EQ(fs->close(file), FS_OK);
+
+			// Header is validated
+			{
+				LittleFS::Delta::Header header{};
+				MemoryDataStream delta;
+				delta.write(reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+				REQUIRE_EQ(fs->applyDelta(delta), int(Error::BadParam));
+			}
+			REQUIRE_EQ(flash.getWriteCount(), writeCount);
+
+			{
+				MemoryDataStream delta;
+				makeDelta(delta, base, target);
+				REQUIRE_EQ(fs->applyDelta(delta), FS_OK);
+			}
+			std::vector<uint8_t> image(flashSize);
+			REQUIRE(flash.read(0, image.data(), flashSize));
+			REQUIRE(image == target);
+
+			// Volume is re-mounted with new content
+			REQUIRE_EQ(readFile("d"), "changed");
+			REQUIRE_EQ(readFile("e"), makeContent(2 * blockSize));
+			Stat stat;
+			REQUIRE(fs->stat("dir/b", &stat) < 0);
+			REQUIRE_EQ(fs->check(), FS_OK);
+		}
+
+		TEST_CASE("Batched directory reads")
+		{
+			using namespace IFS;
+			remount({}, true);
+			REQUIRE_EQ(fs->mkdir("list"), FS_OK);
+			REQUIRE_EQ(fs->mkdir("list/sub"), FS_OK);
+			char path[16];
+			for(unsigned i = 0; i < 20; ++i) {
+				m_snprintf(path, sizeof(path), "list/f%u", i);
+				writeFile(path, makeContent(i * 10));
+			}
+
+			// Reference listing
+			struct Entry {
+				String name;
+				file_size_t size;
+				bool isDir;
+				TimeStamp mtime;
+			};
+			std::vector<Entry> entries;
+			DirHandle dir;
+			REQUIRE_EQ(fs->opendir("list", dir), FS_OK);
+			NameStat stat;
+			while(fs->readdir(dir, stat) == FS_OK) {
+				entries.push_back({String(stat.name), stat.size, stat.isDir(), stat.mtime});
+			}
+			REQUIRE_EQ(fs->closedir(dir), FS_OK);
+			REQUIRE_EQ(entries.size(), 21U);
+
+			// Each entry needs its own name buffer
+			constexpr unsigned batchSize{8};
+			Stat list[batchSize];
+			char nameBuffers[batchSize][16];
+			for(unsigned i = 0; i < batchSize; ++i) {
+				list[i].name = NameBuffer(nameBuffers[i], sizeof(nameBuffers[i]));
+			}
+
+			for(bool withAttributes : {true, false}) {
+				REQUIRE_EQ(fs->opendir("list", dir), FS_OK);
+				unsigned count{0};
+				int n;
+				while((n = fs->readdirBatch(dir, list, batchSize, withAttributes)) > 0) {
+					REQUIRE(n <= int(batchSize));
+					for(int i = 0; i < n; ++i, ++count) {
+						REQUIRE(count < entries.size());
+						auto& entry = entries[count];
+						REQUIRE_EQ(String(list[i].name), entry.name);
+						REQUIRE_EQ(list[i].size, entry.size);
+						REQUIRE_EQ(list[i].isDir(), entry.isDir);
+						// Timestamps are attributes
+						REQUIRE(list[i].mtime == (withAttributes ? entry.mtime : TimeStamp{}));
+					}
+				}
+				REQUIRE_EQ(n, 0);
+				REQUIRE_EQ(count, entries.size());
+				REQUIRE_EQ(fs->closedir(dir), FS_OK);
+			}
+
+			// Batches continue from the current position
+			REQUIRE_EQ(fs->opendir("list", dir), FS_OK);
+			REQUIRE_EQ(fs->readdir(dir, stat), FS_OK);
+			REQUIRE_EQ(fs->readdirBatch(dir, list, 3), 3);
+			for(unsigned i = 0; i < 3; ++i) {
+				REQUIRE_EQ(String(list[i].name), entries[i + 1].name);
+			}
+			REQUIRE_EQ(fs->closedir(dir), FS_OK);
+		}
+
+		TEST_CASE("Directory trees")
+		{
+			using namespace IFS;
+			remount({}, true);
+			for(auto dir : {"tree", "tree/a", "tree/a/b", "tree/c"}) {
+				REQUIRE_EQ(fs->mkdir(dir), FS_OK);
+			}
+			writeFile("tree/f1", "0123456789");
+			writeFile("tree/a/f2", makeContent(3 * 4096));
+			writeFile("tree/a/b/f3", "0123456789012345678");
+			writeFile("tree/c/f4", "");
+			writeFile("keep", "content");
+
+			LittleFS::DirUsage usage;
+			REQUIRE_EQ(fs->dirUsage("tree", usage), FS_OK);
+			CHECK_EQ(usage.files, 4U);
+			CHECK_EQ(usage.directories, 3U);
+			CHECK_EQ(usage.size, 10U + 3 * 4096 + 19);
+			// Two blocks for each directory plus a CTZ list of 4 blocks for `f2`
+			CHECK_EQ(usage.blocks, 4U * 2 + 4);
+
+			REQUIRE_EQ(fs->dirUsage("tree/a/b", usage), FS_OK);
+			CHECK_EQ(usage.files, 1U);
+			CHECK_EQ(usage.directories, 0U);
+			CHECK_EQ(usage.size, 19U);
+
+			// Nothing is removed from a read-only directory
+			FileAttributes attr{};
+			attr += FileAttribute::ReadOnly;
+			REQUIRE_EQ(fs->setxattr("tree", AttributeTag::FileAttributes, &attr, sizeof(attr)), FS_OK);
+			REQUIRE_EQ(fs->removeTree("tree"), int(Error::ReadOnly));
+			REQUIRE_EQ(fs->dirUsage("tree", usage), FS_OK);
+			CHECK_EQ(usage.files, 4U);
+			attr -= FileAttribute::ReadOnly;
+			REQUIRE_EQ(fs->setxattr("tree", AttributeTag::FileAttributes, &attr, sizeof(attr)), FS_OK);
+
+			// Removal stops at a read-only entry
+			attr += FileAttribute::ReadOnly;
+			REQUIRE_EQ(fs->setxattr("tree/c/f4", AttributeTag::FileAttributes, &attr, sizeof(attr)), FS_OK);
+			REQUIRE_EQ(fs->removeTree("tree"), int(Error::ReadOnly));
+			Stat stat;
+			REQUIRE_EQ(fs->stat("tree/c/f4", &stat), FS_OK);
+			REQUIRE_EQ(fs->dirUsage("tree", usage), FS_OK);
+			CHECK(usage.files < 4);
+
+			attr -= FileAttribute::ReadOnly;
+			REQUIRE_EQ(fs->setxattr("tree/c/f4", AttributeTag::FileAttributes, &attr, sizeof(attr)), FS_OK);
+			auto usedBlocks = fs->getUsedBlockCount(true);
+			REQUIRE_EQ(fs->removeTree("/tree"), FS_OK);
+			REQUIRE(fs->stat("tree", &stat) < 0);
+			REQUIRE_EQ(readFile("keep"), "content");
+			REQUIRE(fs->getUsedBlockCount(true) < usedBlocks);
+
+			// A file is simply removed
+			REQUIRE_EQ(fs->removeTree("keep"), FS_OK);
+			REQUIRE(fs->stat("keep", &stat) < 0);
+			REQUIRE_EQ(fs->check(), FS_OK);
+		}
+
+		TEST_CASE("Open file paths")
+		{
+			using namespace IFS;
+			remount({}, true);
+			REQUIRE_EQ(fs->mkdir("dir"), FS_OK);
+			REQUIRE_EQ(fs->mkdir("dir/sub"), FS_OK);
+			writeFile("dir/sub/file", "content");
+			writeFile("dirfile", "content");
+
+			auto file = fs->open("/dir/sub/file", File::ReadWrite);
+			REQUIRE(file >= 0);
+			auto other = fs->open("dirfile", File::ReadOnly);
+			REQUIRE(other >= 0);
+			String path;
+			REQUIRE_EQ(fs->getFilePath(file, path), FS_OK);
+			REQUIRE_EQ(path, "dir/sub/file");
+
+			// Renaming a parent directory affects only the files within it
+			REQUIRE_EQ(fs->rename("dir", "renamed"), FS_OK);
+			REQUIRE_EQ(fs->getFilePath(file, path), FS_OK);
+			REQUIRE_EQ(path, "renamed/sub/file");
+			REQUIRE_EQ(fs->getFilePath(other, path), FS_OK);
+			REQUIRE_EQ(path, "dirfile");
+			REQUIRE_EQ(fs->rename("/renamed/sub/file", "renamed/file2"), FS_OK);
+			REQUIRE_EQ(fs->getFilePath(file, path), FS_OK);
+			REQUIRE_EQ(path, "renamed/file2");
+			Stat stat;
+			REQUIRE_EQ(fs->fstat(file, &stat), FS_OK);
+			REQUIRE_EQ(String(stat.name), "file2");
+
+			// Read-only files cannot be removed, and handle remains usable
+			FileAttributes attr{};
+			attr += FileAttribute::ReadOnly;
+			REQUIRE_EQ(fs->setxattr("dirfile", AttributeTag::FileAttributes, &attr, sizeof(attr)), FS_OK);
+			REQUIRE_EQ(fs->fremove(other), int(Error::ReadOnly));
+			char buffer[16];
+			REQUIRE_EQ(fs->read(other, buffer, sizeof(buffer)), 7);
+			REQUIRE_EQ(fs->close(other), FS_OK);
+
+			// Removal discards unwritten data and leaves handle awaiting close
+			REQUIRE_EQ(fs->write(file, "more", 4), 4);
+			REQUIRE_EQ(fs->fremove(file), FS_OK);
+			REQUIRE_EQ(fs->read(file, buffer, sizeof(buffer)), int(Error::FileNotOpen));
+			REQUIRE_EQ(fs->fremove(file), int(Error::FileNotOpen));
+			REQUIRE_EQ(fs->close(file), FS_OK);
+			REQUIRE(fs->stat("renamed/file2", &stat) < 0);
+			REQUIRE_EQ(fs->check(), FS_OK);
+		}
+
+		TEST_CASE("Wear state size limit")
+		{
+			// 512 blocks need more than the maximum attribute size
+			SimFlash bigFlash("BIG", 2 * 1024 * 1024);
+			auto part = bigFlash.editablePartitions().add("big", Storage::Partition::SubType::Data::littlefs, 0,
+														  bigFlash.getSize());
+			IFS::LittleFS::Config config;
+			config.trackWear = true;
+			IFS::LittleFS::FileSystem bigfs(part, config);
+			REQUIRE_EQ(bigfs.format(), FS_OK);
+			REQUIRE_EQ(bigfs.mount(), FS_OK);
+			REQUIRE_EQ(bigfs.saveWearState(), int(IFS::Error::TooBig));
+			// Counts are still available
+			IFS::LittleFS::WearStats stats;
+			REQUIRE_EQ(bigfs.getWearStats(stats), FS_OK);
+			REQUIRE_EQ(stats.blockCount, 512U);
+			REQUIRE_EQ(stats.totalErases, bigFlash.getTotalEraseCount());
+		}
+
+		fs.reset();
+	}
+
+private:
+	/*
+	 * Create a new filesystem instance, optionally formatting the volume
+	 */
+	void remount(const IFS::LittleFS::Config& config = {}, bool format = false)
+	{
+		fs.reset();
+		fs.reset(new IFS::LittleFS::FileSystem(partition, config));
+		if(format) {
+			REQUIRE_EQ(fs->format(), FS_OK);
+		}
+		REQUIRE_EQ(fs->mount(), FS_OK);
+	}
+
+	void writeFile(const char* path, const String& content)
+	{
+		auto file = fs->open(path, File::CreateNewAlways | File::WriteOnly);
+		REQUIRE(file >= 0);
+		REQUIRE_EQ(fs->write(file, content.c_str(), content.length()), int(content.length()));
+		REQUIRE_EQ(fs->close(file), FS_OK);
+	}
+
+	static String makeContent(size_t size)
+	{
+		String s;
+		s.setLength(size);
+		for(size_t i = 0; i < size; ++i) {
+			s[i] = 'A' + (i % 26);
+		}
+		return s;
 	}
+
+	String readFile(const char* path)
+	{
+		auto file = fs->open(path, File::ReadOnly);
+		if(file < 0) {
+			return nullptr;
+		}
+		String s;
+		char buffer[256];
+		int len;
+		while((len = fs->read(file, buffer, sizeof(buffer))) > 0) {
+			s.concat(buffer, len);
+		}
+		fs->close(file);
+		return s;
+	}
+
+	/*
+	 * Create a delta between two images, as `fscopy diff` does
+	 */
+	static void makeDelta(MemoryDataStream& stream, const std::vector<uint8_t>& base, const std::vector<uint8_t>& target)
+	{
+		namespace Delta = IFS::LittleFS::Delta;
+		Delta::Header header{};
+		header.magic = Delta::magic;
+		header.blockSize = blockSize;
+		header.blockCount = target.size() / blockSize;
+		header.baseCrc = Delta::crc(0xffffffff, base.data(), base.size());
+		header.targetCrc = Delta::crc(0xffffffff, target.data(), target.size());
+		for(uint32_t block = 0; block < header.blockCount; ++block) {
+			if(memcmp(&base[block * blockSize], &target[block * blockSize], blockSize) != 0) {
+				++header.recordCount;
+			}
+		}
+		header.headerCrc = Delta::crc(0xffffffff, &header, offsetof(Delta::Header, headerCrc));
+		stream.write(reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+		for(uint32_t block = 0; block < header.blockCount; ++block) {
+			auto data = &target[block * blockSize];
+			if(memcmp(&base[block * blockSize], data, blockSize) != 0) {
+				stream.write(reinterpret_cast<const uint8_t*>(&block), sizeof(block));
+				stream.write(data, blockSize);
+			}
+		}
+	}
+
+	/*
+	 * Create a small tree of files, as might be used to build an image
+	 */
+	void populate()
+	{
+		REQUIRE_EQ(fs->mkdir("dir"), FS_OK);
+		writeFile("dir/a", makeContent(3 * blockSize));
+		writeFile("dir/b", "small");
+		writeFile("c", makeContent(blockSize + 100));
+		writeFile("d", "content");
+	}
+
+	/*
+	 * Read a file sequentially using the given chunk size
+	 */
+	String readChunked(const char* path, size_t chunkSize)
+	{
+		auto file = fs->open(path, File::ReadOnly);
+		REQUIRE(file >= 0);
+		std::vector<char> buffer(chunkSize);
+		String s;
+		int len;
+		while((len = fs->read(file, buffer.data(), chunkSize)) > 0) {
+			s.concat(buffer.data(), len);
+		}
+		REQUIRE_EQ(len, 0);
+		REQUIRE_EQ(fs->close(file), FS_OK);
+		return s;
+	}
+
+	/*
+	 * Get extents for a file, which must have content
+	 */
+	std::vector<IFS::Extent> getExtents(const char* path)
+	{
+		auto file = fs->open(path, File::ReadOnly);
+		REQUIRE(file >= 0);
+		int count = fs->fgetextents(file, nullptr, nullptr, 0);
+		REQUIRE(count > 0);
+		std::vector<IFS::Extent> list(count);
+		REQUIRE_EQ(fs->fgetextents(file, nullptr, list.data(), count), count);
+		REQUIRE_EQ(fs->close(file), FS_OK);
+		return list;
+	}
+
+	/*
+	 * Verify the extents reported for a file contain exactly its content, in order
+	 * @retval int Number of extents
+	 */
+	int checkExtents(const char* path, const String& content)
+	{
+		auto list = getExtents(path);
+		String data;
+		for(auto& ext : list) {
+			String s;
+			REQUIRE(s.setLength(ext.length));
+			REQUIRE(partition.read(ext.offset, s.begin(), ext.length));
+			data += s;
+		}
+		REQUIRE_EQ(data, content);
+		return list.size();
+	}
+
+	SimFlash flash;
+	Storage::Partition partition;
+	std::unique_ptr<IFS::LittleFS::FileSystem> fs;
 };
 
 void REGISTER_TEST(basic)
 {
+	// Flash is emulated in RAM
+#ifdef ARCH_HOST
 	registerGroup<BasicTest>();
+#endif
 }
@@ -0,0 +1,319 @@
+#include "report.h"
+#include "SimFlash.h"
+#include <SmingTest.h>
+#include <Storage/FileDevice.h>
+#include <LittleFS.h>
+#include <LittleFS/FileSystem.h>
+#include <algorithm>
+#include <vector>
+
+/*
+ * Performance benchmarks, results are output via `benchReport()`
+ */
+namespace
+{
+#ifdef ARCH_HOST
+constexpr size_t hostDeviceSize{1024 * 1024};
+#endif
+constexpr size_t seqFileSize{64 * 1024};
+constexpr size_t smallFileCount{100};
+constexpr size_t dirEntryCount{1000};
+constexpr size_t logRecordCount{1000};
+constexpr size_t logRecordSize{64};
+constexpr size_t fillFileSize{16 * 1024};
+
+// Kilobytes per second for a given number of bytes in microseconds
+uint32_t kbps(size_t bytes, uint32_t elapsed)
+{
+	return elapsed ? (uint64_t(bytes) * 1000000ULL / 1024) / elapsed : 0;
+}
+
+// Operations per second
+uint32_t opsPerSec(size_t count, uint32_t elapsed)
+{
+	return elapsed ? uint64_t(count) * 1000000ULL / elapsed : 0;
+}
+
+} // namespace
+
+class BenchmarkTest : public TestGroup
+{
+public:
+	BenchmarkTest() : TestGroup(_F("Benchmark"))
+	{
+	}
+
+	void execute() override
+	{
+		REQUIRE(openPartition());
+
+		TEST_CASE("Sequential read/write")
+		{
+			remount(true);
+			const size_t chunkSizes[]{16, 256, 4096};
+			for(auto chunkSize : chunkSizes) {
+				sequential(chunkSize);
+			}
+		}
+
+		TEST_CASE("Small files")
+		{
+			remount(true);
+			smallFiles();
+		}
+
+		TEST_CASE("Directory listing")
+		{
+			remount(true);
+			directoryListing();
+		}
+
+		TEST_CASE("Append log")
+		{
+			remount(true);
+			appendLog();
+		}
+
+		TEST_CASE("Mount time")
+		{
+			remount(true);
+			mountTime();
+		}
+
+		fs.reset();
+	}
+
+private:
+	bool openPartition()
+	{
+#ifdef ARCH_HOST
+#if BENCHMARK_SIMFLASH
+		simFlash = new SimFlash("BENCH", hostDeviceSize);
+		device.reset(simFlash);
+#else
+		auto& hostfs = IFS::Host::getFileSystem();
+		auto file = hostfs.open("benchmark.bin", File::CreateNewAlways | File::ReadWrite);
+		if(file < 0) {
+			return false;
+		}
+		device.reset(new Storage::FileDevice("BENCH", hostfs, file, hostDeviceSize));
+		device->erase_range(0, hostDeviceSize);
+#endif
+		partition =
+			device->editablePartitions().add("bench", Storage::Partition::SubType::Data::littlefs, 0, hostDeviceSize);
+#else
+		partition = Storage::findDefaultPartition(Storage::Partition::SubType::Data::littlefs);
+#endif
+		return bool(partition);
+	}
+
+	/*
+	 * Current time in microseconds, including time spent by the simulated flash device
+	 */
+	uint32_t now() const
+	{
+		auto time = micros();
+#if defined(ARCH_HOST) && BENCHMARK_SIMFLASH
+		time += simFlash->getElapsedNs() / 1000;
+#endif
+		return time;
+	}
+
+	/*
+	 * Create a new filesystem instance, optionally formatting the volume
+	 * @retval uint32_t Time taken to mount in microseconds
+	 */
+	uint32_t remount(bool format)
+	{
+		fs.reset();
+		fs.reset(new IFS::LittleFS::FileSystem(partition));
+		if(format) {
+			REQUIRE(fs->format() == FS_OK);
+		}
+		auto start = now();
+		REQUIRE(fs->mount() == FS_OK);
+		auto elapsed = now() - start;
+		fs->attachProfiler(&profiler);
+		profiler.reset();
+		return elapsed;
+	}
+
+	uint32_t writeFile(const char* name, size_t size, size_t chunkSize)
+	{
+		std::unique_ptr<uint8_t[]> buffer(new uint8_t[chunkSize]);
+		os_get_random(buffer.get(), chunkSize);
+		auto start = now();
+		auto file = fs->open(name, File::CreateNewAlways | File::WriteOnly);
+		REQUIRE(file >= 0);
+		for(size_t pos = 0; pos < size; pos += chunkSize) {
+			REQUIRE(fs->write(file, buffer.get(), chunkSize) == int(chunkSize));
+		}
+		REQUIRE(fs->close(file) == FS_OK);
+		return now() - start;
+	}
+
+	void sequential(size_t chunkSize)
+	{
+		String param(chunkSize);
+
+		profiler.reset();
+		auto elapsed = writeFile("seq.bin", seqFileSize, chunkSize);
+		benchReport(F("seqwrite"), param, kbps(seqFileSize, elapsed), F("KB/s"));
+
+		// Erases per MB written
+		auto& erase = profiler.getDeviceStats(IFS::LittleFS::Profiler::Device::erase);
+		benchReport(F("erasepermb"), param, uint64_t(erase.count) * 1024 * 1024 / seqFileSize, F("erases"));
+
+		std::unique_ptr<uint8_t[]> buffer(new uint8_t[chunkSize]);
+		auto start = now();
+		auto file = fs->open("seq.bin", File::ReadOnly);
+		REQUIRE(file >= 0);
+		for(size_t pos = 0; pos < seqFileSize; pos += chunkSize) {
+			REQUIRE(fs->read(file, buffer.get(), chunkSize) == int(chunkSize));
+		}
+		fs->close(file);
+		elapsed = now() - start;
+		benchReport(F("seqread"), param, kbps(seqFileSize, elapsed), F("KB/s"));
+
+		REQUIRE(fs->remove("seq.bin") == FS_OK);
+	}
+
+	void smallFiles()
+	{
+		char name[16];
+		uint8_t data[32];
+		os_get_random(data, sizeof(data));
+		auto start = now();
+		for(unsigned i = 0; i < smallFileCount; ++i) {
+			m_snprintf(name, sizeof(name), "f%u", i);
+			auto file = fs->open(name, File::CreateNewAlways | File::WriteOnly);
+			REQUIRE(file >= 0);
+			REQUIRE(fs->write(file, data, sizeof(data)) == int(sizeof(data)));
+			fs->close(file);
+		}
+		benchReport(F("smallfile"), F("create"), opsPerSec(smallFileCount, now() - start), F("ops/s"));
+
+		start = now();
+		for(unsigned i = 0; i < smallFileCount; ++i) {
+			m_snprintf(name, sizeof(name), "f%u", i);
+			IFS::Stat stat;
+			REQUIRE(fs->stat(name, &stat) == FS_OK);
+		}
+		benchReport(F("smallfile"), F("stat"), opsPerSec(smallFileCount, now() - start), F("ops/s"));
+
+		start = now();
+		for(unsigned i = 0; i < smallFileCount; ++i) {
+			m_snprintf(name, sizeof(name), "f%u", i);
+			REQUIRE(fs->remove(name) == FS_OK);
+		}
+		benchReport(F("smallfile"), F("remove"), opsPerSec(smallFileCount, now() - start), F("ops/s"));
+	}
+
+	void directoryListing()
+	{
+		REQUIRE(fs->mkdir("dir") == FS_OK);
+		char name[16];
+		for(unsigned i = 0; i < dirEntryCount; ++i) {
+			m_snprintf(name, sizeof(name), "dir/%u", i);
+			auto file = fs->open(name, File::CreateNewAlways | File::WriteOnly);
+			REQUIRE(file >= 0);
+			fs->close(file);
+		}
+
+		profiler.reset();
+		auto start = now();
+		IFS::DirHandle dir;
+		REQUIRE(fs->opendir("dir", dir) == FS_OK);
+		unsigned count{0};
+		IFS::NameStat stat;
+		while(fs->readdir(dir, stat) == FS_OK) {
+			++count;
+		}
+		fs->closedir(dir);
+		auto elapsed = now() - start;
+		REQUIRE_EQ(count, dirEntryCount);
+		benchReport(F("dirlist"), String(dirEntryCount), elapsed / 1000, F("ms"));
+		auto& read = profiler.getDeviceStats(IFS::LittleFS::Profiler::Device::read);
+		benchReport(F("dirlist"), F("bytesread"), read.bytes, F("bytes"));
+
+		// Batched, names and sizes only
+		profiler.reset();
+		start = now();
+		REQUIRE(fs->opendir("dir", dir) == FS_OK);
+		count = 0;
+		IFS::Stat list[8];
+		int n;
+		while((n = fs->readdirBatch(dir, list, ARRAY_SIZE(list), false)) > 0) {
+			count += n;
+		}
+		fs->closedir(dir);
+		elapsed = now() - start;
+		REQUIRE_EQ(count, dirEntryCount);
+		benchReport(F("dirlist"), F("batch"), elapsed / 1000, F("ms"));
+		benchReport(F("dirlist"), F("batchbytesread"), read.bytes, F("bytes"));
+	}
+
+	void appendLog()
+	{
+		std::vector<uint32_t> times(logRecordCount);
+		uint8_t record[logRecordSize];
+		os_get_random(record, sizeof(record));
+
+		auto file = fs->open("log.bin", File::CreateNewAlways | File::WriteOnly);
+		REQUIRE(file >= 0);
+		for(auto& t : times) {
+			auto start = now();
+			REQUIRE(fs->write(file, record, sizeof(record)) == int(sizeof(record)));
+			REQUIRE(fs->flush(file) == FS_OK);
+			t = now() - start;
+		}
+		fs->close(file);
+
+		std::sort(times.begin(), times.end());
+		auto percentile = [&](unsigned p) { return times[(times.size() - 1) * p / 100]; };
+		benchReport(F("appendlog"), F("p50"), percentile(50), F("us"));
+		benchReport(F("appendlog"), F("p90"), percentile(90), F("us"));
+		benchReport(F("appendlog"), F("p99"), percentile(99), F("us"));
+		benchReport(F("appendlog"), F("max"), times.back(), F("us"));
+	}
+
+	/*
+	 * Time to mount and perform first write, which requires a scan for free blocks
+	 */
+	void mountTime()
+	{
+		IFS::FileSystem::Info info;
+		REQUIRE(fs->getinfo(info) == FS_OK);
+		auto fillStep = info.volumeSize / 4;
+		size_t filled{0};
+		unsigned fileIndex{0};
+		char name[16];
+
+		for(unsigned level = 0; level < 4; ++level) {
+			while(filled + fillFileSize <= level * fillStep) {
+				m_snprintf(name, sizeof(name), "fill%u", fileIndex++);
+				writeFile(name, fillFileSize, 4096);
+				filled += fillFileSize;
+			}
+
+			String param(level * 25);
+			auto elapsed = remount(false);
+			benchReport(F("mount"), param, elapsed, F("us"));
+			elapsed = writeFile("first.bin", 16, 16);
+			benchReport(F("firstwrite"), param, elapsed, F("us"));
+		}
+	}
+
+#ifdef ARCH_HOST
+	std::unique_ptr<Storage::Device> device;
+	SimFlash* simFlash{nullptr}; ///< Owned by `device` if used
+#endif
+	Storage::Partition partition;
+	std::unique_ptr<IFS::LittleFS::FileSystem> fs;
+	IFS::LittleFS::Profiler profiler;
+};
+
+void REGISTER_TEST(benchmark)
+{
+	registerGroup<BenchmarkTest>();
+}
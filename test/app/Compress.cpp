@@ -0,0 +1,152 @@
+#include "report.h"
+#include "SimFlash.h"
+#include <SmingTest.h>
+#include <LittleFS.h>
+#include <LittleFS/FileSystem.h>
+
+/*
+ * Verify transparent compression gives back what was written, and report the space saved
+ */
+namespace
+{
+constexpr size_t flashSize{256 * 1024};
+constexpr size_t textSize{20000};
+
+// Repetitive content, typical of text assets
+String makeText(size_t size)
+{
+	String s;
+	for(unsigned i = 0; s.length() < size; ++i) {
+		s += F("<p class=\"item\">Item number ");
+		s += i;
+		s += F(" of the list</p>\n");
+	}
+	s.setLength(size);
+	return s;
+}
+
+} // namespace
+
+class CompressTest : public TestGroup
+{
+public:
+	CompressTest() : TestGroup(_F("Compression")), flash("SIM", flashSize)
+	{
+		partition = flash.editablePartitions().add("sim", Storage::Partition::SubType::Data::littlefs, 0, flashSize);
+	}
+
+	void execute() override
+	{
+		IFS::LittleFS::Config config;
+		config.compressNewFiles = true;
+		IFS::LittleFS::FileSystem fs(partition, config);
+		REQUIRE_EQ(fs.format(), FS_OK);
+		REQUIRE_EQ(fs.mount(), FS_OK);
+		String text = makeText(textSize);
+
+		TEST_CASE("Write and read")
+		{
+			// Odd-sized writes so chunks don't align with them
+			auto file = fs.open("text.html", File::CreateNewAlways | File::WriteOnly);
+			REQUIRE(file >= 0);
+			for(size_t pos = 0; pos < text.length(); pos += 777) {
+				auto n = std::min(size_t(777), text.length() - pos);
+				REQUIRE_EQ(fs.write(file, &text[pos], n), int(n));
+			}
+			REQUIRE_EQ(fs.close(file), FS_OK);
+
+			IFS::Stat stat;
+			REQUIRE_EQ(fs.stat("text.html", &stat), FS_OK);
+			REQUIRE_EQ(stat.size, file_size_t(textSize));
+			REQUIRE(readAll(fs, "text.html") == text);
+
+			IFS::FileSystem::Info info;
+			fs.getinfo(info);
+			benchReport(F("compress"), F("used"), info.used(), F("bytes"));
+		}
+
+		TEST_CASE("Random access")
+		{
+			auto file = fs.open("text.html", File::ReadOnly);
+			REQUIRE(file >= 0);
+			char buffer[100];
+			for(unsigned i = 0; i < 50; ++i) {
+				auto pos = os_random() % (textSize - sizeof(buffer));
+				REQUIRE_EQ(fs.lseek(file, pos, SeekOrigin::Start), int(pos));
+				REQUIRE_EQ(fs.read(file, buffer, sizeof(buffer)), int(sizeof(buffer)));
+				REQUIRE(memcmp(buffer, &text[pos], sizeof(buffer)) == 0);
+			}
+			fs.close(file);
+		}
+
+		TEST_CASE("Append")
+		{
+			auto file = fs.open("text.html", File::WriteOnly | File::Append);
+			REQUIRE(file >= 0);
+			REQUIRE_EQ(fs.write(file, text.c_str(), 1000), 1000);
+			fs.close(file);
+			REQUIRE(readAll(fs, "text.html") == text + text.substring(0, 1000));
+		}
+
+		TEST_CASE("Restrictions")
+		{
+			auto file = fs.open("text.html", File::ReadWrite);
+			REQUIRE(file >= 0);
+			fs.lseek(file, 0, SeekOrigin::Start);
+			REQUIRE_EQ(fs.write(file, "x", 1), int(IFS::Error::NotSupported));
+			REQUIRE_EQ(fs.ftruncate(file, 10), int(IFS::Error::NotSupported));
+			REQUIRE_EQ(fs.ftruncate(file, 0), FS_OK);
+			fs.close(file);
+			IFS::Stat stat;
+			REQUIRE_EQ(fs.stat("text.html", &stat), FS_OK);
+			REQUIRE_EQ(stat.size, file_size_t(0));
+		}
+
+		TEST_CASE("Incompressible content")
+		{
+			// Stored as-is so the data is directly accessible
+			uint8_t buffer[LFS_COMPRESS_CHUNK_SIZE * 2];
+			os_get_random(buffer, sizeof(buffer));
+			auto file = fs.open("random.bin", File::CreateNewAlways | File::ReadWrite);
+			REQUIRE(file >= 0);
+			REQUIRE_EQ(fs.write(file, buffer, sizeof(buffer)), int(sizeof(buffer)));
+			IFS::Extent extent;
+			REQUIRE(fs.fgetextents(file, nullptr, &extent, 1) > 0);
+			fs.close(file);
+			IFS::Stat stat;
+			REQUIRE_EQ(fs.stat("random.bin", &stat), FS_OK);
+			REQUIRE_EQ(stat.size, file_size_t(sizeof(buffer)));
+			REQUIRE(readAll(fs, "random.bin") == String(reinterpret_cast<const char*>(buffer), sizeof(buffer)));
+		}
+
+		REQUIRE_EQ(fs.check(), FS_OK);
+	}
+
+private:
+	String readAll(IFS::IFileSystem& fs, const char* name)
+	{
+		auto file = fs.open(name, File::ReadOnly);
+		if(file < 0) {
+			return nullptr;
+		}
+		String s;
+		char buffer[256];
+		int len;
+		while((len = fs.read(file, buffer, sizeof(buffer))) > 0) {
+			s.concat(buffer, len);
+		}
+		fs.close(file);
+		return s;
+	}
+
+	SimFlash flash;
+	Storage::Partition partition;
+};
+
+void REGISTER_TEST(compress)
+{
+	// Flash is emulated in RAM
+#ifdef ARCH_HOST
+	registerGroup<CompressTest>();
+#endif
+}
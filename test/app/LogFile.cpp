@@ -0,0 +1,186 @@
+#include "report.h"
+#include "SimFlash.h"
+#include <SmingTest.h>
+#include <LittleFS.h>
+#include <LittleFS/LogFile.h>
+
+/*
+ * Verify circular log retains the most recent records, and report append latency and wear
+ */
+namespace
+{
+constexpr size_t flashSize{256 * 1024};
+constexpr unsigned recordCount{2000};
+constexpr size_t recordSize{60};
+
+void makeRecord(uint8_t* record, uint32_t index)
+{
+	memset(record, index & 0xff, recordSize);
+	memcpy(record, &index, sizeof(index));
+}
+
+} // namespace
+
+class LogFileTest : public TestGroup
+{
+public:
+	LogFileTest() : TestGroup(_F("Log file")), flash("SIM", flashSize)
+	{
+		partition = flash.editablePartitions().add("sim", Storage::Partition::SubType::Data::littlefs, 0, flashSize);
+		logConfig.segmentSize = 4096;
+		logConfig.segmentCount = 4;
+	}
+
+	void execute() override
+	{
+		IFS::LittleFS::Config config;
+		config.trackWear = true;
+		IFS::LittleFS::FileSystem fs(partition, config);
+		REQUIRE_EQ(fs.format(), FS_OK);
+		REQUIRE_EQ(fs.mount(), FS_OK);
+
+		TEST_CASE("Append")
+		{
+			IFS::LittleFS::LogFile log(fs);
+			REQUIRE_EQ(log.open("log", logConfig), FS_OK);
+			uint8_t record[recordSize];
+			flash.resetElapsed();
+			for(unsigned i = 0; i < recordCount; ++i) {
+				makeRecord(record, i);
+				REQUIRE_EQ(log.append(record, sizeof(record)), FS_OK);
+			}
+			REQUIRE_EQ(log.close(), FS_OK);
+			benchReport(F("logfile"), F("append"), flash.getElapsedNs() / recordCount / 1000, F("us"));
+			benchReport(F("logfile"), F("maxerase"), flash.getMaxEraseCount(), F("erases"));
+
+			// Driver counts must match those seen by the device
+			IFS::LittleFS::WearStats stats;
+			REQUIRE_EQ(fs.getWearStats(stats), FS_OK);
+			REQUIRE_EQ(stats.maxErases, flash.getMaxEraseCount());
+			REQUIRE_EQ(stats.totalErases, flash.getTotalEraseCount());
+			REQUIRE_EQ(unsigned(fs.getBlockEraseCount(stats.maxBlock)), unsigned(stats.maxErases));
+			benchReport(F("logfile"), F("meanerase"), stats.meanErases(), F("erases"));
+
+			IFS::DirHandle dir;
+			REQUIRE_EQ(fs.opendir("log", dir), FS_OK);
+			unsigned count{0};
+			IFS::NameStat stat;
+			while(fs.readdir(dir, stat) == FS_OK) {
+				++count;
+			}
+			fs.closedir(dir);
+			REQUIRE_EQ(count, logConfig.segmentCount);
+		}
+
+		TEST_CASE("Persistent wear counts")
+		{
+			REQUIRE_EQ(fs.saveWearState(), FS_OK);
+			IFS::LittleFS::WearStats saved;
+			REQUIRE_EQ(fs.getWearStats(saved), FS_OK);
+
+			IFS::LittleFS::FileSystem fs2(partition, config);
+			REQUIRE_EQ(fs2.mount(), FS_OK);
+			IFS::LittleFS::WearStats loaded;
+			REQUIRE_EQ(fs2.getWearStats(loaded), FS_OK);
+			// Saving may itself have erased blocks
+			REQUIRE(loaded.totalErases != 0);
+			REQUIRE(loaded.totalErases <= saved.totalErases);
+		}
+
+		TEST_CASE("Read after reopen")
+		{
+			IFS::LittleFS::LogFile log(fs);
+			REQUIRE_EQ(log.open("log", logConfig), FS_OK);
+
+			// Append continues from end of newest segment
+			uint8_t record[recordSize];
+			makeRecord(record, recordCount);
+			REQUIRE_EQ(log.append(record, sizeof(record)), FS_OK);
+			REQUIRE_EQ(log.flush(), FS_OK);
+
+			// Oldest records have been discarded, remainder must be consecutive
+			int len;
+			uint32_t expected{0};
+			unsigned count{0};
+			while((len = log.read(record, sizeof(record))) > 0) {
+				REQUIRE_EQ(len, int(recordSize));
+				uint32_t index;
+				memcpy(&index, record, sizeof(index));
+				if(count != 0) {
+					REQUIRE_EQ(index, expected);
+				}
+				expected = index + 1;
+				++count;
+			}
+			REQUIRE_EQ(len, 0);
+			REQUIRE_EQ(expected, recordCount + 1);
+			auto perSegment = logConfig.segmentSize / (recordSize + 2);
+			REQUIRE(count > (logConfig.segmentCount - 1) * perSegment);
+			REQUIRE(count <= logConfig.segmentCount * perSegment);
+		}
+
+		TEST_CASE("Power loss at segment rollover")
+		{
+			IFS::LittleFS::LogFile::Config smallConfig;
+			smallConfig.segmentSize = 512;
+			smallConfig.segmentCount = 2;
+			const unsigned perSegment = smallConfig.segmentSize / (recordSize + 2);
+
+			IFS::LittleFS::LogFile log(fs);
+			REQUIRE_EQ(log.open("plog", smallConfig), FS_OK);
+			uint8_t record[recordSize];
+			for(unsigned i = 0; i < perSegment; ++i) {
+				makeRecord(record, i);
+				REQUIRE_EQ(log.append(record, sizeof(record)), FS_OK);
+			}
+			REQUIRE_EQ(log.flush(), FS_OK);
+
+			// Next record needs a new segment, which cannot be created
+			flash.failAfter(1);
+			makeRecord(record, perSegment);
+			REQUIRE(log.append(record, sizeof(record)) < 0);
+			REQUIRE(!log.isOpen());
+			REQUIRE_EQ(log.getLastSegment(), 0U);
+			flash.powerOn();
+
+			IFS::LittleFS::Config config2;
+			config2.formatOnFail = false;
+			IFS::LittleFS::FileSystem fs2(partition, config2);
+			REQUIRE_EQ(fs2.mount(), FS_OK);
+			IFS::LittleFS::LogFile log2(fs2);
+			REQUIRE_EQ(log2.open("plog", smallConfig), FS_OK);
+			REQUIRE_EQ(log2.getFirstSegment(), 0U);
+
+			// Committed records survive, and appending resumes after them
+			makeRecord(record, perSegment);
+			REQUIRE_EQ(log2.append(record, sizeof(record)), FS_OK);
+			REQUIRE_EQ(log2.flush(), FS_OK);
+			int len;
+			unsigned count{0};
+			while((len = log2.read(record, sizeof(record))) > 0) {
+				REQUIRE_EQ(len, int(recordSize));
+				uint32_t index;
+				memcpy(&index, record, sizeof(index));
+				REQUIRE_EQ(index, count);
+				++count;
+			}
+			REQUIRE_EQ(len, 0);
+			REQUIRE_EQ(count, perSegment + 1);
+			REQUIRE_EQ(log2.close(), FS_OK);
+			REQUIRE_EQ(fs2.check(), FS_OK);
+		}
+	}
+
+private:
+	SimFlash flash;
+	Storage::Partition partition;
+	IFS::LittleFS::LogFile::Config logConfig;
+};
+
+void REGISTER_TEST(logfile)
+{
+	// Flash is emulated in RAM
+#ifdef ARCH_HOST
+	registerGroup<LogFileTest>();
+#endif
+}
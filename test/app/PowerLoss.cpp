@@ -0,0 +1,131 @@
+#include "report.h"
+#include "SimFlash.h"
+#include <SmingTest.h>
+#include <LittleFS.h>
+#include <LittleFS/FileSystem.h>
+
+/*
+ * Interrupt filesystem writes at various points and verify the volume remains consistent.
+ *
+ * Mount times following power loss are reported using the simulated flash timing.
+ */
+namespace
+{
+constexpr size_t flashSize{256 * 1024};
+constexpr unsigned workloadCycles{20};
+constexpr size_t recordSize{100};
+const unsigned failPoints[]{1, 2, 3, 5, 8, 13, 21, 34, 55, 89, 144};
+DEFINE_FSTR_LOCAL(baseContent, "This file is written before any simulated power loss.")
+
+} // namespace
+
+class PowerLossTest : public TestGroup
+{
+public:
+	PowerLossTest() : TestGroup(_F("Power loss")), flash("SIM", flashSize)
+	{
+		partition = flash.editablePartitions().add("sim", Storage::Partition::SubType::Data::littlefs, 0, flashSize);
+		// Must not hide failures by re-formatting
+		config.formatOnFail = false;
+	}
+
+	void execute() override
+	{
+		TEST_CASE("Create volume")
+		{
+			IFS::LittleFS::FileSystem fs(partition, config);
+			REQUIRE_EQ(fs.format(), FS_OK);
+			REQUIRE_EQ(fs.mount(), FS_OK);
+			auto file = fs.open("base.txt", File::CreateNewAlways | File::WriteOnly);
+			REQUIRE(file >= 0);
+			String s(baseContent);
+			REQUIRE_EQ(fs.write(file, s.c_str(), s.length()), int(s.length()));
+			REQUIRE_EQ(fs.close(file), FS_OK);
+		}
+
+		TEST_CASE("Interrupted writes")
+		{
+			for(auto failPoint : failPoints) {
+				interrupt(failPoint);
+			}
+		}
+
+		benchReport(F("powerloss"), F("maxerase"), flash.getMaxEraseCount(), F("erases"));
+		benchReport(F("powerloss"), F("totalerase"), flash.getTotalEraseCount(), F("erases"));
+		CHECK_EQ(flash.getViolations(), 0U);
+	}
+
+private:
+	/*
+	 * Append to a log file, rotating periodically, until all cycles complete or power fails.
+	 * A directory is also created and removed, as interrupting this can leave orphans.
+	 */
+	void workload(IFS::LittleFS::FileSystem& fs)
+	{
+		uint8_t record[recordSize];
+		os_get_random(record, sizeof(record));
+		for(unsigned i = 0; i < workloadCycles && flash.isPoweredOn(); ++i) {
+			auto file = fs.open("log.bin", File::Create | File::Append | File::WriteOnly);
+			if(file < 0) {
+				break;
+			}
+			fs.write(file, record, sizeof(record));
+			fs.close(file);
+			if(i % 5 == 1) {
+				fs.mkdir("tmp");
+				file = fs.open("tmp/record.bin", File::CreateNewAlways | File::WriteOnly);
+				if(file >= 0) {
+					fs.write(file, record, sizeof(record));
+					fs.close(file);
+				}
+			} else if(i % 5 == 3) {
+				fs.removeTree("tmp");
+			} else if(i % 5 == 4) {
+				fs.remove("old.bin");
+				fs.rename("log.bin", "old.bin");
+			}
+		}
+	}
+
+	void interrupt(unsigned failPoint)
+	{
+		{
+			IFS::LittleFS::FileSystem fs(partition, config);
+			REQUIRE_EQ(fs.mount(), FS_OK);
+			flash.failAfter(failPoint);
+			workload(fs);
+		}
+
+		bool failed = !flash.isPoweredOn();
+		flash.powerOn();
+		flash.resetElapsed();
+
+		IFS::LittleFS::FileSystem fs(partition, config);
+		REQUIRE_EQ(fs.mount(), FS_OK);
+		if(failed) {
+			benchReport(F("powerloss"), String(failPoint), flash.getElapsedNs() / 1000, F("us"));
+		}
+		REQUIRE_EQ(fs.check(), FS_OK);
+
+		// Content written before power loss must be intact
+		auto file = fs.open("base.txt", File::ReadOnly);
+		REQUIRE(file >= 0);
+		char buffer[128];
+		int len = fs.read(file, buffer, sizeof(buffer));
+		fs.close(file);
+		REQUIRE(len >= 0);
+		REQUIRE(String(baseContent) == String(buffer, len));
+	}
+
+	SimFlash flash;
+	Storage::Partition partition;
+	IFS::LittleFS::Config config;
+};
+
+void REGISTER_TEST(powerloss)
+{
+	// Flash is emulated in RAM
+#ifdef ARCH_HOST
+	registerGroup<PowerLossTest>();
+#endif
+}
@@ -0,0 +1,223 @@
+#pragma once
+
+#include <Storage/Device.h>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+/**
+ * @brief RAM-based NOR flash emulator for performance modelling and power-loss testing
+ *
+ * Time taken by each operation is calculated from a timing model and accumulated, rather than
+ * actually waited for, so results are repeatable and independent of the host machine.
+ *
+ * Programming follows NOR flash rules: bits can only be cleared, so writing to a location which
+ * hasn't been erased produces the logical AND of old and new data and is counted as a violation.
+ *
+ * Power loss may be simulated at any program or erase operation via `failAfter()`. The affected
+ * operation completes only partially, and all further accesses fail until `powerOn()` is called.
+ */
+class SimFlash : public Storage::Device
+{
+public:
+	/**
+	 * @brief Operation timings in nanoseconds, defaults are typical of a SPI NOR device
+	 */
+	struct Timing {
+		uint32_t readSetup{5000};		///< Per read command
+		uint32_t readByte{100};			///< Per byte read
+		uint32_t pageProgram{700000};	///< Per page (or part of) programmed
+		uint32_t sectorErase{45000000}; ///< Per sector erased
+	};
+
+	SimFlash(const String& name, size_t size, size_t sectorSize = 4096, size_t pageSize = 256)
+		: name(name), size(size), sectorSize(sectorSize), pageSize(pageSize), data(new uint8_t[size]),
+		  eraseCounts(size / sectorSize)
+	{
+		memset(data.get(), 0xff, size);
+	}
+
+	String getName() const override
+	{
+		return name;
+	}
+
+	size_t getBlockSize() const override
+	{
+		return sectorSize;
+	}
+
+	storage_size_t getSize() const override
+	{
+		return size;
+	}
+
+	Type getType() const override
+	{
+		return Type::flash;
+	}
+
+	bool read(storage_size_t address, void* dst, size_t len) override
+	{
+		if(!poweredOn || !checkRange(address, len)) {
+			return false;
+		}
+		memcpy(dst, &data[address], len);
+		elapsed += timing.readSetup + uint64_t(timing.readByte) * len;
+		return true;
+	}
+
+	bool write(storage_size_t address, const void* src, size_t len) override
+	{
+		if(!poweredOn || !checkRange(address, len)) {
+			return false;
+		}
+		bool interrupted = checkPowerLoss();
+		if(interrupted) {
+			// Only some of the data gets written
+			len = os_random() % (len + 1);
+		}
+		auto s = static_cast<const uint8_t*>(src);
+		for(size_t i = 0; i < len; ++i) {
+			auto& d = data[address + i];
+			if((d & s[i]) != s[i]) {
+				++violations;
+			}
+			d &= s[i];
+		}
+		if(len != 0) {
+			auto firstPage = address / pageSize;
+			auto lastPage = (address + len - 1) / pageSize;
+			elapsed += uint64_t(timing.pageProgram) * (lastPage - firstPage + 1);
+		}
+		++writeCount;
+		return !interrupted;
+	}
+
+	bool erase_range(storage_size_t address, storage_size_t len) override
+	{
+		if(!poweredOn || address % sectorSize != 0 || len % sectorSize != 0 || !checkRange(address, len)) {
+			return false;
+		}
+		for(; len != 0; address += sectorSize, len -= sectorSize) {
+			if(checkPowerLoss()) {
+				// Erase interrupted part-way through sector
+				memset(&data[address], 0xff, os_random() % sectorSize);
+				return false;
+			}
+			memset(&data[address], 0xff, sectorSize);
+			++eraseCounts[address / sectorSize];
+			elapsed += timing.sectorErase;
+		}
+		return true;
+	}
+
+	void setTiming(const Timing& timing)
+	{
+		this->timing = timing;
+	}
+
+	/**
+	 * @brief Get total simulated time for all operations
+	 */
+	uint64_t getElapsedNs() const
+	{
+		return elapsed;
+	}
+
+	void resetElapsed()
+	{
+		elapsed = 0;
+	}
+
+	uint32_t getEraseCount(unsigned sector) const
+	{
+		return (sector < eraseCounts.size()) ? eraseCounts[sector] : 0;
+	}
+
+	uint32_t getMaxEraseCount() const
+	{
+		uint32_t max{0};
+		for(auto count : eraseCounts) {
+			max = std::max(max, count);
+		}
+		return max;
+	}
+
+	uint64_t getTotalEraseCount() const
+	{
+		uint64_t total{0};
+		for(auto count : eraseCounts) {
+			total += count;
+		}
+		return total;
+	}
+
+	/**
+	 * @brief Number of program operations performed
+	 */
+	unsigned getWriteCount() const
+	{
+		return writeCount;
+	}
+
+	/**
+	 * @brief Number of programs which attempted to set bits without an erase
+	 */
+	unsigned getViolations() const
+	{
+		return violations;
+	}
+
+	/**
+	 * @brief Simulate power loss
+	 * @param count Power is lost during this program/erase operation, counting from 1. 0 to cancel.
+	 */
+	void failAfter(unsigned count)
+	{
+		failCountdown = count;
+	}
+
+	bool isPoweredOn() const
+	{
+		return poweredOn;
+	}
+
+	/**
+	 * @brief Restore power following simulated loss
+	 */
+	void powerOn()
+	{
+		poweredOn = true;
+		failCountdown = 0;
+	}
+
+private:
+	bool checkRange(storage_size_t address, size_t len) const
+	{
+		return address <= size && len <= size - address;
+	}
+
+	bool checkPowerLoss()
+	{
+		if(failCountdown == 0 || --failCountdown != 0) {
+			return false;
+		}
+		poweredOn = false;
+		return true;
+	}
+
+	String name;
+	size_t size;
+	size_t sectorSize;
+	size_t pageSize;
+	std::unique_ptr<uint8_t[]> data;
+	std::vector<uint32_t> eraseCounts;
+	Timing timing;
+	uint64_t elapsed{0};
+	unsigned violations{0};
+	unsigned writeCount{0};
+	unsigned failCountdown{0};
+	bool poweredOn{true};
+};
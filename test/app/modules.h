@@ -1,3 +1,3 @@
 // List of test modules to register
 
-#define TEST_MAP(XX) XX(basic)
+#define TEST_MAP(XX) XX(basic) XX(benchmark) XX(powerloss) XX(compress) XX(logfile)
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <SmingCore.h>
+
+/*
+ * Output a machine-readable benchmark result as a line of the form:
+ *
+ * 	BENCH,<test>,<parameter>,<value>,<unit>
+ *
+ * so results can be extracted from the log and compared between releases.
+ */
+inline void benchReport(const String& test, const String& parameter, uint64_t value, const String& unit)
+{
+	Serial << _F("BENCH,") << test << ',' << parameter << ',' << value << ',' << unit << endl;
+}
@@ -8,6 +8,11 @@ endif
 HOST_NETWORK_OPTIONS := --nonet
 DISABLE_NETWORK := 1
 
+# Threads are available on Host, so tests can exercise locking
+ifeq ($(SMING_ARCH),Host)
+LFS_ENABLE_LOCKING ?= 1
+endif
+
 COMPONENT_DEPENDS := \
 	SmingTest \
 	LittleFS
@@ -29,5 +34,11 @@ endif
 endif
 APP_CFLAGS += -DRESTART_DELAY=$(RESTART_DELAY)
 
+# On Host, run benchmarks against a simulated flash device and include its access times in results
+# Set to 0 to use a file-backed device, which has no access cost
+CONFIG_VARS += BENCHMARK_SIMFLASH
+BENCHMARK_SIMFLASH ?= 1
+APP_CFLAGS += -DBENCHMARK_SIMFLASH=$(BENCHMARK_SIMFLASH)
+
 .PHONY: execute
 execute: flash run
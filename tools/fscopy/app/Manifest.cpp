@@ -0,0 +1,111 @@
+#include "Manifest.h"
+#include <FileSystem.h>
+#include <memory>
+
+namespace
+{
+uint32_t crc32(uint32_t crc, const void* data, size_t len)
+{
+	auto p = static_cast<const uint8_t*>(data);
+	crc = ~crc;
+	while(len-- != 0) {
+		crc ^= *p++;
+		for(unsigned i = 0; i < 8; ++i) {
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+		}
+	}
+	return ~crc;
+}
+
+} // namespace
+
+bool Manifest::load(IFS::FileSystem& fs, const String& filename)
+{
+	entries.clear();
+	String content = fs.getContent(filename);
+	if(!content) {
+		return false;
+	}
+
+	auto line = content.c_str();
+	if(sscanf(line, "# %u %u", &imageSize, &blockSize) != 2) {
+		return false;
+	}
+	while((line = strchr(line, '\n')) != nullptr) {
+		++line;
+		Entry entry;
+		int pathOffset{0};
+		if(sscanf(line, "%x %u %n", &entry.crc, &entry.size, &pathOffset) != 2 || pathOffset == 0) {
+			continue;
+		}
+		auto path = line + pathOffset;
+		auto end = strchr(path, '\n');
+		entries[end ? String(path, end - path) : String(path)] = entry;
+	}
+	return true;
+}
+
+int Manifest::save(IFS::FileSystem& fs, const String& filename) const
+{
+	String content;
+	content += "# ";
+	content += imageSize;
+	content += ' ';
+	content += blockSize;
+	content += '\n';
+	char buf[32];
+	for(unsigned i = 0; i < entries.count(); ++i) {
+		auto& entry = entries.valueAt(i);
+		m_snprintf(buf, sizeof(buf), "%08x %u ", entry.crc, entry.size);
+		content += buf;
+		content += entries.keyAt(i);
+		content += '\n';
+	}
+	return fs.setContent(filename, content);
+}
+
+bool Manifest::scan(IFS::IFileSystem& fs, const String& path)
+{
+	IFS::DirHandle dir;
+	int err = fs.opendir(path.c_str(), dir);
+	if(err < 0) {
+		return false;
+	}
+
+	constexpr size_t bufSize{4096};
+	std::unique_ptr<uint8_t[]> buffer(new uint8_t[bufSize]);
+	bool res{true};
+	IFS::NameStat stat;
+	while(res && fs.readdir(dir, stat) >= 0) {
+		String childPath = path;
+		if(childPath) {
+			childPath += '/';
+		}
+		childPath += String(stat.name);
+		if(stat.attr[IFS::FileAttribute::Directory]) {
+			res = scan(fs, childPath);
+			continue;
+		}
+
+		auto file = fs.open(childPath.c_str(), File::ReadOnly);
+		if(file < 0) {
+			res = false;
+			break;
+		}
+		Entry entry{0, 0};
+		int len;
+		while((len = fs.read(file, buffer.get(), bufSize)) > 0) {
+			entry.crc = crc32(entry.crc, buffer.get(), len);
+			entry.size += len;
+		}
+		fs.close(file);
+		if(len < 0) {
+			res = false;
+			break;
+		}
+		entries[childPath] = entry;
+	}
+
+	fs.closedir(dir);
+	return res;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <IFS/FileSystem.h>
+#include <WHashMap.h>
+
+/*
+ * Records the source files used to build an image so it can be updated incrementally
+ *
+ * Stored as a text file, one line per file: `crc size path`.
+ * The first line records the image size and block size: if these change then the image is rebuilt.
+ */
+class Manifest
+{
+public:
+	struct Entry {
+		uint32_t crc;
+		uint32_t size;
+
+		bool operator==(const Entry& other) const
+		{
+			return crc == other.crc && size == other.size;
+		}
+	};
+
+	/*
+	 * Load manifest from a file
+	 * @retval bool false if file is missing or invalid
+	 */
+	bool load(IFS::FileSystem& fs, const String& filename);
+
+	/*
+	 * Write manifest to a file
+	 */
+	int save(IFS::FileSystem& fs, const String& filename) const;
+
+	/*
+	 * Add entries for all files in a filesystem
+	 */
+	bool scan(IFS::IFileSystem& fs, const String& path = nullptr);
+
+	HashMap<String, Entry> entries;
+	uint32_t imageSize{0};
+	uint32_t blockSize{0};
+};
@@ -3,10 +3,189 @@
 #include <Storage/FileDevice.h>
 #include <IFS/FileCopier.h>
 #include <hostlib/CommandLine.h>
+#include "Manifest.h"
+#include <LittleFS/Delta.h>
 
 namespace
 {
-bool fscopy(const char* srcFile, const char* dstFile, size_t dstSize)
+/*
+ * Image is built in RAM then written out in one go.
+ *
+ * Going through a FileDevice costs a host file seek and write for every program operation,
+ * which makes large images very slow to build. The filesystem code is identical either way
+ * so the resulting images are too.
+ */
+class MemoryDevice : public Storage::Device
+{
+public:
+	MemoryDevice(const String& name, size_t size) : name(name), size(size), data(new uint8_t[size])
+	{
+		memset(data.get(), 0xff, size);
+	}
+
+	String getName() const override
+	{
+		return name;
+	}
+
+	// Same as FileDevice, so default geometry is unchanged
+	size_t getBlockSize() const override
+	{
+		return sizeof(uint32_t);
+	}
+
+	storage_size_t getSize() const override
+	{
+		return size;
+	}
+
+	Type getType() const override
+	{
+		return Type::sysmem;
+	}
+
+	bool read(storage_size_t address, void* dst, size_t len) override
+	{
+		if(!checkRange(address, len)) {
+			return false;
+		}
+		memcpy(dst, &data[address], len);
+		return true;
+	}
+
+	bool write(storage_size_t address, const void* src, size_t len) override
+	{
+		if(!checkRange(address, len)) {
+			return false;
+		}
+		memcpy(&data[address], src, len);
+		return true;
+	}
+
+	bool erase_range(storage_size_t address, storage_size_t len) override
+	{
+		if(!checkRange(address, len)) {
+			return false;
+		}
+		memset(&data[address], 0xff, len);
+		return true;
+	}
+
+	uint8_t* getData()
+	{
+		return data.get();
+	}
+
+private:
+	bool checkRange(storage_size_t address, size_t len) const
+	{
+		return address <= size && len <= size - address;
+	}
+
+	String name;
+	size_t size;
+	std::unique_ptr<uint8_t[]> data;
+};
+
+struct Options {
+	IFS::LittleFS::Config config;
+	bool direct{false}; ///< Write directly to output file instead of building in RAM
+	bool update{false}; ///< Update existing image where possible
+};
+
+/*
+ * Parse optional settings of the form `name=value`
+ */
+bool parseOption(const char* param, Options& options)
+{
+	auto sep = strchr(param, '=');
+	if(sep == nullptr) {
+		return false;
+	}
+	String name(param, sep - param);
+	auto value = strtoul(sep + 1, nullptr, 0);
+	auto& config = options.config;
+	if(name == "direct") {
+		options.direct = (value != 0);
+	} else if(name == "update") {
+		options.update = (value != 0);
+	} else if(name == "compress") {
+		config.compressNewFiles = (value != 0);
+	} else if(name == "blocksize") {
+		config.blockSize = value;
+	} else if(name == "readsize") {
+		config.readSize = value;
+	} else if(name == "progsize") {
+		config.progSize = value;
+	} else if(name == "cachesize") {
+		config.cacheSize = value;
+	} else if(name == "lookahead") {
+		config.lookaheadSize = value;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Load existing image into memory for updating
+ */
+bool loadImage(const char* filename, MemoryDevice& device)
+{
+	auto& hostfs = IFS::Host::getFileSystem();
+	auto file = hostfs.open(filename, File::ReadOnly);
+	if(file < 0) {
+		return false;
+	}
+	auto size = device.getSize();
+	auto len = hostfs.read(file, device.getData(), size);
+	hostfs.close(file);
+	return len == int(size);
+}
+
+/*
+ * Create any missing parent directories for a file
+ */
+void createParents(IFS::IFileSystem& fs, const String& path)
+{
+	for(int i = 0; (i = path.indexOf('/', i)) > 0; ++i) {
+		fs.mkdir(path.substring(0, i).c_str());
+	}
+}
+
+/*
+ * Bring image up to date with changes to source files
+ */
+bool updateFiles(IFS::FileCopier& copier, IFS::IFileSystem& dstfs, const Manifest& oldManifest,
+				 const Manifest& newManifest)
+{
+	bool res{true};
+	unsigned removed{0};
+	for(unsigned i = 0; i < oldManifest.entries.count(); ++i) {
+		auto& path = oldManifest.entries.keyAt(i);
+		if(!newManifest.entries.contains(path)) {
+			dstfs.remove(path.c_str());
+			++removed;
+		}
+	}
+
+	unsigned changed{0};
+	for(unsigned i = 0; res && i < newManifest.entries.count(); ++i) {
+		auto& path = newManifest.entries.keyAt(i);
+		int oldIndex = oldManifest.entries.indexOf(path);
+		if(oldIndex >= 0 && oldManifest.entries.valueAt(oldIndex) == newManifest.entries.valueAt(i)) {
+			continue;
+		}
+		createParents(dstfs, path);
+		res = copier.copyFile(path, path);
+		++changed;
+	}
+
+	Serial << "Updated " << changed << " files, removed " << removed << endl;
+	return res;
+}
+
+bool fscopy(const char* srcFile, const char* dstFile, size_t dstSize, const Options& options)
 {
 	auto& hostfs = IFS::Host::getFileSystem();
 
@@ -17,22 +196,81 @@ bool fscopy(const char* srcFile, const char* dstFile, size_t dstSize)
 		return false;
 	}
 
+	Manifest newManifest;
+	newManifest.imageSize = dstSize;
+	newManifest.blockSize = options.config.blockSize;
+	if(!newManifest.scan(*srcfs)) {
+		Serial << _F("Error reading '") << srcFile << "'" << endl;
+		delete srcfs;
+		return false;
+	}
+
+	// Existing image may be used if it was built with the same settings
+	String manifestFile = String(dstFile) + ".manifest";
+	std::unique_ptr<MemoryDevice> memDevice;
+	Manifest oldManifest;
+	bool update{false};
+	if(!options.direct) {
+		memDevice.reset(new MemoryDevice("DST", dstSize));
+		if(options.update && oldManifest.load(hostfs, manifestFile) && oldManifest.imageSize == dstSize &&
+		   oldManifest.blockSize == newManifest.blockSize) {
+			update = loadImage(dstFile, *memDevice);
+			if(!update) {
+				memDevice->erase_range(0, dstSize);
+			}
+		}
+	}
+
 	// Destination
 	auto file = hostfs.open(dstFile, File::CreateNewAlways | File::ReadWrite);
 	if(file < 0) {
 		Serial << _F("Error opening '") << dstFile << "', " << hostfs.getErrorString(file) << endl;
+		delete srcfs;
+		return false;
+	}
+	// FileDevice takes ownership of file
+	std::unique_ptr<Storage::Device> dstDevice;
+	if(options.direct) {
+		dstDevice.reset(new Storage::FileDevice("DST", hostfs, file, dstSize));
+		dstDevice->erase_range(0, dstSize);
+	}
+	auto& device = memDevice ? *memDevice : *dstDevice;
+	auto part = device.editablePartitions().add("dst", Storage::Partition::SubType::Data::littlefs, 0, dstSize);
+
+	// Don't silently discard content of an existing image
+	auto config = options.config;
+	config.formatOnFail = !update;
+	auto dstfs = IFS::createLfsFilesystem(part, config);
+	int err = dstfs->mount();
+	if(err < 0 && update) {
+		Serial << _F("Existing image unusable, rebuilding: ") << dstfs->getErrorString(err) << endl;
+		update = false;
+		memDevice->erase_range(0, dstSize);
+		err = dstfs->format();
+		if(err >= 0) {
+			err = dstfs->mount();
+		}
+	}
+	if(err < 0) {
+		Serial << _F("Mount failed: ") << dstfs->getErrorString(err) << endl;
+		delete dstfs;
+		delete srcfs;
+		if(memDevice) {
+			hostfs.close(file);
+		}
+		return false;
 	}
-	Storage::FileDevice dstDevice("DST", hostfs, file, dstSize);
-	dstDevice.erase_range(0, dstSize);
-	auto part = dstDevice.editablePartitions().add("dst", Storage::Partition::SubType::Data::littlefs, 0, dstSize);
-	auto dstfs = IFS::createLfsFilesystem(part);
-	dstfs->mount();
 
 	IFS::Profiler profiler;
 	dstfs->setProfiler(&profiler);
 
 	IFS::FileCopier copier(*srcfs, *dstfs);
-	bool res = copier.copyDir(nullptr, nullptr);
+	bool res;
+	if(update) {
+		res = updateFiles(copier, *dstfs, oldManifest, newManifest);
+	} else {
+		res = copier.copyDir(nullptr, nullptr);
+	}
 	dstfs->setProfiler(nullptr);
 
 	IFS::FileSystem::Info srcinfo;
@@ -43,6 +281,22 @@ bool fscopy(const char* srcFile, const char* dstFile, size_t dstSize)
 	delete dstfs;
 	delete srcfs;
 
+	if(memDevice) {
+		int len = hostfs.write(file, memDevice->getData(), dstSize);
+		if(len != int(dstSize)) {
+			Serial << _F("Error writing '") << dstFile << "', " << hostfs.getErrorString(len) << endl;
+			res = false;
+		}
+		hostfs.close(file);
+	}
+
+	// Without a valid manifest the next update does a full rebuild
+	if(res) {
+		newManifest.save(hostfs, manifestFile);
+	} else {
+		hostfs.remove(manifestFile);
+	}
+
 	auto kb = [](file_size_t size) { return (size + 1023) / 1024; };
 
 	Serial << "Source " << srcinfo.type << " size: " << kb(srcinfo.used()) << " KB; Output " << dstinfo.type
@@ -53,6 +307,59 @@ bool fscopy(const char* srcFile, const char* dstFile, size_t dstSize)
 	return res;
 }
 
+/*
+ * Create a delta containing blocks which differ between two images of the same size
+ */
+bool fsdiff(const char* baseFile, const char* targetFile, const char* deltaFile, size_t blockSize)
+{
+	namespace Delta = IFS::LittleFS::Delta;
+	auto& hostfs = IFS::Host::getFileSystem();
+
+	String base = hostfs.getContent(baseFile);
+	String target = hostfs.getContent(targetFile);
+	if(!base || !target) {
+		Serial << _F("Error reading images") << endl;
+		return false;
+	}
+	if(base.length() != target.length() || target.length() % blockSize != 0) {
+		Serial << _F("Images must be the same size, a multiple of ") << blockSize << _F(" bytes") << endl;
+		return false;
+	}
+
+	Delta::Header header{};
+	header.magic = Delta::magic;
+	header.blockSize = blockSize;
+	header.blockCount = target.length() / blockSize;
+	header.baseCrc = Delta::crc(0xffffffff, base.c_str(), base.length());
+	header.targetCrc = Delta::crc(0xffffffff, target.c_str(), target.length());
+
+	String records;
+	for(uint32_t block = 0; block < header.blockCount; ++block) {
+		auto offset = block * blockSize;
+		if(memcmp(&base[offset], &target[offset], blockSize) == 0) {
+			continue;
+		}
+		records.concat(reinterpret_cast<const char*>(&block), sizeof(block));
+		records.concat(&target[offset], blockSize);
+		++header.recordCount;
+	}
+	header.headerCrc = Delta::crc(0xffffffff, &header, offsetof(Delta::Header, headerCrc));
+
+	auto file = hostfs.open(deltaFile, File::CreateNewAlways | File::WriteOnly);
+	if(file < 0) {
+		Serial << _F("Error opening '") << deltaFile << "', " << hostfs.getErrorString(file) << endl;
+		return false;
+	}
+	bool res = hostfs.write(file, &header, sizeof(header)) == int(sizeof(header)) &&
+			   hostfs.write(file, records.c_str(), records.length()) == int(records.length());
+	hostfs.close(file);
+
+	Serial << "Delta contains " << header.recordCount << " of " << header.blockCount << " blocks, "
+		   << sizeof(header) + records.length() << " bytes" << endl;
+
+	return res;
+}
+
 }; // namespace
 
 void init()
@@ -62,11 +369,25 @@ void init()
 	Serial.systemDebugOutput(true);
 
 	auto parameters = commandLine.getParameters();
-	if(parameters.count() != 3) {
-		m_printf("Usage: fscopy <source file> <dest file> <dest size>\r\n");
+	bool diff = (parameters.count() != 0 && strcmp(parameters[0].text, "diff") == 0);
+	unsigned firstOption = diff ? 4 : 3;
+	Options options;
+	bool ok = (parameters.count() >= firstOption);
+	for(unsigned i = firstOption; ok && i < parameters.count(); ++i) {
+		ok = parseOption(parameters[i].text, options);
+	}
+	if(!ok) {
+		m_printf("Usage: fscopy <source file> <dest file> <dest size> [blocksize=N] [readsize=N] [progsize=N] "
+				 "[cachesize=N] [lookahead=N] [direct=1] [update=1] [compress=1]\r\n"
+				 "       fscopy diff <base image> <target image> <delta file> [blocksize=N]\r\n");
+	} else if(diff) {
+		auto blockSize = options.config.blockSize ?: IFS::LittleFS::LFS_BLOCK_SIZE;
+		if(!fsdiff(parameters[1].text, parameters[2].text, parameters[3].text, blockSize)) {
+			exit(2);
+		}
 	} else {
 		auto size = strtoul(parameters[2].text, nullptr, 0);
-		auto res = fscopy(parameters[0].text, parameters[1].text, size);
+		auto res = fscopy(parameters[0].text, parameters[1].text, size, options);
 		if(!res) {
 			exit(2);
 		}